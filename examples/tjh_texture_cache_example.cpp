@@ -79,8 +79,7 @@ int main(int argc, char const *argv[])
             }
         }
 
-        // Try to reload all images in the cache
-        // NOTE: this is a bad idea to do every frame in real code!
+        // Reload any images whose files have changed, only changed files are decoded
         Texture::cacheReload();
 
         // Clear the screen to black
@@ -0,0 +1,158 @@
+// Fills tjh_texture_cache's cooked cache for every image under an asset directory, so even
+// the first run of the game uploads textures without decoding them. Images are cooked in
+// parallel and ones already in the cache are skipped.
+//
+// tjh_texture_cooker <asset directory> <cache directory> [-channels 1-4] [-mipmaps none|gpu|cpu] [-threads n]
+//
+// The game has to load with the same channels and mipmaps, or it won't find the cooked files.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define TJH_TEXTURE_CACHE_IMPLEMENTATION
+#include "../tjh_texture_cache.h"
+
+// Anything stb_image can decode
+static bool is_image( const std::string& filename )
+{
+    static const char* extensions[] = { ".png", ".jpg", ".jpeg", ".tga", ".bmp", ".psd", ".gif", ".hdr", ".pic", ".ppm", ".pgm" };
+
+    std::string lower = filename;
+    std::transform( lower.begin(), lower.end(), lower.begin(), ::tolower );
+    for( const char* extension : extensions )
+    {
+        const size_t length = strlen( extension );
+        if( lower.size() > length && lower.compare( lower.size() - length, length, extension ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void find_images( const std::string& directory, std::vector<std::string>& images )
+{
+    DIR* dir = opendir( directory.c_str() );
+    if( !dir )
+    {
+        printf( "ERROR: couldn't open directory '%s'\n", directory.c_str() );
+        return;
+    }
+
+    while( struct dirent* entry = readdir( dir ) )
+    {
+        // Skips '.', '..' and hidden files
+        if( entry->d_name[0] == '.' )
+        {
+            continue;
+        }
+
+        const std::string path = directory + "/" + entry->d_name;
+        struct stat status;
+        if( stat( path.c_str(), &status ) != 0 )
+        {
+            continue;
+        }
+        if( S_ISDIR( status.st_mode ) )
+        {
+            find_images( path, images );
+        }
+        else if( is_image( path ) )
+        {
+            images.push_back( path );
+        }
+    }
+    closedir( dir );
+}
+
+static void print_usage()
+{
+    printf( "usage: tjh_texture_cooker <asset directory> <cache directory> [-channels 1-4] [-mipmaps none|gpu|cpu] [-threads n]\n" );
+}
+
+int main( int argc, char const *argv[] )
+{
+    if( argc < 3 )
+    {
+        print_usage();
+        return 1;
+    }
+
+    const std::string assets = argv[1];
+    const std::string cache = argv[2];
+    Texture::LoadOptions options;
+    int thread_count = std::max( 1, static_cast<int>(std::thread::hardware_concurrency()) );
+
+    for( int i = 3; i + 1 < argc; i += 2 )
+    {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if( option == "-channels" && value.size() == 1 && value[0] >= '1' && value[0] <= '4' )
+        {
+            options.channels = static_cast<char>(value[0] - '0');
+        }
+        else if( option == "-mipmaps" && (value == "none" || value == "gpu" || value == "cpu") )
+        {
+            options.mipmaps = value == "cpu" ? Texture::CPU_MIPMAPS : value == "gpu" ? Texture::GPU_MIPMAPS : Texture::NO_MIPMAPS;
+        }
+        else if( option == "-threads" && atoi( value.c_str() ) > 0 )
+        {
+            thread_count = atoi( value.c_str() );
+        }
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    if( (argc - 3) % 2 != 0 )
+    {
+        print_usage();
+        return 1;
+    }
+
+    mkdir( cache.c_str(), 0755 );
+    Texture::setCookedCacheDirectory( cache );
+
+    std::vector<std::string> images;
+    find_images( assets, images );
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Each thread takes the next image until there are none left
+    std::atomic<size_t> next( 0 );
+    std::atomic<size_t> failed( 0 );
+    std::vector<std::thread> threads;
+    for( int i = 0; i < thread_count; i++ )
+    {
+        threads.emplace_back( [&]() {
+            for( size_t image = next++; image < images.size(); image = next++ )
+            {
+                if( !Texture::cook( images[image], options ) )
+                {
+                    failed++;
+                }
+            }
+        });
+    }
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+
+    const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    printf( "Cooked %zu images into '%s' in %.2fs, %zu failed\n", images.size() - failed, cache.c_str(), seconds, failed.load() );
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Count every allocation tjh_draw makes
+static size_t allocation_count = 0;
+static void* counting_malloc( size_t size )
+{
+    allocation_count++;
+    return malloc( size );
+}
+
+#define TJH_DRAW_MALLOC counting_malloc
+#define TJH_DRAW_IMPLEMENTATION
+#include "../tjh_draw.h"
+
+static void draw_frame( int frame )
+{
+    draw::clear( 0.1f, 0.1f, 0.1f );
+
+    draw::setColor( 1.0f, 0.5f, 0.0f );
+    for( int i = 0; i < 100; i++ )
+    {
+        draw::rect( i * 3.0f, frame % 100, 2.0f, 2.0f );
+        draw::circle( i * 3.0f, 50.0f, 4.0f );
+    }
+
+    draw::text( "Hello from the allocation test!\nSecond line", 10, 10 );
+
+    GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    draw::setMVPMatrix( identity );
+    draw::sphere( 0.0f, 0.0f, 0.0f, 0.5f, 3 );
+    draw::cylinder( -0.5f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.1f );
+    for( int i = 0; i < 500; i++ )
+    {
+        draw::debugLine( -1.0f, i / 500.0f, 0.0f, 1.0f, i / 500.0f, 0.0f );
+    }
+
+    draw::present();
+}
+
+TEST_CASE( "drawing does not allocate after warm up", "[draw]" )
+{
+    REQUIRE( draw::init( "tjh_draw_test", 320, 240 ) );
+    draw::setVsync( false );
+    draw::reserve( 16 * 1024, 1024 );
+
+    for( int frame = 0; frame < 10; frame++ )
+    {
+        draw_frame( frame );
+    }
+
+    const size_t allocations_after_warm_up = allocation_count;
+
+    for( int frame = 0; frame < 1000; frame++ )
+    {
+        draw_frame( frame );
+    }
+
+    REQUIRE( allocation_count == allocations_after_warm_up );
+
+    draw::shutdown();
+}
+
+TEST_CASE( "hsv and hsl convert to rgb", "[draw][colour]" )
+{
+    const float hsv[] = {
+        0.0f,        1.0f, 1.0f,
+        1.0f / 3.0f, 1.0f, 1.0f,
+        2.0f / 3.0f, 1.0f, 0.5f,
+        0.5f,        0.0f, 0.25f };
+    float rgba[16];
+    draw::hsvToRgba( hsv, rgba, 4 );
+
+    REQUIRE( rgba[0] == Approx( 1.0f ) );  REQUIRE( rgba[1] == Approx( 0.0f ) );  REQUIRE( rgba[2] == Approx( 0.0f ) );
+    REQUIRE( rgba[4] == Approx( 0.0f ) );  REQUIRE( rgba[5] == Approx( 1.0f ) );  REQUIRE( rgba[6] == Approx( 0.0f ) );
+    REQUIRE( rgba[8] == Approx( 0.0f ) );  REQUIRE( rgba[9] == Approx( 0.0f ) );  REQUIRE( rgba[10] == Approx( 0.5f ) );
+    REQUIRE( rgba[12] == Approx( 0.25f ) ); REQUIRE( rgba[13] == Approx( 0.25f ) ); REQUIRE( rgba[14] == Approx( 0.25f ) );
+    REQUIRE( rgba[15] == Approx( 1.0f ) );
+
+    const float hsl[] = {
+        0.0f,        1.0f, 0.5f,
+        2.0f / 3.0f, 1.0f, 0.25f };
+    draw::hslToRgba( hsl, rgba, 2 );
+
+    REQUIRE( rgba[0] == Approx( 1.0f ) ); REQUIRE( rgba[1] == Approx( 0.0f ) ); REQUIRE( rgba[2] == Approx( 0.0f ) );
+    REQUIRE( rgba[4] == Approx( 0.0f ) ); REQUIRE( rgba[5] == Approx( 0.0f ) ); REQUIRE( rgba[6] == Approx( 0.5f ) );
+}
+
+TEST_CASE( "palettes blend between their stops", "[draw][colour]" )
+{
+    const float stops[] = {
+        0.0f, 0.0f, 0.0f, 1.0f,
+        1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f, 1.0f, 1.0f, 1.0f };
+    draw::Palette palette;
+    draw::makePalette( &palette, stops, 3 );
+
+    const float values[] = { 0.0f, 0.5f, 1.0f, 2.0f };
+    float rgba[16];
+    draw::paletteToRgba( palette, values, rgba, 4 );
+
+    REQUIRE( rgba[0] == Approx( 0.0f ) );
+    REQUIRE( rgba[4] == Approx( 1.0f ).epsilon( 0.01 ) );
+    REQUIRE( rgba[5] == Approx( 0.0f ).margin( 0.01 ) );
+    REQUIRE( rgba[9] == Approx( 1.0f ) );
+    REQUIRE( rgba[13] == Approx( 1.0f ) ); // Clamped
+}
+
+TEST_CASE( "debug lines stay visible for every frame they are kept", "[draw][debug]" )
+{
+    REQUIRE( draw::init( "tjh_draw_test", 320, 240 ) );
+
+    GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    draw::setMVPMatrix( identity );
+    draw::setColor( 1.0f, 1.0f, 1.0f );
+    draw::debugLinesDepthTest = true;
+
+    // A horizontal line across the middle of the window, kept for five frames
+    draw::debugLine( -1.0f, 0.01f, 0.0f, 1.0f, 0.01f, 0.0f, 5 );
+
+    for( int frame = 0; frame < 5; frame++ )
+    {
+        draw::clear( 0.0f, 0.0f, 0.0f );
+        draw::flushDebugLines();
+
+        // Read a few rows around the middle before swapping, the line must be in one of them
+        unsigned char pixels[5 * 4] = {};
+        glReadPixels( 160, 118, 1, 5, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+        int brightest = 0;
+        for( int i = 0; i < 5; i++ )
+        {
+            brightest = std::max( brightest, static_cast<int>(pixels[i * 4]) );
+        }
+        REQUIRE( brightest > 0 );
+
+        SDL_GL_SwapWindow( draw::sdl_window );
+    }
+
+    REQUIRE( draw::debugLineCount() == 0 );
+
+    draw::shutdown();
+}
+
+TEST_CASE( "3d lines and quads are drawn solid in wireframe mode", "[draw][3d]" )
+{
+    REQUIRE( draw::init( "tjh_draw_test", 320, 240 ) );
+
+    GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    draw::setMVPMatrix( identity );
+    draw::setViewDirection( 0.0f, 0.0f, 1.0f );
+    draw::setColor( 1.0f, 1.0f, 1.0f );
+    draw::lineWidth = 0.1f;
+    draw::wireframe = true;
+
+    auto pixel = []( int x, int y ) {
+        unsigned char rgba[4] = {};
+        glReadPixels( x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba );
+        return static_cast<int>(rgba[0]);
+    };
+
+    // A line across the left half and a quad in the middle of the right half
+    draw::clear( 0.0f, 0.0f, 0.0f );
+    draw::line( -1.0f, 0.0f, 0.0f, -0.1f, 0.0f, 0.0f );
+    draw::quad( 0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.5f, 0.5f );
+    draw::flush();
+
+    REQUIRE( pixel( 40, 120 ) > 0 );
+    REQUIRE( pixel( 240, 120 ) > 0 );
+    REQUIRE( pixel( 160, 20 ) == 0 );
+
+    draw::wireframe = false;
+    draw::lineWidth = 1.0f;
+    draw::shutdown();
+}
@@ -0,0 +1,778 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TJH_SHADER_IMPLEMENTATION
+#include "../tjh_shader.h"
+
+// Compute shaders need GL 4.3, Mesa's llvmpipe provides 4.5 so this runs without a GPU
+// e.g. LIBGL_ALWAYS_SOFTWARE=1 ./a.out
+static SDL_Window* window = nullptr;
+static SDL_GLContext context = nullptr;
+
+static bool create_compute_context()
+{
+    if( context ) {
+        return true;
+    }
+
+    SDL_Init( SDL_INIT_VIDEO );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 4 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+
+    window = SDL_CreateWindow( "tjh_shader_test", 0, 0, 16, 16, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN );
+    if( !window ) {
+        return false;
+    }
+    context = SDL_GL_CreateContext( window );
+    if( !context ) {
+        return false;
+    }
+
+    glewExperimental = GL_TRUE;
+    return glewInit() == GLEW_OK;
+}
+
+// Every file in 'directory', with the directory in front
+static std::vector<std::string> list_files( const std::string& directory )
+{
+    std::vector<std::string> files;
+    DIR* dir = opendir( directory.c_str() );
+    while( dir ) {
+        struct dirent* entry = readdir( dir );
+        if( !entry ) {
+            break;
+        }
+        if( entry->d_name[0] != '.' ) {
+            files.push_back( directory + "/" + entry->d_name );
+        }
+    }
+    if( dir ) {
+        closedir( dir );
+    }
+    return files;
+}
+
+static void write_file( const std::string& path, const std::string& content )
+{
+    FILE* file = fopen( path.c_str(), "wb" );
+    REQUIRE( file );
+    fwrite( content.data(), 1, content.size(), file );
+    fclose( file );
+}
+
+static const char* simple_vertex_source =
+    "#version 330\n"
+    "in vec3 pos;\n"
+    "void main() { gl_Position = vec4( pos, 1.0 ); }\n";
+static const char* simple_fragment_source =
+    "#version 330\n"
+    "out vec4 colour;\n"
+    "void main() { colour = vec4( 1.0 ); }\n";
+
+TEST_CASE( "compute shaders dispatch over storage buffers", "[shader][compute]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the compute shader test" );
+        return;
+    }
+
+    Shader shader;
+    shader.setComputeSourceString(
+        "#version 430\n"
+        "layout(local_size_x = 64) in;\n"
+        "layout(std430, binding = 3) buffer Values { float values[]; };\n"
+        "uniform float scale;\n"
+        "void main() { values[gl_GlobalInvocationID.x] *= scale; }\n" );
+    REQUIRE( shader.compileAndLink() );
+    REQUIRE( shader.getStages() == GL_COMPUTE_SHADER_BIT );
+
+    // The work group size comes from reflection
+    REQUIRE( shader.getWorkGroupSize()[0] == 64 );
+    REQUIRE( shader.getWorkGroupSize()[1] == 1 );
+    REQUIRE( shader.getWorkGroupSize()[2] == 1 );
+
+    // Build stats are recorded and show up in the report
+    shader.setName( "scale.comp" );
+    REQUIRE( shader.getStats().active_uniforms == 1 );
+    REQUIRE( Shader::getStatsJson().find( "\"name\":\"scale.comp\"" ) != std::string::npos );
+
+    const int count = 1000;
+    std::vector<float> values( count );
+    for( int i = 0; i < count; i++ ) {
+        values[i] = static_cast<float>(i);
+    }
+
+    GLuint buffer = 0;
+    glGenBuffers( 1, &buffer );
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, buffer );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, count * sizeof(float), values.data(), GL_DYNAMIC_COPY );
+
+    REQUIRE( shader.bindStorageBuffer( "Values", buffer ) );
+    shader.bind();
+    shader.setFloat( "scale", 2.0f );
+
+    // Two dispatches in a row, the second reads the first's writes through the storage
+    // buffer, and only the results are read back with glGetBufferSubData
+    shader.dispatchThreads( count, 1, 1, GL_SHADER_STORAGE_BARRIER_BIT );
+    Shader::memoryBarrier();
+    shader.dispatchThreads( count, 1, 1, GL_BUFFER_UPDATE_BARRIER_BIT );
+    Shader::memoryBarrier();
+
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, buffer );
+    glGetBufferSubData( GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(float), values.data() );
+    for( int i = 0; i < count; i++ ) {
+        REQUIRE( values[i] == Approx( i * 4.0f ) );
+    }
+
+    glDeleteBuffers( 1, &buffer );
+}
+
+TEST_CASE( "warming up a shader leaves GL state as it was", "[shader][warmup]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the warm up test" );
+        return;
+    }
+
+    Shader shader;
+    shader.setVertexSourceString(
+        "#version 330\n"
+        "in vec3 pos;\n"
+        "void main() { gl_Position = vec4( pos, 1.0 ); }\n" );
+    shader.setFragmentSourceString(
+        "#version 330\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( 1.0 ); }\n" );
+    REQUIRE( shader.compileAndLink() );
+
+    VertexLayout layout;
+    REQUIRE( layout.init( shader, { {"pos", 3, GL_FLOAT, GL_FALSE} } ) );
+    shader.addWarmUpLayout( layout );
+
+    GLuint vao = 0;
+    glGenVertexArrays( 1, &vao );
+    glBindVertexArray( vao );
+    glViewport( 0, 0, 16, 16 );
+    GLuint renderbuffer = 0;
+    glGenRenderbuffers( 1, &renderbuffer );
+    glBindRenderbuffer( GL_RENDERBUFFER, renderbuffer );
+
+    REQUIRE( shader.warmUp() );
+    REQUIRE( Shader::warmUpAll() >= 1 );
+
+    GLint bound = -1;
+    glGetIntegerv( GL_VERTEX_ARRAY_BINDING, &bound );
+    REQUIRE( bound == static_cast<GLint>(vao) );
+    glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &bound );
+    REQUIRE( bound == 0 );
+    GLint viewport[4] = {};
+    glGetIntegerv( GL_VIEWPORT, viewport );
+    REQUIRE( viewport[2] == 16 );
+    glGetIntegerv( GL_RENDERBUFFER_BINDING, &bound );
+    REQUIRE( bound == static_cast<GLint>(renderbuffer) );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+
+    glDeleteRenderbuffers( 1, &renderbuffer );
+    glDeleteVertexArrays( 1, &vao );
+}
+
+TEST_CASE( "directives in comments are not preprocessed", "[shader][preprocess]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the preprocessor test" );
+        return;
+    }
+
+    // The defines have to go after the real #version, and the commented out include
+    // doesn't exist so would fail to load
+    Shader shader;
+    shader.setVertexSourceString(
+        "// #version 100\n"
+        "#version 330\n"
+        "in vec3 pos;\n"
+        "void main() { gl_Position = vec4( pos * SCALE, 1.0 ); }\n" );
+    shader.setFragmentSourceString(
+        "/* Was\n"
+        "#version 100\n"
+        "#include \"missing.glsl\"\n"
+        "*/\n"
+        "#version 330\n"
+        "out vec4 colour; // #include \"missing.glsl\"\n"
+        "void main() { colour = vec4( SCALE ); }\n" );
+    shader.setDefines({ {"SCALE", "0.5"} });
+    REQUIRE( shader.compileAndLink() );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "vertex layouts handle integer and matrix attributes", "[shader][layout]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the vertex layout test" );
+        return;
+    }
+
+    Shader shader;
+    shader.setVertexSourceString(
+        "#version 330\n"
+        "in ivec2 id;\n"
+        "in mat4 model;\n"
+        "flat out ivec2 out_id;\n"
+        "void main() { out_id = id; gl_Position = model * vec4( 1.0 ); }\n" );
+    shader.setFragmentSourceString(
+        "#version 330\n"
+        "flat in ivec2 out_id;\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( out_id, 0.0, 1.0 ); }\n" );
+    REQUIRE( shader.compileAndLink() );
+
+    VertexLayout layout;
+    REQUIRE( layout.init( shader, { {"id", 2, GL_INT, GL_FALSE}, {"model", 16, GL_FLOAT, GL_FALSE} } ) );
+
+    // The ivec2 and then one attribute for each column of the matrix
+    REQUIRE( layout.getAttributeCount() == 5 );
+    REQUIRE( layout.getAttribute( 0 ).integer );
+    REQUIRE( !layout.getAttribute( 1 ).integer );
+    REQUIRE( layout.getAttribute( 1 ).count == 4 );
+    REQUIRE( layout.getAttribute( 2 ).location == layout.getAttribute( 1 ).location + 1 );
+    REQUIRE( layout.getAttribute( 4 ).offset == 8 + 3 * 16 );
+    REQUIRE( layout.getStride() == 8 + 64 );
+
+    GLuint vao = 0, buffer = 0;
+    glGenVertexArrays( 1, &vao );
+    glGenBuffers( 1, &buffer );
+    layout.apply( vao, buffer );
+
+    GLint is_integer = GL_FALSE;
+    glGetVertexAttribiv( layout.getAttribute( 0 ).location, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &is_integer );
+    REQUIRE( is_integer == GL_TRUE );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+
+    glDeleteBuffers( 1, &buffer );
+    glDeleteVertexArrays( 1, &vao );
+}
+
+TEST_CASE( "the program binary cache counts hits, misses and invalidations", "[shader][binary]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the binary cache test" );
+        return;
+    }
+    GLint formats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+    if( formats == 0 )
+    {
+        WARN( "The driver has no program binary formats, skipping the binary cache test" );
+        return;
+    }
+
+    const std::string directory = "tjh_shader_test_binaries";
+    mkdir( directory.c_str(), 0755 );
+    Shader::setProgramBinaryCachePath( directory );
+    const Shader::ProgramBinaryCacheStats before = Shader::getProgramBinaryCacheStats();
+
+    auto compile = []() {
+        Shader shader;
+        shader.setVertexSourceString( simple_vertex_source );
+        shader.setFragmentSourceString( simple_fragment_source );
+        const bool linked = shader.compileAndLink();
+        return linked && shader.isReady();
+    };
+
+    // Compiled and saved, then loaded from the file
+    REQUIRE( compile() );
+    REQUIRE( Shader::getProgramBinaryCacheStats().misses == before.misses + 1 );
+    const std::vector<std::string> files = list_files( directory );
+    REQUIRE( files.size() == 1 );
+    REQUIRE( compile() );
+    REQUIRE( Shader::getProgramBinaryCacheStats().hits == before.hits + 1 );
+
+    // A length far bigger than the file is rejected before anything is allocated, and the
+    // program is compiled from source and saved again
+    FILE* file = fopen( files[0].c_str(), "r+b" );
+    REQUIRE( file );
+    const GLint length = 0x7FFFFFFF;
+    fseek( file, sizeof(GLenum), SEEK_SET );
+    fwrite( &length, sizeof(length), 1, file );
+    fclose( file );
+    REQUIRE( compile() );
+    REQUIRE( Shader::getProgramBinaryCacheStats().invalidations == before.invalidations + 1 );
+    REQUIRE( compile() );
+    REQUIRE( Shader::getProgramBinaryCacheStats().hits == before.hits + 2 );
+    REQUIRE( Shader::getProgramBinaryCacheStats().misses == before.misses + 1 );
+
+    Shader::setProgramBinaryCachePath( "" );
+    for( const std::string& name : list_files( directory ) ) {
+        remove( name.c_str() );
+    }
+    rmdir( directory.c_str() );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "batched and async compiles become ready and link", "[shader][async]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the async compile test" );
+        return;
+    }
+
+    Shader shaders[3];
+    const char* colours[3] = { "vec4( 1.0 )", "vec4( 0.5 )", "vec4( 0.25 )" };
+    for( int i = 0; i < 3; i++ )
+    {
+        shaders[i].setVertexSourceString( simple_vertex_source );
+        shaders[i].setFragmentSourceString( std::string( "#version 330\n"
+                                                         "out vec4 colour;\n"
+                                                         "void main() { colour = " ) + colours[i] + "; }\n" );
+    }
+    REQUIRE( Shader::compileAndLinkAll({ &shaders[0], &shaders[1], &shaders[2] }) );
+    for( Shader& shader : shaders )
+    {
+        REQUIRE( shader.isReady() );
+        REQUIRE( shader.isLinked() );
+        REQUIRE( shader.getProgram() != 0 );
+    }
+
+    // One broken shader fails the batch without stopping the others
+    Shader broken;
+    broken.setVertexSourceString( simple_vertex_source );
+    broken.setFragmentSourceString( "#version 330\nvoid main() { not glsl }\n" );
+    Shader fine;
+    fine.setVertexSourceString( simple_vertex_source );
+    fine.setFragmentSourceString( simple_fragment_source );
+    REQUIRE( !Shader::compileAndLinkAll({ &broken, &fine }) );
+    REQUIRE( !broken.isLinked() );
+    REQUIRE( fine.isLinked() );
+
+    // Polled until the driver is done
+    Shader async;
+    async.setVertexSourceString( simple_vertex_source );
+    async.setFragmentSourceString( simple_fragment_source );
+    REQUIRE( async.compileAndLinkAsync() );
+    while( !async.isReady() ) {
+        SDL_Delay( 1 );
+    }
+    REQUIRE( async.isLinked() );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "uniform locations are cached and unchanged values are skipped", "[shader][uniforms]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the uniform test" );
+        return;
+    }
+
+    const std::string vertex = "tjh_shader_test_uniforms.vert";
+    const std::string fragment = "tjh_shader_test_uniforms.frag";
+    write_file( vertex, simple_vertex_source );
+    write_file( fragment,
+        "#version 330\n"
+        "uniform float scale;\n"
+        "uniform vec4 offsets[2];\n"
+        "out vec4 colour;\n"
+        "void main() { colour = (offsets[0] + offsets[1]) * scale; }\n" );
+
+    Shader shader;
+    REQUIRE( shader.loadVertexSourceFile( vertex ) );
+    REQUIRE( shader.loadFragmentSourceFile( fragment ) );
+    REQUIRE( shader.compileAndLink() );
+    shader.bind();
+
+    const GLint scale = shader.getUniformLocation( "scale" );
+    REQUIRE( scale == glGetUniformLocation( shader.getProgram(), "scale" ) );
+    REQUIRE( shader.getUniformLocation( "offsets" ) == glGetUniformLocation( shader.getProgram(), "offsets[0]" ) );
+    REQUIRE( shader.getUniformLocation( "offsets[1]" ) == glGetUniformLocation( shader.getProgram(), "offsets[1]" ) );
+
+    // Misses are remembered as -1, and setting them does nothing
+    REQUIRE( shader.getUniformLocation( "extra" ) == -1 );
+    REQUIRE( shader.getUniformLocation( "extra" ) == -1 );
+    shader.setFloat( "extra", 1.0f );
+
+    // Setting the value it already has is skipped, so a change behind its back stays
+    GLfloat value = 0.0f;
+    shader.setFloat( scale, 2.0f );
+    glUniform1f( scale, 5.0f );
+    shader.setFloat( scale, 2.0f );
+    glGetUniformfv( shader.getProgram(), scale, &value );
+    REQUIRE( value == 5.0f );
+    shader.setFloat( scale, 3.0f );
+    glGetUniformfv( shader.getProgram(), scale, &value );
+    REQUIRE( value == 3.0f );
+
+    // A reload is a new program, so locations, misses and values are all looked up again
+    write_file( fragment,
+        "#version 330\n"
+        "uniform float extra;\n"
+        "uniform float scale;\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( extra * scale ); }\n" );
+    REQUIRE( shader.reload() );
+    shader.bind();
+    REQUIRE( shader.getUniformLocation( "extra" ) == glGetUniformLocation( shader.getProgram(), "extra" ) );
+    REQUIRE( shader.getUniformLocation( "extra" ) != -1 );
+    REQUIRE( shader.getUniformLocation( "offsets[1]" ) == -1 );
+    shader.setFloat( "scale", 3.0f );
+    glGetUniformfv( shader.getProgram(), shader.getUniformLocation( "scale" ), &value );
+    REQUIRE( value == 3.0f );
+
+    shader.shutdown();
+    remove( vertex.c_str() );
+    remove( fragment.c_str() );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "uniform blocks share bindings and uniform buffers cycle through their copies", "[shader][uniforms]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the uniform buffer test" );
+        return;
+    }
+
+    // Chosen bindings are kept, the others are handed out the first time a block is seen
+    Shader::setUniformBlockBinding( "TestFixed", 7 );
+
+    Shader copy;
+    copy.setComputeSourceString(
+        "#version 430\n"
+        "layout(local_size_x = 1) in;\n"
+        "layout(std140) uniform TestFixed { vec4 fixed_value; };\n"
+        "layout(std140) uniform TestFrame { vec4 frame_value; };\n"
+        "layout(std430, binding = 4) buffer Result { vec4 result; };\n"
+        "void main() { result = frame_value + fixed_value; }\n" );
+    REQUIRE( copy.compileAndLink() );
+
+    Shader other;
+    other.setComputeSourceString(
+        "#version 430\n"
+        "layout(local_size_x = 1) in;\n"
+        "layout(std140) uniform TestFrame { vec4 frame_value; };\n"
+        "layout(std430, binding = 4) buffer Result { vec4 result; };\n"
+        "void main() { result = frame_value * 2.0; }\n" );
+    REQUIRE( other.compileAndLink() );
+
+    const GLuint frame_binding = Shader::getUniformBlockBinding( "TestFrame" );
+    REQUIRE( frame_binding != 7 );
+    REQUIRE( copy.getUniformBlocks().size() == 2 );
+    REQUIRE( other.getUniformBlocks().size() == 1 );
+    for( const Shader* shader : { &copy, &other } )
+    {
+        for( const auto& block : shader->getUniformBlocks() )
+        {
+            GLint binding = -1;
+            glGetActiveUniformBlockiv( shader->getProgram(), block.index, GL_UNIFORM_BLOCK_BINDING, &binding );
+            REQUIRE( static_cast<GLuint>(binding) == block.binding );
+            REQUIRE( block.binding == (block.name == "TestFixed" ? 7 : frame_binding) );
+            REQUIRE( block.data_size == 16 );
+        }
+    }
+
+    GLuint result = 0;
+    glGenBuffers( 1, &result );
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, result );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float), nullptr, GL_DYNAMIC_COPY );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 4, result );
+
+    UniformBuffer fixed;
+    REQUIRE( fixed.init( "TestFixed", 4 * sizeof(float), 1 ) );
+    REQUIRE( fixed.getBinding() == 7 );
+    const float fixed_value[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+    fixed.update( fixed_value );
+
+    // Both with and without persistent mapping, each frame writes the next of the three
+    // copies and the shader reads back what was written
+    for( bool persistent_map : { true, false } )
+    {
+        UniformBuffer frame;
+        REQUIRE( frame.init( "TestFrame", 4 * sizeof(float), 3, persistent_map ) );
+        REQUIRE( frame.getBinding() == frame_binding );
+
+        GLint64 starts[5] = {};
+        for( int i = 0; i < 5; i++ )
+        {
+            const float value[4] = { float(i), float(i + 1), float(i + 2), float(i + 3) };
+            frame.update( value );
+
+            GLint bound = 0;
+            glGetIntegeri_v( GL_UNIFORM_BUFFER_BINDING, frame_binding, &bound );
+            REQUIRE( static_cast<GLuint>(bound) == frame.getBuffer() );
+            glGetInteger64i_v( GL_UNIFORM_BUFFER_START, frame_binding, &starts[i] );
+
+            copy.dispatch( 1, 1, 1, GL_BUFFER_UPDATE_BARRIER_BIT );
+            Shader::memoryBarrier();
+
+            float read[4] = {};
+            glBindBuffer( GL_SHADER_STORAGE_BUFFER, result );
+            glGetBufferSubData( GL_SHADER_STORAGE_BUFFER, 0, sizeof(read), read );
+            for( int c = 0; c < 4; c++ ) {
+                REQUIRE( read[c] == Approx( value[c] + 0.5f ) );
+            }
+        }
+
+        REQUIRE( starts[0] != starts[1] );
+        REQUIRE( starts[1] != starts[2] );
+        REQUIRE( starts[0] != starts[2] );
+        REQUIRE( starts[3] == starts[0] );
+        REQUIRE( starts[4] == starts[1] );
+
+        // The other program reads the same block through the same binding
+        other.dispatch( 1, 1, 1, GL_BUFFER_UPDATE_BARRIER_BIT );
+        Shader::memoryBarrier();
+        float read[4] = {};
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, result );
+        glGetBufferSubData( GL_SHADER_STORAGE_BUFFER, 0, sizeof(read), read );
+        REQUIRE( read[0] == Approx( 8.0f ) );
+        REQUIRE( read[3] == Approx( 14.0f ) );
+    }
+
+    glDeleteBuffers( 1, &result );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "only shaders using a changed file are reloaded", "[shader][reload]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the reload test" );
+        return;
+    }
+
+    const std::string directory = "tjh_shader_test_reload";
+    mkdir( directory.c_str(), 0755 );
+    Shader::setShaderBasePath( directory + "/" );
+    Shader::setReloadPollInterval( 0 );
+
+    write_file( directory + "/shared.vert", simple_vertex_source );
+    write_file( directory + "/colour.glsl", "vec4 colour_value() { return vec4( 1.0 ); }\n" );
+    write_file( directory + "/plain.frag", simple_fragment_source );
+    write_file( directory + "/included.frag",
+        "#version 330\n"
+        "#include \"colour.glsl\"\n"
+        "out vec4 colour;\n"
+        "void main() { colour = colour_value(); }\n" );
+
+    Shader plain, included;
+    REQUIRE( plain.loadVertexSourceFile( "shared.vert" ) );
+    REQUIRE( plain.loadFragmentSourceFile( "plain.frag" ) );
+    REQUIRE( plain.compileAndLink() );
+    REQUIRE( included.loadVertexSourceFile( "shared.vert" ) );
+    REQUIRE( included.loadFragmentSourceFile( "included.frag" ) );
+    REQUIRE( included.compileAndLink() );
+
+    // Swaps can happen on a later call when the driver compiles in the background,
+    // so keep calling for a while and count every swap
+    auto reload_changed = []() {
+        int swapped = 0;
+        for( int i = 0; i < 50; i++ )
+        {
+            swapped += Shader::reloadChanged();
+            SDL_Delay( 10 );
+        }
+        return swapped;
+    };
+
+    // Nothing has changed yet, and saving a file without edits doesn't count either
+    REQUIRE( reload_changed() == 0 );
+    write_file( directory + "/plain.frag", simple_fragment_source );
+    REQUIRE( reload_changed() == 0 );
+
+    // Without inotify files are polled by modification time and size, so each edit
+    // changes the size too in case it lands in the same second
+    GLuint plain_program = plain.getProgram();
+    GLuint included_program = included.getProgram();
+    write_file( directory + "/plain.frag",
+        "#version 330\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( 0.25 ); }\n" );
+    REQUIRE( reload_changed() == 1 );
+    REQUIRE( plain.getProgram() != plain_program );
+    REQUIRE( plain.isLinked() );
+    REQUIRE( included.getProgram() == included_program );
+
+    // An included file reloads the shaders including it
+    plain_program = plain.getProgram();
+    write_file( directory + "/colour.glsl", "vec4 colour_value() { return vec4( 0.25 ); }\n" );
+    REQUIRE( reload_changed() == 1 );
+    REQUIRE( included.getProgram() != included_program );
+    REQUIRE( included.isLinked() );
+    REQUIRE( plain.getProgram() == plain_program );
+
+    // A shared file reloads both, and a broken one keeps the old programs working
+    included_program = included.getProgram();
+    write_file( directory + "/shared.vert",
+        "#version 330\n"
+        "in vec3 pos;\n"
+        "void main() { gl_Position = vec4( pos * 2.0, 1.0 ); }\n" );
+    REQUIRE( reload_changed() == 2 );
+    REQUIRE( plain.getProgram() != plain_program );
+    REQUIRE( included.getProgram() != included_program );
+
+    plain_program = plain.getProgram();
+    included_program = included.getProgram();
+    write_file( directory + "/shared.vert", "#version 330\nvoid main() { this does not compile }\n" );
+    REQUIRE( reload_changed() == 0 );
+    REQUIRE( plain.getProgram() == plain_program );
+    REQUIRE( included.getProgram() == included_program );
+    REQUIRE( plain.isLinked() );
+
+    plain.shutdown();
+    included.shutdown();
+    for( const std::string& file : list_files( directory ) ) {
+        remove( file.c_str() );
+    }
+    rmdir( directory.c_str() );
+    Shader::setShaderBasePath( "" );
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "programs with the same stage source share one compiled stage", "[shader][stages]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the shared stage test" );
+        return;
+    }
+
+    const std::string vertex =
+        "#version 330\n"
+        "in vec3 pos;\n"
+        "void main() { gl_Position = vec4( pos * 0.5, 1.0 ); } // shared stage test\n";
+    const std::string other_fragment =
+        "#version 330\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( 0.5 ); }\n";
+
+    auto link = [&]( Shader& shader, const std::string& fragment ) {
+        shader.setVertexSourceString( vertex );
+        shader.setFragmentSourceString( fragment );
+        REQUIRE( shader.compileAndLink() );
+        return shader.getStats().shared_stages;
+    };
+
+    Shader first, second, third;
+    REQUIRE( link( first, simple_fragment_source ) == 0 );
+    REQUIRE( link( second, other_fragment ) == 1 );
+    REQUIRE( link( third, simple_fragment_source ) == 2 );
+
+    // The stages stay alive while anyone is using them
+    first.shutdown();
+    Shader fourth;
+    REQUIRE( link( fourth, simple_fragment_source ) == 2 );
+    third.shutdown();
+    fourth.shutdown();
+    Shader fifth;
+    REQUIRE( link( fifth, simple_fragment_source ) == 1 );
+    REQUIRE( second.isLinked() );
+
+    // Once the last user has gone they are deleted, and compiled again when next needed
+    second.shutdown();
+    fifth.shutdown();
+    Shader sixth;
+    REQUIRE( link( sixth, simple_fragment_source ) == 0 );
+    REQUIRE( Shader::getStatsJson().find( "\"shared_stages\":" ) != std::string::npos );
+    sixth.shutdown();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "pipelines mix separable stages and pick up reloaded programs", "[shader][pipeline]" )
+{
+    if( !create_compute_context() )
+    {
+        WARN( "GL 4.3 is not available, skipping the pipeline test" );
+        return;
+    }
+
+    Shader vertex, red, blue, combined;
+    vertex.setSeparable( true );
+    vertex.setVertexSourceString(
+        "#version 430\n"
+        "in vec3 pos;\n"
+        "out gl_PerVertex { vec4 gl_Position; };\n"
+        "void main() { gl_Position = vec4( pos, 1.0 ); }\n" );
+    red.setSeparable( true );
+    red.setFragmentSourceString(
+        "#version 430\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( 1.0, 0.0, 0.0, 1.0 ); }\n" );
+    blue.setSeparable( true );
+    blue.setFragmentSourceString(
+        "#version 430\n"
+        "out vec4 colour;\n"
+        "void main() { colour = vec4( 0.0, 0.0, 1.0, 1.0 ); }\n" );
+    combined.setVertexSourceString( simple_vertex_source );
+    combined.setFragmentSourceString( simple_fragment_source );
+    REQUIRE( vertex.compileAndLink() );
+    REQUIRE( red.compileAndLink() );
+    REQUIRE( blue.compileAndLink() );
+    REQUIRE( combined.compileAndLink() );
+
+    Pipeline pipeline;
+    REQUIRE( pipeline.init() );
+
+    auto stage_program = [&]( GLenum stage ) {
+        GLint program = 0;
+        glGetProgramPipelineiv( pipeline.getPipeline(), stage, &program );
+        return static_cast<GLuint>(program);
+    };
+
+    // Only separable programs can be used
+    REQUIRE_FALSE( pipeline.useStages( combined ) );
+
+    REQUIRE( pipeline.useStages( vertex ) );
+    REQUIRE( pipeline.useStages( red ) );
+    REQUIRE( stage_program( GL_VERTEX_SHADER ) == vertex.getProgram() );
+    REQUIRE( stage_program( GL_FRAGMENT_SHADER ) == red.getProgram() );
+    REQUIRE( pipeline.validate() );
+
+    // Binding clears any program bound with glUseProgram, which would win over the pipeline
+    combined.bind();
+    pipeline.bind();
+    GLint bound = -1;
+    glGetIntegerv( GL_CURRENT_PROGRAM, &bound );
+    REQUIRE( bound == 0 );
+    glGetIntegerv( GL_PROGRAM_PIPELINE_BINDING, &bound );
+    REQUIRE( static_cast<GLuint>(bound) == pipeline.getPipeline() );
+
+    // Swapping a stage doesn't touch the others
+    REQUIRE( pipeline.useStages( blue ) );
+    REQUIRE( stage_program( GL_VERTEX_SHADER ) == vertex.getProgram() );
+    REQUIRE( stage_program( GL_FRAGMENT_SHADER ) == blue.getProgram() );
+
+    // A reload gives the shader a new program, bind() attaches it in place of the old one
+    const GLuint old_blue = blue.getProgram();
+    REQUIRE( blue.reload() );
+    REQUIRE( blue.getProgram() != old_blue );
+    pipeline.bind();
+    REQUIRE( stage_program( GL_FRAGMENT_SHADER ) == blue.getProgram() );
+    REQUIRE( stage_program( GL_VERTEX_SHADER ) == vertex.getProgram() );
+    REQUIRE( pipeline.validate() );
+
+    // Cleared stages stay cleared, even when the shader that was there reloads
+    pipeline.clearStages( GL_FRAGMENT_SHADER_BIT );
+    REQUIRE( stage_program( GL_FRAGMENT_SHADER ) == 0 );
+    REQUIRE( blue.reload() );
+    pipeline.bind();
+    REQUIRE( stage_program( GL_FRAGMENT_SHADER ) == 0 );
+    REQUIRE( stage_program( GL_VERTEX_SHADER ) == vertex.getProgram() );
+
+    pipeline.unbind();
+    pipeline.shutdown();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
@@ -0,0 +1,597 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TJH_TEXTURE_CACHE_IMPLEMENTATION
+#include "../tjh_texture_cache.h"
+
+// Run from the repository root so examples/sample.png can be found
+static SDL_Window* window = nullptr;
+static SDL_GLContext context = nullptr;
+
+static bool create_context()
+{
+    if( context ) {
+        return true;
+    }
+
+    SDL_Init( SDL_INIT_VIDEO );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+
+    window = SDL_CreateWindow( "tjh_texture_cache_test", 0, 0, 16, 16, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN );
+    if( !window ) {
+        return false;
+    }
+    context = SDL_GL_CreateContext( window );
+    if( !context ) {
+        return false;
+    }
+
+    glewExperimental = GL_TRUE;
+    return glewInit() == GLEW_OK;
+}
+
+
+static void put_u32( std::vector<unsigned char>& bytes, size_t offset, uint32_t value )
+{
+    memcpy( &bytes[offset], &value, 4 );
+}
+
+// An 8x8 BC1 DDS with the given number of levels, the data is whatever is left in the file
+static std::vector<unsigned char> make_dds( uint32_t width, uint32_t height, uint32_t levels, size_t data_bytes )
+{
+    std::vector<unsigned char> file( 128 + data_bytes, 0x55 );
+    memset( file.data(), 0, 128 );
+    memcpy( file.data(), "DDS ", 4 );
+    put_u32( file, 8, 0x20000 );    // DDSD_MIPMAPCOUNT
+    put_u32( file, 12, height );
+    put_u32( file, 16, width );
+    put_u32( file, 28, levels );
+    put_u32( file, 80, 0x4 );       // DDPF_FOURCC
+    memcpy( &file[84], "DXT1", 4 );
+    return file;
+}
+
+TEST_CASE( "atlas regions never overlap", "[texture][atlas]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the atlas test" );
+        return;
+    }
+
+    const int page_size = 256;
+    const int padding = 1;
+    Texture::Atlas atlas;
+    atlas.init( page_size, padding );
+
+    std::vector<unsigned char> rgba( 64 * 64 * 4, 255 );
+    std::vector<Texture::Region> regions;
+    unsigned int seed = 1;
+    for( int i = 0; i < 200; i++ )
+    {
+        seed = seed * 1103515245u + 12345u;
+        const int width = 4 + static_cast<int>((seed >> 16) % 60);
+        const int height = 4 + static_cast<int>((seed >> 8) % 60);
+        Texture::Region region = atlas.add( "image" + std::to_string( i ), rgba.data(), width, height );
+        REQUIRE( region.texture != 0 );
+        regions.push_back( region );
+    }
+    REQUIRE( atlas.getPageCount() > 1 );
+
+    for( size_t a = 0; a < regions.size(); a++ )
+    {
+        const Texture::Region& r = regions[a];
+        REQUIRE( r.x >= padding );
+        REQUIRE( r.y >= padding );
+        REQUIRE( r.x + r.width + padding <= page_size );
+        REQUIRE( r.y + r.height + padding <= page_size );
+
+        for( size_t b = a + 1; b < regions.size(); b++ )
+        {
+            const Texture::Region& o = regions[b];
+            if( o.page != r.page ) {
+                continue;
+            }
+            // Padding included, so filtering never bleeds between images
+            const bool apart = r.x + r.width + padding <= o.x - padding || o.x + o.width + padding <= r.x - padding ||
+                               r.y + r.height + padding <= o.y - padding || o.y + o.height + padding <= r.y - padding;
+            REQUIRE( apart );
+        }
+    }
+
+    atlas.shutdown();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "atlas padding repeats the edge of each image", "[texture][atlas]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the atlas test" );
+        return;
+    }
+
+    const int page_size = 16;
+    Texture::Atlas atlas;
+    atlas.init( page_size, 2 );
+
+    const unsigned char rgba[2 * 2 * 4] = {
+        10, 10, 10, 255,   20, 20, 20, 255,
+        30, 30, 30, 255,   40, 40, 40, 255 };
+    const Texture::Region region = atlas.add( "corners", rgba, 2, 2 );
+    REQUIRE( region.x == 2 );
+    REQUIRE( region.y == 2 );
+
+    std::vector<unsigned char> page( page_size * page_size * 4 );
+    glBindTexture( GL_TEXTURE_2D, atlas.getPageTexture( 0 ) );
+    glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+    glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, page.data() );
+    auto texel = [&]( int x, int y ) { return page[(y * page_size + x) * 4]; };
+
+    REQUIRE( texel( 0, 0 ) == 10 );     // Corners
+    REQUIRE( texel( 5, 0 ) == 20 );
+    REQUIRE( texel( 0, 5 ) == 30 );
+    REQUIRE( texel( 5, 5 ) == 40 );
+    REQUIRE( texel( 2, 1 ) == 10 );     // Edges
+    REQUIRE( texel( 4, 2 ) == 20 );
+    REQUIRE( texel( 3, 5 ) == 40 );
+    REQUIRE( page[(5 * page_size + 5) * 4 + 3] == 255 );
+    REQUIRE( texel( 6, 6 ) == 0 );      // Outside the padding stays clear
+
+    atlas.shutdown();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "atlases and arrays take files and loaded handles", "[texture][atlas]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the atlas test" );
+        return;
+    }
+
+    Texture::Atlas atlas;
+    atlas.init( 1024, 1 );
+    const Texture::Region from_file = atlas.add( "examples/sample.png" );
+    REQUIRE( from_file.texture != 0 );
+    REQUIRE( from_file.width == 512 );
+
+    // A loaded texture under the same name is the same image, so it gets the same region
+    Texture::Handle sample = Texture::load( "examples/sample.png" );
+    REQUIRE( sample.isValid() );
+    const Texture::Region from_handle = atlas.add( sample );
+    REQUIRE( from_handle.x == from_file.x );
+    REQUIRE( from_handle.y == from_file.y );
+    REQUIRE( atlas.add( "examples/missing.png" ).texture == 0 );
+
+    Texture::TextureArray array;
+    array.init( 4 );
+    const Texture::Region layer = array.add( sample );
+    REQUIRE( layer.texture != 0 );
+    REQUIRE( layer.width == 512 );
+    REQUIRE( array.add( "examples/sample.png" ).layer == layer.layer );
+    REQUIRE( !array.add( Texture::Handle() ).texture );
+
+    atlas.shutdown();
+    array.shutdown();
+    Texture::cacheClear();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "handles to the same path share a texture until the cache is cleared", "[texture][handles]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the handle test" );
+        return;
+    }
+
+    REQUIRE( !Texture::Handle().isValid() );
+    REQUIRE( Texture::Handle().getTexture() == 0 );
+
+    const Texture::PathId path = Texture::intern( "examples/sample.png" );
+    REQUIRE( Texture::intern( "examples/sample.png" ) == path );
+    REQUIRE( Texture::getPath( path ) == "examples/sample.png" );
+
+    Texture::Handle sample = Texture::load( "examples/sample.png" );
+    REQUIRE( sample.isValid() );
+    REQUIRE( sample.getWidth() == 512 );
+    REQUIRE( Texture::load( path ) == sample );
+    REQUIRE( Texture::cacheSize() == 1 );
+
+    // Another spelling of the path is another entry
+    Texture::Handle other = Texture::load( "./examples/sample.png" );
+    REQUIRE( other.isValid() );
+    REQUIRE( other != sample );
+    REQUIRE( other.getTexture() != sample.getTexture() );
+    REQUIRE( Texture::cacheSize() == 2 );
+
+    // Clearing bumps the generation, so old handles don't pick up whatever reuses the entry
+    Texture::cacheClear();
+    REQUIRE( !sample.isValid() );
+    REQUIRE( sample.getTexture() == 0 );
+    Texture::Handle reloaded = Texture::load( path );
+    REQUIRE( reloaded.isValid() );
+    REQUIRE( reloaded != sample );
+
+    Texture::cacheClear();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "failed async loads are dropped so the next load tries again", "[texture][async]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the async failure test" );
+        return;
+    }
+
+    const char* filename = "tjh_texture_cache_test_late.png";
+    remove( filename );
+
+    int calls = 0;
+    bool loaded = true;
+    Texture::Handle handle = Texture::loadAsync( filename, Texture::LoadOptions(), [&]( Texture::Handle, bool ok ) {
+        calls++;
+        loaded = ok;
+    });
+    REQUIRE( handle.isValid() );
+    REQUIRE( Texture::cacheSize() == 1 );
+
+    // The placeholder goes with the entry, rather than being handed out as if it loaded
+    REQUIRE( !Texture::wait( { handle } ) );
+    REQUIRE( calls == 1 );
+    REQUIRE( !loaded );
+    REQUIRE( !handle.isValid() );
+    REQUIRE( handle.getTexture() == 0 );
+    REQUIRE( Texture::cacheSize() == 0 );
+    REQUIRE( Texture::pendingCount() == 0 );
+
+    // load() waiting on a failing async load gets an invalid handle too
+    Texture::loadAsync( filename );
+    REQUIRE( !Texture::load( filename ).isValid() );
+    REQUIRE( Texture::cacheSize() == 0 );
+
+    // Once the file is there, loading it again works
+    FILE* in = fopen( "examples/sample.png", "rb" );
+    REQUIRE( in );
+    std::vector<unsigned char> bytes;
+    unsigned char buffer[4096];
+    size_t read = 0;
+    while( (read = fread( buffer, 1, sizeof(buffer), in )) > 0 ) {
+        bytes.insert( bytes.end(), buffer, buffer + read );
+    }
+    fclose( in );
+    FILE* out = fopen( filename, "wb" );
+    REQUIRE( out );
+    fwrite( bytes.data(), 1, bytes.size(), out );
+    fclose( out );
+
+    Texture::Handle retried = Texture::loadAsync( filename, Texture::LoadOptions(), [&]( Texture::Handle, bool ok ) {
+        calls++;
+        loaded = ok;
+    });
+    REQUIRE( Texture::wait( { retried } ) );
+    REQUIRE( calls == 2 );
+    REQUIRE( loaded );
+    REQUIRE( retried.getWidth() == 512 );
+    REQUIRE( Texture::load( filename ) == retried );
+    REQUIRE( !handle.isValid() );
+
+    remove( filename );
+    Texture::cacheClear();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "changed files are reloaded whether or not their directory is watched", "[texture][reload]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the reload test" );
+        return;
+    }
+
+    std::vector<unsigned char> png;
+    REQUIRE( Texture::read_file( "examples/sample.png", png ) );
+    auto write_png = [&png]( const std::string& path, size_t trailing_bytes ) {
+        // Anything after the end of the png is ignored, it just changes the file's size
+        FILE* file = fopen( path.c_str(), "wb" );
+        REQUIRE( file );
+        fwrite( png.data(), 1, png.size(), file );
+        for( size_t i = 0; i < trailing_bytes; i++ ) {
+            fputc( 0, file );
+        }
+        fclose( file );
+    };
+
+    const std::string directory = "tjh_texture_cache_test_reload";
+    const std::string path = directory + "/sample.png";
+    mkdir( directory.c_str(), 0755 );
+    write_png( path, 0 );
+    Texture::setReloadPollInterval( 0 );
+
+    Texture::Handle handle = Texture::load( path );
+    REQUIRE( handle.isValid() );
+    REQUIRE( Texture::cacheReload() == 0 );
+
+    write_png( path, 0 );
+    REQUIRE( Texture::cacheReload() == 1 );
+    Texture::waitAll();
+    REQUIRE( Texture::cacheReload() == 0 );
+
+    // Replacing the directory takes its watch with it, from then on the file is polled.
+    // Each write changes the size in case it lands in the same second as the last one.
+    remove( path.c_str() );
+    rmdir( directory.c_str() );
+    mkdir( directory.c_str(), 0755 );
+    write_png( path, 1 );
+    REQUIRE( Texture::cacheReload() == 1 );
+    Texture::waitAll();
+    REQUIRE( Texture::cacheReload() == 0 );
+
+    write_png( path, 2 );
+    REQUIRE( Texture::cacheReload() == 1 );
+    Texture::waitAll();
+    REQUIRE( handle.getWidth() == 512 );
+
+    remove( path.c_str() );
+    rmdir( directory.c_str() );
+    Texture::setReloadPollInterval( 250 );
+    Texture::cacheClear();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "eviction waits for the next frame and bound textures come back", "[texture][budget]" )
+{
+    if( !create_context() )
+    {
+        WARN( "GL 3.3 is not available, skipping the budget test" );
+        return;
+    }
+
+    const size_t evictions = Texture::getCacheStats().evictions;
+    const size_t reloads = Texture::getCacheStats().reloads;
+
+    // Two copies under different names, then a budget that only fits one of them
+    Texture::Handle sample = Texture::load( "examples/sample.png" );
+    Texture::LoadOptions grey;
+    grey.channels = 1;
+    Texture::Handle small = Texture::load( "./examples/sample.png", grey );
+    REQUIRE( small.isValid() );
+    REQUIRE( small.info().format == GL_R8 );
+    REQUIRE( Texture::getCacheStats().resident_bytes == sample.info().bytes + small.info().bytes );
+
+    Texture::update();
+    sample.bind();
+    small.bind();
+    Texture::setMemoryBudget( sample.info().bytes );
+
+    // Both were bound this frame, so neither goes until the frame is over
+    REQUIRE( Texture::getCacheStats().evictions == evictions );
+    Texture::update();
+    REQUIRE( Texture::getCacheStats().evictions == evictions + 1 );
+    REQUIRE( !sample.info().resident );
+    REQUIRE( sample.info().bytes < 16 );
+    REQUIRE( sample.isValid() );
+
+    // Binding it again brings it back in the background
+    sample.bind();
+    Texture::waitAll();
+    REQUIRE( sample.info().resident );
+    REQUIRE( Texture::getCacheStats().reloads == reloads + 1 );
+
+    // Pinned textures stay, whatever the budget
+    Texture::setMemoryBudget( 1 );
+    sample.pin();
+    Texture::update();
+    Texture::update();
+    REQUIRE( sample.info().resident );
+    REQUIRE( !small.info().resident );
+    sample.unpin();
+
+    Texture::setMemoryBudget( 0 );
+    Texture::cacheClear();
+    REQUIRE( glGetError() == GL_NO_ERROR );
+}
+
+TEST_CASE( "texture sizes count every mip level", "[texture]" )
+{
+    using namespace Texture;
+
+    REQUIRE( full_mip_count( 512, 256 ) == 10 );
+    REQUIRE( full_mip_count( 1, 1 ) == 1 );
+
+    Image rgba;
+    rgba.width = 4;
+    rgba.height = 4;
+    rgba.channels = 4;
+    REQUIRE( texture_bytes( rgba, 3 ) == 64 + 16 + 4 );
+
+    // Drivers pad RGB8 out to four bytes a pixel
+    Image rgb = rgba;
+    rgb.channels = 3;
+    REQUIRE( texture_bytes( rgb, 1 ) == 64 );
+
+    // BC1 is 8 bytes per 4x4 block, and levels smaller than a block still take a whole one
+    Image bc1 = rgba;
+    bc1.width = 8;
+    bc1.height = 8;
+    bc1.compressed_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    REQUIRE( texture_bytes( bc1, 4 ) == 32 + 8 + 8 + 8 );
+}
+
+TEST_CASE( "cpu mipmaps average colour in linear space", "[texture][mipmaps]" )
+{
+    using namespace Texture;
+
+    // Black and transparent next to white and opaque
+    const unsigned char pixels[16] = {
+        0, 0, 0, 0,   255, 255, 255, 255,
+        0, 0, 0, 0,   255, 255, 255, 255 };
+
+    Image image;
+    image.width = 2;
+    image.height = 2;
+    image.channels = 4;
+    image.size = sizeof(pixels);
+    image.data = static_cast<unsigned char*>(STBI_MALLOC( image.size ));
+    memcpy( image.data, pixels, image.size );
+
+    generate_mipmaps( image );
+
+    REQUIRE( image.levels == 2 );
+    REQUIRE( image.size == 16 + 4 );
+
+    // Half way between black and white in linear light is 188 in sRGB, not 128
+    const unsigned char* smallest = image.data + 16;
+    REQUIRE( smallest[0] == 188 );
+    REQUIRE( smallest[1] == 188 );
+    REQUIRE( smallest[2] == 188 );
+    REQUIRE( smallest[3] == 128 );  // Alpha is averaged as it is
+
+    free_image( image );
+}
+
+TEST_CASE( "dds and ktx files are read with their mip levels", "[texture][compressed]" )
+{
+    using namespace Texture;
+
+    // 8x8, 4x4, 2x2 and 1x1 are one 8 byte block each after the first's four
+    std::vector<unsigned char> dds = make_dds( 8, 8, 4, 32 + 8 + 8 + 8 );
+    Image image;
+    REQUIRE( read_dds( dds.data(), dds.size(), "test.dds", image ) );
+    REQUIRE( image.width == 8 );
+    REQUIRE( image.levels == 4 );
+    REQUIRE( image.compressed_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT );
+    REQUIRE( image.size == 56 );
+    free_image( image );
+
+    // Truncated, more levels than the size allows, and a size that isn't possible
+    std::vector<unsigned char> truncated = make_dds( 8, 8, 4, 55 );
+    REQUIRE( !read_dds( truncated.data(), truncated.size(), "truncated.dds", image ) );
+    std::vector<unsigned char> too_many = make_dds( 8, 8, 0xFFFFFFFF, 56 );
+    REQUIRE( !read_dds( too_many.data(), too_many.size(), "too_many.dds", image ) );
+    std::vector<unsigned char> too_big = make_dds( 0x80000000u, 8, 1, 56 );
+    REQUIRE( !read_dds( too_big.data(), too_big.size(), "too_big.dds", image ) );
+
+    // An 8x4 BC7 KTX with two levels, each level has its size in front of it
+    std::vector<unsigned char> ktx( 64 + 4 + 32 + 4 + 16, 0x55 );
+    const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    memcpy( ktx.data(), identifier, 12 );
+    put_u32( ktx, 12, 0x04030201 );
+    put_u32( ktx, 16, 0 );          // glType, 0 for compressed
+    put_u32( ktx, 24, 0 );          // glFormat
+    put_u32( ktx, 28, GL_COMPRESSED_RGBA_BPTC_UNORM );
+    put_u32( ktx, 36, 8 );
+    put_u32( ktx, 40, 4 );
+    put_u32( ktx, 44, 0 );          // Depth, 0 for 2D
+    put_u32( ktx, 48, 0 );          // Array elements
+    put_u32( ktx, 52, 1 );          // Faces
+    put_u32( ktx, 56, 2 );          // Levels
+    put_u32( ktx, 60, 0 );          // Key/value bytes
+    put_u32( ktx, 64, 32 );
+    put_u32( ktx, 64 + 4 + 32, 16 );
+
+    REQUIRE( read_ktx( ktx.data(), ktx.size(), "test.ktx", image ) );
+    REQUIRE( image.width == 8 );
+    REQUIRE( image.height == 4 );
+    REQUIRE( image.levels == 2 );
+    REQUIRE( image.channels == 4 );
+    REQUIRE( image.size == 48 );
+    free_image( image );
+
+    put_u32( ktx, 64, 31 );     // Level size doesn't match the format
+    REQUIRE( !read_ktx( ktx.data(), ktx.size(), "bad_level.ktx", image ) );
+}
+
+TEST_CASE( "cooked files round trip and reject anything that doesn't match", "[texture][cooked]" )
+{
+    using namespace Texture;
+
+    const unsigned char pixels[4 * 4 * 2] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    Image image;
+    image.width = 4;
+    image.height = 4;
+    image.channels = 2;
+    image.data = const_cast<unsigned char*>(pixels);
+    image.size = sizeof(pixels);
+
+    const std::string path = "tjh_texture_cache_test.tex";
+    const uint64_t key = 0x1234;
+    REQUIRE( write_cooked( path, key, LoadOptions(), image ) );
+
+    std::vector<unsigned char> file;
+    REQUIRE( read_file( path, file ) );
+    remove( path.c_str() );
+    REQUIRE( file.size() == COOKED_HEADER_BYTES + sizeof(pixels) );
+
+    Image cooked;
+    REQUIRE( read_cooked_header( file.data(), file.size(), key, cooked ) );
+    REQUIRE( cooked.width == 4 );
+    REQUIRE( cooked.height == 4 );
+    REQUIRE( cooked.channels == 2 );
+    REQUIRE( cooked.levels == 1 );
+    REQUIRE( cooked.compressed_format == 0 );
+    REQUIRE( memcmp( cooked.data, pixels, sizeof(pixels) ) == 0 );
+
+    // A different key or a truncated file is rejected without touching the image
+    Image rejected;
+    REQUIRE( !read_cooked_header( file.data(), file.size(), key + 1, rejected ) );
+    REQUIRE( !read_cooked_header( file.data(), file.size() - 1, key, rejected ) );
+
+    // More levels than the data holds
+    const int32_t levels = 2;
+    memcpy( &file[40], &levels, 4 );
+    REQUIRE( !read_cooked_header( file.data(), file.size(), key, rejected ) );
+    REQUIRE( rejected.levels == 1 );
+    REQUIRE( rejected.width == 0 );
+    REQUIRE( rejected.data == nullptr );
+}
+
+TEST_CASE( "cooked images are decoded once and mapped after that", "[texture][cooked]" )
+{
+    using namespace Texture;
+
+    const std::string directory = "tjh_texture_cache_test_cooked";
+    mkdir( directory.c_str(), 0755 );
+    setCookedCacheDirectory( directory );
+
+    LoadOptions options;
+    options.mipmaps = CPU_MIPMAPS;
+    REQUIRE( cook( "examples/sample.png", options ) );
+
+    Image image;
+    REQUIRE( decode_image( "examples/sample.png", options, image ) );
+    REQUIRE( image.mapping != nullptr );
+    REQUIRE( image.width == 512 );
+    REQUIRE( image.levels == 10 );
+    free_image( image );
+
+    // Different options are a different file, so the first load with them decodes
+    REQUIRE( decode_image( "examples/sample.png", LoadOptions(), image ) );
+    REQUIRE( image.mapping == nullptr );
+    REQUIRE( image.levels == 1 );
+    free_image( image );
+
+    std::vector<unsigned char> contents;
+    REQUIRE( read_file( "examples/sample.png", contents ) );
+    for( const LoadOptions& cooked : { options, LoadOptions() } )
+    {
+        std::string path;
+        uint64_t key = 0;
+        REQUIRE( cooked_path( contents, cooked, path, key ) );
+        REQUIRE( remove( path.c_str() ) == 0 );
+    }
+    setCookedCacheDirectory( "" );
+    rmdir( directory.c_str() );
+}
@@ -80,6 +80,14 @@
 #define TJH_DRAW_GLEW_H_LOCATION <GL/glew.h>
 #endif
 
+// If 1 the window gets an sRGB framebuffer and blending happens in linear light.
+// Colours passed to setColor() and the colour helpers are still sRGB, just like
+// normal, they are converted for you. Values written to red, green and blue
+// directly are treated as linear.
+#ifndef TJH_DRAW_SRGB
+#define TJH_DRAW_SRGB 0
+#endif
+
 // Change this to customise the namespace for this library
 #ifndef TJH_DRAW_NAMESPACE
 #define TJH_DRAW_NAMESPACE draw
@@ -90,6 +98,15 @@
 #define TJH_DRAW_PRINTF printf
 #endif
 
+// Change these to use your own allocator, all of the memory this library uses comes through them
+#ifndef TJH_DRAW_MALLOC
+#define TJH_DRAW_MALLOC malloc
+#endif
+
+#ifndef TJH_DRAW_FREE
+#define TJH_DRAW_FREE free
+#endif
+
 ////// TODO ////////////////////////////////////////////////////////////////////
 //
 //  - convert line() to use triangles, optional settable width
@@ -102,12 +119,7 @@
 //  - solid shapes have a line draw mode
 //      - when drawing shapes in line mode, lines expand inwards to preserve specified size
 //  - pointSize would be nice to have
-//  - 3d quad from point, normal, width, height
-//  - 3d textured quad
-//  - 3d circle from point, line, radius
-//  - 3d sphere
-//  - 3d cylinder
-//  - 3d line
+//  - 3d shapes ignore wireframe, they are always drawn solid
 //  - setWireframe toggle wireframe rendering for at least all the 2d stuff
 //      - wireframes should also respond to lineWidth
 //      - wireframes should work with textured draw calls
@@ -152,12 +164,21 @@ namespace TJH_DRAW_NAMESPACE
     bool init( const char* title, GLfloat width, GLfloat height );
     void shutdown();
 
-    void clear( GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f )             { glClearColor( r, g, b, a ); glClear( GL_COLOR_BUFFER_BIT ); }
+    // Clears depth too, debug lines are depth tested and would otherwise fail against last frame's
+    void clear( GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f )             { glClearColor( r, g, b, a ); glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT ); }
     void flush();
-    void present()                                                              { flush(); SDL_GL_SwapWindow( sdl_window ); }
+    void flushDebugLines();
+    void present()                                                              { flush(); flushDebugLines(); SDL_GL_SwapWindow( sdl_window ); }
 
     bool setVsync( bool enable );
 
+    // Allocates room for `vertices` vertices and `debug_lines` debug lines up front.
+    // If `fixed` is true the buffers will never grow after this, instead they are
+    // flushed early when full (debug lines that don't fit are dropped) so that no
+    // memory is allocated while drawing. The unit meshes for the 3D shapes are
+    // still generated the first time each one is used, so draw a warm up frame.
+    void reserve( size_t vertices, size_t debug_lines, bool fixed = true );
+
     void getSize( int* width, int* height )                                     { SDL_GetWindowSize( sdl_window, width, height ); }
 
     // DRAWING ////////////////////////////////////////////////////////////////
@@ -166,14 +187,14 @@ namespace TJH_DRAW_NAMESPACE
 
     extern float red;           // Colour to draw with (does not affect clear colour!)
     extern float green;         //  Normal values are in the range [0.0, 1.0]
-    extern float blue;          //  Set them direclty or use setColor(r,g,b,a);
+    extern float blue;          //  Set them direclty or use setColor(r,g,b,a); (see TJH_DRAW_SRGB)
     extern float alpha;         // 0.0 == transparent, 1.0 == opaque/solid
 
     extern float lineWidth;     // 
     extern float orthoDepth;    // Depth (z value) at which to draw 2D shapes
     extern bool  wireframe;     //
 
-    void setColor( GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f )          { red = r; green = g; blue = b; alpha = a; }
+    void setColor( GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f );
     void setColor( float c )                                                    { setColor( c, c, c ); }
     void setDepth( GLfloat depth )                                              { orthoDepth = depth; }
     void setLineWidth( GLfloat width )                                          { lineWidth = width; }
@@ -225,6 +246,112 @@ namespace TJH_DRAW_NAMESPACE
         GLfloat x2, GLfloat y2, GLfloat z2,
         GLfloat x3, GLfloat y3, GLfloat z3,
         GLfloat x4, GLfloat y4, GLfloat z4 );
+
+    // Lines are drawn as a quad lineWidth units wide facing the view direction,
+    // so remember to call setViewDirection() when your camera moves
+    void line( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2 );
+
+    // Quads and circles are centred on x,y,z and face along the normal nx,ny,nz
+    void quad( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat width, GLfloat height );
+    void circle( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat radius, int segments = 16 );
+
+    // Detail is the number of times the icosahedron is subdivided, [0, 4]
+    void sphere( GLfloat x, GLfloat y, GLfloat z, GLfloat radius, int detail = 2 );
+    void cylinder( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat radius, int segments = 16 );
+
+    void texturedQuad( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat width, GLfloat height,
+        GLfloat s = 0.0f, GLfloat t = 0.0f, GLfloat s_width = 1.0f, GLfloat t_height = 1.0f );
+    void texturedTriangle( GLfloat x1, GLfloat y1, GLfloat z1,
+        GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat x3, GLfloat y3, GLfloat z3,
+        GLfloat s1, GLfloat t1, GLfloat s2, GLfloat t2, GLfloat s3, GLfloat t3 );
+
+    // COLOUR /////////////////////////////////////////////////////////////////
+    //
+    // All values are in the range [0, 1] and hue wraps around. The array versions
+    // convert `count` colours in one go and write 4 floats (RGBA) per colour to `rgba`,
+    // ready to be assigned to red, green, blue and alpha. That means they come out
+    // linear when TJH_DRAW_SRGB is enabled, just like setColor() would do.
+    //
+
+    float srgbToLinear( float c );
+    float linearToSrgb( float c );
+
+    void hsvToRgb( float h, float s, float v, float* r, float* g, float* b );
+    void hslToRgb( float h, float s, float l, float* r, float* g, float* b );
+
+    void hsvToRgba( const float* hsv, float* rgba, size_t count, float a = 1.0f );
+    void hslToRgba( const float* hsl, float* rgba, size_t count, float a = 1.0f );
+    void unpackRgba8( const unsigned char* rgba8, float* rgba, size_t count );
+
+    // A 256 entry colour lookup table, handy for turning values into heatmaps
+    struct Palette
+    {
+        float rgba[256 * 4];
+    };
+
+    // Blends evenly spaced RGBA `stops` (4 floats each, at least 2) into the palette
+    void makePalette( Palette* palette, const float* stops, size_t stop_count );
+    void paletteToRgba( const Palette& palette, const float* values, float* rgba, size_t count );
+
+    // LAYERS /////////////////////////////////////////////////////////////////
+    //
+    // A layer is a texture you can draw into. Use them for things that are expensive
+    // to draw but don't change often, like a minimap, then each frame drawing it only
+    // costs one textured rect:
+    //
+    //  if( draw::pushLayer( &minimap ) )
+    //  {
+    //      draw::clear( 0, 0, 0, 0 );
+    //      ... draw the minimap ...
+    //      draw::popLayer();
+    //  }
+    //  draw::drawLayer( minimap, x, y, width, height );
+    //
+    // pushLayer() redirects drawing into the layer and sets the ortho matrix to the
+    // layer size, popLayer() puts everything back how it was. Static layers are only
+    // redrawn after invalidateLayer(), until then pushLayer() returns false and you
+    // should skip drawing them. Layers can be pushed inside each other.
+    //
+
+    struct Layer
+    {
+        GLuint framebuffer  = 0;
+        GLuint texture      = 0;
+        int width           = 0;
+        int height          = 0;
+        bool isStatic       = false;
+        bool valid          = false;    // True once drawn, until it is invalidated
+    };
+
+    bool createLayer( Layer* layer, int width, int height, bool is_static = false );
+    void destroyLayer( Layer* layer );
+    void invalidateLayer( Layer* layer )                                        { layer->valid = false; }
+    bool pushLayer( Layer* layer );
+    void popLayer();
+    void drawLayer( const Layer& layer, GLfloat x, GLfloat y, GLfloat width, GLfloat height );
+
+    // DEBUG LINES ////////////////////////////////////////////////////////////
+    //
+    // For when you need a LOT of 3D lines, physics or navmesh debugging for example.
+    // Debug lines live in their own buffer and are drawn with GL_LINES using the MVP
+    // matrix whenever flushDebugLines() is called, present() does this for you.
+    // Lines outside the view frustum are skipped before anything is sent to OpenGL.
+    //
+    // A line is drawn for `frames` calls to flushDebugLines(), or for `seconds`
+    // seconds, so geometry that doesn't change does not need to be resubmitted.
+    //
+
+    extern bool debugLinesDepthTest;    // Test debug lines against the depth buffer, which clear() clears
+
+    void debugLine( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, int frames = 1 );
+    void debugLineForSeconds( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, float seconds );
+    void clearDebugLines();
+    size_t debugLineCount();
 }
 
 #endif
@@ -233,10 +360,30 @@ namespace TJH_DRAW_NAMESPACE
 #ifdef TJH_DRAW_IMPLEMENTATION
 
 #include <vector>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
 
 namespace TJH_DRAW_NAMESPACE
 {
+    // Routes every container allocation through TJH_DRAW_MALLOC and TJH_DRAW_FREE
+    template<typename T>
+    struct Allocator
+    {
+        typedef T value_type;
+
+        Allocator() = default;
+        template<typename U> Allocator( const Allocator<U>& ) {}
+
+        T* allocate( size_t n )         { return static_cast<T*>( TJH_DRAW_MALLOC( n * sizeof(T) ) ); }
+        void deallocate( T* p, size_t ) { TJH_DRAW_FREE( p ); }
+    };
+    template<typename T, typename U> bool operator == ( const Allocator<T>&, const Allocator<U>& ) { return true; }
+    template<typename T, typename U> bool operator != ( const Allocator<T>&, const Allocator<U>& ) { return false; }
+
+    template<typename T> using Vector = std::vector<T, Allocator<T>>;
+
     // PUBLIC MEMBER VARIABLES
     SDL_Window*     sdl_window      = NULL;
     SDL_GLContext   sdl_gl_context  = NULL;
@@ -250,6 +397,7 @@ namespace TJH_DRAW_NAMESPACE
     float lineWidth         = 1.0f;
     float orthoDepth        = 0.0f;
     bool  wireframe         = false;
+    bool  debugLinesDepthTest = true;
 
     // 'PRIVATE' MEMBER VARIABLES
     enum class DrawMode { Colour2D, Texture2D, Colour3D, Texture3D };
@@ -276,7 +424,59 @@ namespace TJH_DRAW_NAMESPACE
 
     GLfloat mvp_matrix_[16]         = { 0.0f };
     GLfloat ortho_matrix_[16]       = { 0.0f };
-    std::vector<GLfloat> vertex_buffer_;
+    Vector<GLfloat> vertex_buffer_;
+    bool fixed_capacity_            = false;
+
+    // Unit meshes for the 3D shapes, generated the first time they are needed
+    // and then just scaled and moved into place for each shape that is drawn
+    static const int MAX_SPHERE_DETAIL_ = 4;
+    Vector<GLfloat> unit_spheres_[MAX_SPHERE_DETAIL_ + 1];
+    // Circles and cylinders can have any number of segments, so the few most recently used
+    // of each are kept, most recent first
+    static const int UNIT_MESH_CACHE_SIZE_ = 8;
+    struct UnitMesh
+    {
+        int segments = 0;
+        Vector<GLfloat> positions;
+    };
+    UnitMesh unit_cylinders_[UNIT_MESH_CACHE_SIZE_];
+    UnitMesh unit_circles_[UNIT_MESH_CACHE_SIZE_];
+
+    // Debug lines are stored as a structure of arrays so culling only touches the positions
+    struct DebugLines
+    {
+        Vector<GLfloat> x1, y1, z1;
+        Vector<GLfloat> x2, y2, z2;
+        Vector<GLuint>  colour;        // RGBA8, same byte order as the vertex attribute
+        Vector<GLint>   frames_left;   // Decremented each flush, removed at zero
+        Vector<Uint32>  expires;       // SDL_GetTicks() time to remove the line, or 0
+    };
+    struct DebugLineVertex
+    {
+        GLfloat x, y, z;
+        GLuint colour;
+    };
+    DebugLines debug_lines_;
+    Vector<DebugLineVertex> debug_line_vertices_;
+    GLuint debug_line_vao_ = 0;
+    GLuint debug_line_vbo_ = 0;
+
+    // Colour conversion tables, filled by init_colour_tables()
+    bool colour_tables_ready_ = false;
+    float byte_to_draw_colour_[256];            // 8-bit sRGB to a colour ready to draw with
+    static const int SRGB_TABLE_SIZE_ = 4096;
+    float srgb_to_linear_[SRGB_TABLE_SIZE_ + 1];  // Sampled sRGB to linear curve
+
+    // Everything pushLayer() changes, so popLayer() can put it back
+    struct LayerState
+    {
+        GLint framebuffer;
+        GLint viewport[4];
+        float x_offset, y_offset, width, height;
+    };
+    static const int MAX_LAYER_DEPTH_ = 8;
+    LayerState layer_stack_[MAX_LAYER_DEPTH_];
+    int layer_depth_ = 0;
 
     GLuint font_ = 0;
     static const unsigned char font_data_[128*128] = {
@@ -419,6 +619,21 @@ namespace TJH_DRAW_NAMESPACE
     static void send_ortho_matrix();
     static void send_mvp_matrix();
 
+    static bool begin_primitive( DrawMode mode, size_t vertices );
+    static void init_colour_tables();
+    static float to_draw_colour( float c );
+    static GLfloat* push_floats( size_t count );
+    static void push_transformed( const Vector<GLfloat>& positions, const GLfloat* basis, GLfloat x, GLfloat y, GLfloat z );
+    // Two triangles, whatever wireframe is set to, like the other 3D shapes
+    static void push_solid_quad( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat x3, GLfloat y3, GLfloat z3, GLfloat x4, GLfloat y4, GLfloat z4 );
+    static void make_basis( GLfloat nx, GLfloat ny, GLfloat nz, GLfloat* basis );
+    static const Vector<GLfloat>& get_unit_sphere( int detail );
+    static UnitMesh& find_unit_mesh( UnitMesh* meshes, int segments );
+    static const Vector<GLfloat>& get_unit_cylinder( int segments );
+    static const Vector<GLfloat>& get_unit_circle( int segments );
+    static void push_debug_line( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, GLint frames, Uint32 expires );
+
     static GLuint create_shader( GLenum type, const char* source );
     static GLuint create_program( GLuint vertex_shader, GLuint fragment_shader );
 
@@ -442,6 +657,9 @@ namespace TJH_DRAW_NAMESPACE
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
         SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
         SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+    #if TJH_DRAW_SRGB
+        SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1);
+    #endif
 
         sdl_window = SDL_CreateWindow( title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_OPENGL );
         if( sdl_window == NULL )
@@ -466,6 +684,10 @@ namespace TJH_DRAW_NAMESPACE
         }
 
         glEnable(GL_MULTISAMPLE);
+    #if TJH_DRAW_SRGB
+        glEnable(GL_FRAMEBUFFER_SRGB);
+    #endif
+        init_colour_tables();
         
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -564,12 +786,26 @@ namespace TJH_DRAW_NAMESPACE
         glEnableVertexAttribArray( texAtrib );
         glVertexAttribPointer( texAtrib, 2, GL_FLOAT, GL_FALSE, 9*sizeof(GLfloat), (void*)(7*sizeof(float)) );
 
+        // Debug lines use the colour program, but with the colour packed into bytes
+        glGenVertexArrays( 1, &debug_line_vao_ );
+        glBindVertexArray( debug_line_vao_ );
+        glGenBuffers( 1, &debug_line_vbo_ );
+        glBindBuffer( GL_ARRAY_BUFFER, debug_line_vbo_ );
+
+        posAtrib = glGetAttribLocation( colour_program_, "vPos" );
+        glEnableVertexAttribArray( posAtrib );
+        glVertexAttribPointer( posAtrib, 3, GL_FLOAT, GL_FALSE, sizeof(DebugLineVertex), 0 );
+
+        colAtrib = glGetAttribLocation( colour_program_, "vCol" );
+        glEnableVertexAttribArray( colAtrib );
+        glVertexAttribPointer( colAtrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DebugLineVertex), (void*)(3*sizeof(float)) );
+
         glGenTextures( 1, &font_ );
         glBindTexture( GL_TEXTURE_2D, font_ );
         // Tell all components to read from the read channel
         GLint swizzleMask[] = { GL_RED, GL_RED, GL_RED, GL_RED };
         glTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask );
-        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, 128, 128, 0, GL_RED, GL_UNSIGNED_BYTE, font_data_ );
+        glTexImage2D( GL_TEXTURE_2D, 0, TJH_DRAW_SRGB ? GL_SRGB8 : GL_RGB, 128, 128, 0, GL_RED, GL_UNSIGNED_BYTE, font_data_ );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
         glGenerateMipmap( GL_TEXTURE_2D );
@@ -592,11 +828,15 @@ namespace TJH_DRAW_NAMESPACE
         DELETE_AND_ZERO_RESOURCE( texture_vao_, glDeleteVertexArrays );
         DELETE_AND_ZERO_RESOURCE( colour_vbo_, glDeleteBuffers );
         DELETE_AND_ZERO_RESOURCE( texture_vbo_, glDeleteBuffers );
+        DELETE_AND_ZERO_RESOURCE( debug_line_vao_, glDeleteVertexArrays );
+        DELETE_AND_ZERO_RESOURCE( debug_line_vbo_, glDeleteBuffers );
     #undef DELETE_AND_ZERO_RESOURCE
 
         delete_and_zero_program( colour_program_ );
         delete_and_zero_program( texture_program_ );
 
+        clearDebugLines();
+
         SDL_GL_DeleteContext( sdl_gl_context );
         sdl_gl_context = NULL;
         SDL_DestroyWindow( sdl_window );
@@ -627,6 +867,22 @@ namespace TJH_DRAW_NAMESPACE
         }
     }
 
+    void reserve( size_t vertices, size_t debug_lines, bool fixed )
+    {
+        // Textured vertices are the biggest
+        vertex_buffer_.reserve( vertices * 9 );
+
+        DebugLines& l = debug_lines_;
+        l.x1.reserve( debug_lines ); l.y1.reserve( debug_lines ); l.z1.reserve( debug_lines );
+        l.x2.reserve( debug_lines ); l.y2.reserve( debug_lines ); l.z2.reserve( debug_lines );
+        l.colour.reserve( debug_lines );
+        l.frames_left.reserve( debug_lines );
+        l.expires.reserve( debug_lines );
+        debug_line_vertices_.reserve( debug_lines * 2 );
+
+        fixed_capacity_ = fixed;
+    }
+
     void flush()
     {
         if( vertex_buffer_.empty() ) return;
@@ -712,17 +968,14 @@ namespace TJH_DRAW_NAMESPACE
     
     void point( GLfloat x, GLfloat y )
     {
-        if( current_mode_ != DrawMode::Colour2D ) flush();
+        if( !begin_primitive( DrawMode::Colour2D, 6 ) ) return;
 
         pushTriangle( x    , y    , x + 1, y    , x + 1, y + 1 );
         pushTriangle( x    , y    , x + 1, y + 1, x    , y + 1 );
-
-        current_mode_ = DrawMode::Colour2D;
     }
     void line( GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2 )
     {
-        if( current_mode_ != DrawMode::Colour2D ) flush();
-        current_mode_ = DrawMode::Colour2D;
+        if( !begin_primitive( DrawMode::Colour2D, 6 ) ) return;
 
         GLfloat x12 = x2 - x1;
         GLfloat y12 = y2 - y1;
@@ -746,8 +999,7 @@ namespace TJH_DRAW_NAMESPACE
     }
     void rect( GLfloat x, GLfloat y, GLfloat width, GLfloat height )
     {
-        if( current_mode_ != DrawMode::Colour2D ) flush();
-        current_mode_ = DrawMode::Colour2D;
+        if( !begin_primitive( DrawMode::Colour2D, wireframe ? 24 : 6 ) ) return;
 
         if( !wireframe )
         {
@@ -780,11 +1032,9 @@ namespace TJH_DRAW_NAMESPACE
     
     void triangle( GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2, GLfloat x3, GLfloat y3 )
     {
-        if( current_mode_ != DrawMode::Colour2D ) flush();
-        current_mode_ = DrawMode::Colour2D;
-
         if( !wireframe )
         {
+            if( !begin_primitive( DrawMode::Colour2D, 3 ) ) return;
             pushTriangle( x1, y1, x2, y2, x3, y3 );
         } else {
 
@@ -802,8 +1052,7 @@ namespace TJH_DRAW_NAMESPACE
 
     void ellipse( float x, float y, float xRadius, float yRadius, int segments )
     {
-        if( current_mode_ != DrawMode::Colour2D ) flush();
-        current_mode_ = DrawMode::Colour2D;
+        if( !begin_primitive( DrawMode::Colour2D, segments * (wireframe ? 6 : 3) ) ) return;
 
         const float frac = (PI*2) / (float)segments;
 
@@ -845,8 +1094,7 @@ namespace TJH_DRAW_NAMESPACE
     void texturedRect( GLfloat x, GLfloat y, GLfloat width, GLfloat height,
         GLfloat s, GLfloat t, GLfloat s_width, GLfloat t_height )
     {
-        if( current_mode_ != DrawMode::Texture2D ) flush();
-        current_mode_ = DrawMode::Texture2D;
+        if( !begin_primitive( DrawMode::Texture2D, 6 ) ) return;
 
         if( !wireframe )
         {
@@ -863,8 +1111,7 @@ namespace TJH_DRAW_NAMESPACE
     void texturedTriangle( GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2, GLfloat x3, GLfloat y3,
         GLfloat s1, GLfloat t1, GLfloat s2, GLfloat t2, GLfloat s3, GLfloat t3 )
     {
-        if( current_mode_ != DrawMode::Texture2D ) flush();
-        current_mode_ = DrawMode::Texture2D;
+        if( !begin_primitive( DrawMode::Texture2D, 3 ) ) return;
 
         if( !wireframe )
         {
@@ -915,8 +1162,7 @@ namespace TJH_DRAW_NAMESPACE
         GLfloat x2, GLfloat y2, GLfloat z2,
         GLfloat x3, GLfloat y3, GLfloat z3 )
     {
-        if( current_mode_ != DrawMode::Colour3D ) flush();
-        current_mode_ = DrawMode::Colour3D;
+        if( !begin_primitive( DrawMode::Colour3D, 3 ) ) return;
 
         if( !wireframe )
         {
@@ -932,22 +1178,478 @@ namespace TJH_DRAW_NAMESPACE
         GLfloat x3, GLfloat y3, GLfloat z3,
         GLfloat x4, GLfloat y4, GLfloat z4 )
     {
-        if( current_mode_ != DrawMode::Colour3D ) flush();
-        current_mode_ = DrawMode::Colour3D;
-
         if( !wireframe )
         {
-            push3( x1, y1, z1 ); push4( red, green, blue, alpha );
-            push3( x2, y2, z2 ); push4( red, green, blue, alpha );
-            push3( x3, y3, z3 ); push4( red, green, blue, alpha );
-            push3( x1, y1, z1 ); push4( red, green, blue, alpha );
-            push3( x3, y3, z3 ); push4( red, green, blue, alpha );
-            push3( x4, y4, z4 ); push4( red, green, blue, alpha );
+            push_solid_quad( x1, y1, z1, x2, y2, z2, x3, y3, z3, x4, y4, z4 );
         } else {
 
         }
     }
 
+    void line( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2 )
+    {
+        const GLfloat dx = x2 - x1;
+        const GLfloat dy = y2 - y1;
+        const GLfloat dz = z2 - z1;
+
+        // The line is widened along the axis perpendicular to both the line and the view
+        GLfloat sx = dy * view_z_ - dz * view_y_;
+        GLfloat sy = dz * view_x_ - dx * view_z_;
+        GLfloat sz = dx * view_y_ - dy * view_x_;
+        GLfloat length = std::sqrt( sx * sx + sy * sy + sz * sz );
+
+        if( length < 1e-6f )
+        {
+            // Looking straight down the line (or no view direction set) pick any perpendicular
+            GLfloat basis[9];
+            make_basis( dx, dy, dz, basis );
+            sx = basis[0]; sy = basis[1]; sz = basis[2];
+            length = 1.0f;
+        }
+
+        const GLfloat scale = lineWidth * 0.5f / length;
+        sx *= scale; sy *= scale; sz *= scale;
+
+        push_solid_quad( x1 - sx, y1 - sy, z1 - sz,
+                         x2 - sx, y2 - sy, z2 - sz,
+                         x2 + sx, y2 + sy, z2 + sz,
+                         x1 + sx, y1 + sy, z1 + sz );
+    }
+    void quad( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat width, GLfloat height )
+    {
+        GLfloat basis[9];
+        make_basis( nx, ny, nz, basis );
+
+        const GLfloat ux = basis[0] * width * 0.5f,  uy = basis[1] * width * 0.5f,  uz = basis[2] * width * 0.5f;
+        const GLfloat vx = basis[3] * height * 0.5f, vy = basis[4] * height * 0.5f, vz = basis[5] * height * 0.5f;
+
+        push_solid_quad( x - ux - vx, y - uy - vy, z - uz - vz,
+                         x + ux - vx, y + uy - vy, z + uz - vz,
+                         x + ux + vx, y + uy + vy, z + uz + vz,
+                         x - ux + vx, y - uy + vy, z - uz + vz );
+    }
+    void circle( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat radius, int segments )
+    {
+        const Vector<GLfloat>& mesh = get_unit_circle( segments );
+        if( !begin_primitive( DrawMode::Colour3D, mesh.size() / 3 ) ) return;
+
+        GLfloat basis[9];
+        make_basis( nx, ny, nz, basis );
+        for( int i = 0; i < 9; i++ ) basis[i] *= radius;
+
+        push_transformed( mesh, basis, x, y, z );
+    }
+    void sphere( GLfloat x, GLfloat y, GLfloat z, GLfloat radius, int detail )
+    {
+        const Vector<GLfloat>& mesh = get_unit_sphere( detail );
+        if( !begin_primitive( DrawMode::Colour3D, mesh.size() / 3 ) ) return;
+
+        const GLfloat basis[9] = {
+            radius, 0.0f, 0.0f,
+            0.0f, radius, 0.0f,
+            0.0f, 0.0f, radius
+        };
+
+        push_transformed( mesh, basis, x, y, z );
+    }
+    void cylinder( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat radius, int segments )
+    {
+        const Vector<GLfloat>& mesh = get_unit_cylinder( segments );
+        if( !begin_primitive( DrawMode::Colour3D, mesh.size() / 3 ) ) return;
+
+        GLfloat basis[9];
+        make_basis( x2 - x1, y2 - y1, z2 - z1, basis );
+        for( int i = 0; i < 6; i++ ) basis[i] *= radius;
+
+        // The unit cylinder runs from z = 0 to z = 1 so the last axis spans the whole length
+        basis[6] = x2 - x1;
+        basis[7] = y2 - y1;
+        basis[8] = z2 - z1;
+
+        push_transformed( mesh, basis, x1, y1, z1 );
+    }
+
+    //
+    // Textured 3D primatives
+    //
+
+    void texturedQuad( GLfloat x, GLfloat y, GLfloat z, GLfloat nx, GLfloat ny, GLfloat nz,
+        GLfloat width, GLfloat height,
+        GLfloat s, GLfloat t, GLfloat s_width, GLfloat t_height )
+    {
+        if( !begin_primitive( DrawMode::Texture3D, 6 ) ) return;
+
+        GLfloat basis[9];
+        make_basis( nx, ny, nz, basis );
+
+        const GLfloat ux = basis[0] * width * 0.5f,  uy = basis[1] * width * 0.5f,  uz = basis[2] * width * 0.5f;
+        const GLfloat vx = basis[3] * height * 0.5f, vy = basis[4] * height * 0.5f, vz = basis[5] * height * 0.5f;
+
+        push3( x - ux - vx, y - uy - vy, z - uz - vz ); push4( red, green, blue, alpha ); push2( s, t );
+        push3( x + ux - vx, y + uy - vy, z + uz - vz ); push4( red, green, blue, alpha ); push2( s + s_width, t );
+        push3( x + ux + vx, y + uy + vy, z + uz + vz ); push4( red, green, blue, alpha ); push2( s + s_width, t + t_height );
+
+        push3( x - ux - vx, y - uy - vy, z - uz - vz ); push4( red, green, blue, alpha ); push2( s, t );
+        push3( x + ux + vx, y + uy + vy, z + uz + vz ); push4( red, green, blue, alpha ); push2( s + s_width, t + t_height );
+        push3( x - ux + vx, y - uy + vy, z - uz + vz ); push4( red, green, blue, alpha ); push2( s, t + t_height );
+    }
+    void texturedTriangle( GLfloat x1, GLfloat y1, GLfloat z1,
+        GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat x3, GLfloat y3, GLfloat z3,
+        GLfloat s1, GLfloat t1, GLfloat s2, GLfloat t2, GLfloat s3, GLfloat t3 )
+    {
+        if( !begin_primitive( DrawMode::Texture3D, 3 ) ) return;
+
+        push3( x1, y1, z1 ); push4( red, green, blue, alpha ); push2( s1, t1 );
+        push3( x2, y2, z2 ); push4( red, green, blue, alpha ); push2( s2, t2 );
+        push3( x3, y3, z3 ); push4( red, green, blue, alpha ); push2( s3, t3 );
+    }
+
+    // COLOUR //////////////////////////////////////////////////////////////////
+
+    void setColor( GLfloat r, GLfloat g, GLfloat b, GLfloat a )
+    {
+        red   = to_draw_colour( r );
+        green = to_draw_colour( g );
+        blue  = to_draw_colour( b );
+        alpha = a;
+    }
+
+    float srgbToLinear( float c )
+    {
+        return c <= 0.04045f ? c / 12.92f : std::pow( (c + 0.055f) / 1.055f, 2.4f );
+    }
+    float linearToSrgb( float c )
+    {
+        return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow( c, 1.0f / 2.4f ) - 0.055f;
+    }
+
+    //
+    // The conversions below are written without branches so the array versions
+    // can be vectorised by the compiler, see https://en.wikipedia.org/wiki/HSL_and_HSV
+    //
+
+    void hsvToRgb( float h, float s, float v, float* r, float* g, float* b )
+    {
+        auto channel = [=]( float n ) {
+            float k = n + h * 6.0f;
+            k -= 6.0f * std::floor( k / 6.0f );
+            return v - v * s * std::fmax( 0.0f, std::fmin( std::fmin( k, 4.0f - k ), 1.0f ) );
+        };
+        *r = channel( 5.0f );
+        *g = channel( 3.0f );
+        *b = channel( 1.0f );
+    }
+    void hslToRgb( float h, float s, float l, float* r, float* g, float* b )
+    {
+        const float a = s * std::fmin( l, 1.0f - l );
+        auto channel = [=]( float n ) {
+            float k = n + h * 12.0f;
+            k -= 12.0f * std::floor( k / 12.0f );
+            return l - a * std::fmax( -1.0f, std::fmin( std::fmin( k - 3.0f, 9.0f - k ), 1.0f ) );
+        };
+        *r = channel( 0.0f );
+        *g = channel( 8.0f );
+        *b = channel( 4.0f );
+    }
+
+    void hsvToRgba( const float* hsv, float* rgba, size_t count, float a )
+    {
+        init_colour_tables();
+        for( size_t i = 0; i < count; i++ )
+        {
+            float r, g, b;
+            hsvToRgb( hsv[i*3], hsv[i*3 + 1], hsv[i*3 + 2], &r, &g, &b );
+            rgba[i*4    ] = to_draw_colour( r );
+            rgba[i*4 + 1] = to_draw_colour( g );
+            rgba[i*4 + 2] = to_draw_colour( b );
+            rgba[i*4 + 3] = a;
+        }
+    }
+    void hslToRgba( const float* hsl, float* rgba, size_t count, float a )
+    {
+        init_colour_tables();
+        for( size_t i = 0; i < count; i++ )
+        {
+            float r, g, b;
+            hslToRgb( hsl[i*3], hsl[i*3 + 1], hsl[i*3 + 2], &r, &g, &b );
+            rgba[i*4    ] = to_draw_colour( r );
+            rgba[i*4 + 1] = to_draw_colour( g );
+            rgba[i*4 + 2] = to_draw_colour( b );
+            rgba[i*4 + 3] = a;
+        }
+    }
+    void unpackRgba8( const unsigned char* rgba8, float* rgba, size_t count )
+    {
+        init_colour_tables();
+        for( size_t i = 0; i < count; i++ )
+        {
+            rgba[i*4    ] = byte_to_draw_colour_[ rgba8[i*4    ] ];
+            rgba[i*4 + 1] = byte_to_draw_colour_[ rgba8[i*4 + 1] ];
+            rgba[i*4 + 2] = byte_to_draw_colour_[ rgba8[i*4 + 2] ];
+            rgba[i*4 + 3] = rgba8[i*4 + 3] * (1.0f / 255.0f);
+        }
+    }
+
+    void makePalette( Palette* palette, const float* stops, size_t stop_count )
+    {
+        if( stop_count < 2 )
+        {
+            TJH_DRAW_PRINTF("ERROR: a palette needs at least 2 colour stops\n");
+            return;
+        }
+
+        // Blend in sRGB like the stops were given, then convert once here so
+        // looking up colours later costs nothing extra
+        init_colour_tables();
+        for( int i = 0; i < 256; i++ )
+        {
+            const float position = (i / 255.0f) * (stop_count - 1);
+            size_t stop = (size_t)position;
+            if( stop >= stop_count - 1 ) stop = stop_count - 2;
+            const float t = position - stop;
+
+            const float* from = &stops[stop * 4];
+            const float* to = &stops[(stop + 1) * 4];
+            for( int c = 0; c < 4; c++ )
+            {
+                const float value = from[c] + (to[c] - from[c]) * t;
+                palette->rgba[i*4 + c] = c < 3 ? to_draw_colour( value ) : value;
+            }
+        }
+    }
+    void paletteToRgba( const Palette& palette, const float* values, float* rgba, size_t count )
+    {
+        for( size_t i = 0; i < count; i++ )
+        {
+            const float v = std::fmin( std::fmax( values[i], 0.0f ), 1.0f );
+            const float* colour = &palette.rgba[ (int)(v * 255.0f + 0.5f) * 4 ];
+            rgba[i*4    ] = colour[0];
+            rgba[i*4 + 1] = colour[1];
+            rgba[i*4 + 2] = colour[2];
+            rgba[i*4 + 3] = colour[3];
+        }
+    }
+
+    // LAYERS //////////////////////////////////////////////////////////////////
+
+    bool createLayer( Layer* layer, int width, int height, bool is_static )
+    {
+        destroyLayer( layer );
+
+        glGenTextures( 1, &layer->texture );
+        glBindTexture( GL_TEXTURE_2D, layer->texture );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexImage2D( GL_TEXTURE_2D, 0, TJH_DRAW_SRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        GLint previous_framebuffer = 0;
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING, &previous_framebuffer );
+
+        glGenFramebuffers( 1, &layer->framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, layer->framebuffer );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer->texture, 0 );
+        const bool complete = glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer( GL_FRAMEBUFFER, previous_framebuffer );
+
+        layer->width = width;
+        layer->height = height;
+        layer->isStatic = is_static;
+        layer->valid = false;
+
+        if( !complete )
+        {
+            TJH_DRAW_PRINTF("ERROR: could not create %dx%d layer framebuffer\n", width, height);
+            destroyLayer( layer );
+            return false;
+        }
+        return true;
+    }
+    void destroyLayer( Layer* layer )
+    {
+        if( layer->framebuffer ) { glDeleteFramebuffers( 1, &layer->framebuffer ); layer->framebuffer = 0; }
+        if( layer->texture )     { glDeleteTextures( 1, &layer->texture );         layer->texture = 0; }
+        layer->valid = false;
+    }
+    bool pushLayer( Layer* layer )
+    {
+        if( layer->isStatic && layer->valid ) return false;
+        if( layer->framebuffer == 0 )
+        {
+            TJH_DRAW_PRINTF("ERROR: pushing a layer that was not created\n");
+            return false;
+        }
+        if( layer_depth_ == MAX_LAYER_DEPTH_ )
+        {
+            TJH_DRAW_PRINTF("ERROR: too many layers pushed, the limit is %d\n", MAX_LAYER_DEPTH_);
+            return false;
+        }
+
+        // Everything drawn so far belongs to whatever was bound before
+        flush();
+
+        LayerState& state = layer_stack_[layer_depth_++];
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING, &state.framebuffer );
+        glGetIntegerv( GL_VIEWPORT, state.viewport );
+        state.x_offset = x_offset_;
+        state.y_offset = y_offset_;
+        state.width = width_;
+        state.height = height_;
+
+        glBindFramebuffer( GL_FRAMEBUFFER, layer->framebuffer );
+        glViewport( 0, 0, layer->width, layer->height );
+        setOrthoMatrix( layer->width, layer->height );
+
+        layer->valid = true;
+        return true;
+    }
+    void popLayer()
+    {
+        if( layer_depth_ == 0 )
+        {
+            TJH_DRAW_PRINTF("ERROR: popLayer called without a matching pushLayer\n");
+            return;
+        }
+
+        flush();
+
+        const LayerState& state = layer_stack_[--layer_depth_];
+        glBindFramebuffer( GL_FRAMEBUFFER, state.framebuffer );
+        glViewport( state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3] );
+        setOrthoMatrix( state.x_offset, state.y_offset, state.width, state.height );
+    }
+    void drawLayer( const Layer& layer, GLfloat x, GLfloat y, GLfloat width, GLfloat height )
+    {
+        // Textured shapes use whatever texture is bound when they are flushed,
+        // so the layer has to be drawn on its own
+        flush();
+
+        GLint previous_texture = 0;
+        glGetIntegerv( GL_TEXTURE_BINDING_2D, &previous_texture );
+        glBindTexture( GL_TEXTURE_2D, layer.texture );
+
+        texturedRect( x, y, width, height );
+        flush();
+
+        glBindTexture( GL_TEXTURE_2D, previous_texture );
+    }
+
+    // DEBUG LINES /////////////////////////////////////////////////////////////
+
+    void debugLine( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, int frames )
+    {
+        if( frames < 1 ) frames = 1;
+        push_debug_line( x1, y1, z1, x2, y2, z2, frames, 0 );
+    }
+    void debugLineForSeconds( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, float seconds )
+    {
+        // Always draw for at least one frame, even if the time is very short
+        Uint32 expires = SDL_GetTicks() + (Uint32)(seconds * 1000.0f);
+        if( expires == 0 ) expires = 1;
+        push_debug_line( x1, y1, z1, x2, y2, z2, 1, expires );
+    }
+    void clearDebugLines()
+    {
+        debug_lines_.x1.clear(); debug_lines_.y1.clear(); debug_lines_.z1.clear();
+        debug_lines_.x2.clear(); debug_lines_.y2.clear(); debug_lines_.z2.clear();
+        debug_lines_.colour.clear();
+        debug_lines_.frames_left.clear();
+        debug_lines_.expires.clear();
+    }
+    size_t debugLineCount()
+    {
+        return debug_lines_.x1.size();
+    }
+    void flushDebugLines()
+    {
+        // Anything already batched was submitted first so should be drawn first
+        flush();
+
+        DebugLines& l = debug_lines_;
+        const size_t count = l.x1.size();
+        if( count == 0 ) return;
+
+        // Extract the frustum planes from the MVP matrix, a point is outside a plane
+        // when a*x + b*y + c*z + d < 0
+        const GLfloat* m = mvp_matrix_;
+        GLfloat planes[6][4];
+        for( int i = 0; i < 3; i++ )
+        {
+            for( int j = 0; j < 4; j++ )
+            {
+                planes[i*2    ][j] = m[j*4 + 3] + m[j*4 + i];
+                planes[i*2 + 1][j] = m[j*4 + 3] - m[j*4 + i];
+            }
+        }
+
+        // Copy the lines that are at least partly inside the frustum into the vertex array
+        debug_line_vertices_.resize( count * 2 );
+        DebugLineVertex* out = debug_line_vertices_.data();
+        size_t visible = 0;
+        for( size_t i = 0; i < count; i++ )
+        {
+            bool culled = false;
+            for( int p = 0; p < 6; p++ )
+            {
+                const GLfloat* plane = planes[p];
+                const bool out1 = plane[0] * l.x1[i] + plane[1] * l.y1[i] + plane[2] * l.z1[i] + plane[3] < 0.0f;
+                const bool out2 = plane[0] * l.x2[i] + plane[1] * l.y2[i] + plane[2] * l.z2[i] + plane[3] < 0.0f;
+                culled |= out1 && out2;
+            }
+            if( culled ) continue;
+
+            out[visible * 2    ] = { l.x1[i], l.y1[i], l.z1[i], l.colour[i] };
+            out[visible * 2 + 1] = { l.x2[i], l.y2[i], l.z2[i], l.colour[i] };
+            visible++;
+        }
+
+        if( visible )
+        {
+            const GLboolean depth_was_enabled = glIsEnabled( GL_DEPTH_TEST );
+            if( debugLinesDepthTest ) glEnable( GL_DEPTH_TEST );
+            else                      glDisable( GL_DEPTH_TEST );
+
+            glUseProgram( colour_program_ );
+            glBindVertexArray( debug_line_vao_ );
+            glBindBuffer( GL_ARRAY_BUFFER, debug_line_vbo_ );
+            send_mvp_matrix();
+
+            glBufferData( GL_ARRAY_BUFFER, sizeof(DebugLineVertex) * visible * 2, debug_line_vertices_.data(), GL_STREAM_DRAW );
+            glDrawArrays( GL_LINES, 0, visible * 2 );
+
+            if( depth_was_enabled ) glEnable( GL_DEPTH_TEST );
+            else                    glDisable( GL_DEPTH_TEST );
+        }
+
+        // Age every line by a frame and compact away the ones that have expired
+        const Uint32 now = SDL_GetTicks();
+        size_t kept = 0;
+        for( size_t i = 0; i < count; i++ )
+        {
+            const bool timed = l.expires[i] != 0;
+            const GLint frames_left = l.frames_left[i] - 1;
+            if( timed ? (Sint32)(now - l.expires[i]) >= 0 : frames_left <= 0 ) continue;
+
+            l.x1[kept] = l.x1[i]; l.y1[kept] = l.y1[i]; l.z1[kept] = l.z1[i];
+            l.x2[kept] = l.x2[i]; l.y2[kept] = l.y2[i]; l.z2[kept] = l.z2[i];
+            l.colour[kept] = l.colour[i];
+            l.frames_left[kept] = frames_left;
+            l.expires[kept] = l.expires[i];
+            kept++;
+        }
+        l.x1.resize( kept ); l.y1.resize( kept ); l.z1.resize( kept );
+        l.x2.resize( kept ); l.y2.resize( kept ); l.z2.resize( kept );
+        l.colour.resize( kept );
+        l.frames_left.resize( kept );
+        l.expires.resize( kept );
+    }
+
     // UTILS //////////////////////////////////////////////////////////////////
     GLuint create_shader( GLenum type, const char* source )
     {
@@ -1030,6 +1732,244 @@ namespace TJH_DRAW_NAMESPACE
         push3( x3, y3, orthoDepth ); push4( red, green, blue, alpha );
         push3( x4, y4, orthoDepth ); push4( red, green, blue, alpha );
     }
+    bool begin_primitive( DrawMode mode, size_t vertices )
+    {
+        // Flush if the mode changes, or if there is no room left in a fixed size buffer
+        const size_t floats = vertices * ((mode == DrawMode::Texture2D || mode == DrawMode::Texture3D) ? 9 : 7);
+        const bool full = fixed_capacity_ && vertex_buffer_.size() + floats > vertex_buffer_.capacity();
+        if( current_mode_ != mode || full ) flush();
+        current_mode_ = mode;
+
+        if( fixed_capacity_ && floats > vertex_buffer_.capacity() )
+        {
+            TJH_DRAW_PRINTF("ERROR: shape with %d vertices does not fit in the reserved vertex buffer\n", (int)vertices);
+            return false;
+        }
+        return true;
+    }
+    void init_colour_tables()
+    {
+        if( colour_tables_ready_ ) return;
+
+        for( int i = 0; i <= SRGB_TABLE_SIZE_; i++ )
+        {
+            srgb_to_linear_[i] = srgbToLinear( i / (float)SRGB_TABLE_SIZE_ );
+        }
+        for( int i = 0; i < 256; i++ )
+        {
+            byte_to_draw_colour_[i] = TJH_DRAW_SRGB ? srgbToLinear( i / 255.0f ) : i / 255.0f;
+        }
+
+        colour_tables_ready_ = true;
+    }
+    float to_draw_colour( float c )
+    {
+    #if TJH_DRAW_SRGB
+        // Look up the nearest point on the curve rather than calling pow()
+        init_colour_tables();
+        c = std::fmin( std::fmax( c, 0.0f ), 1.0f );
+        return srgb_to_linear_[ (int)(c * SRGB_TABLE_SIZE_ + 0.5f) ];
+    #else
+        return c;
+    #endif
+    }
+    GLfloat* push_floats( size_t count )
+    {
+        const size_t size = vertex_buffer_.size();
+        vertex_buffer_.resize( size + count );
+        return vertex_buffer_.data() + size;
+    }
+    void push_solid_quad( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2,
+        GLfloat x3, GLfloat y3, GLfloat z3, GLfloat x4, GLfloat y4, GLfloat z4 )
+    {
+        if( !begin_primitive( DrawMode::Colour3D, 6 ) ) return;
+
+        push3( x1, y1, z1 ); push4( red, green, blue, alpha );
+        push3( x2, y2, z2 ); push4( red, green, blue, alpha );
+        push3( x3, y3, z3 ); push4( red, green, blue, alpha );
+        push3( x1, y1, z1 ); push4( red, green, blue, alpha );
+        push3( x3, y3, z3 ); push4( red, green, blue, alpha );
+        push3( x4, y4, z4 ); push4( red, green, blue, alpha );
+    }
+    void push_transformed( const Vector<GLfloat>& positions, const GLfloat* basis, GLfloat x, GLfloat y, GLfloat z )
+    {
+        // Basis is three columns, each unit vertex is multiplied by it then offset by x,y,z
+        // Keep this loop simple and branch free so the compiler can vectorise it
+        const size_t vertex_count = positions.size() / 3;
+        const GLfloat* in = positions.data();
+        GLfloat* out = push_floats( vertex_count * 7 );
+
+        for( size_t i = 0; i < vertex_count; i++ )
+        {
+            const GLfloat px = in[0], py = in[1], pz = in[2];
+            out[0] = x + px * basis[0] + py * basis[3] + pz * basis[6];
+            out[1] = y + px * basis[1] + py * basis[4] + pz * basis[7];
+            out[2] = z + px * basis[2] + py * basis[5] + pz * basis[8];
+            out[3] = red;
+            out[4] = green;
+            out[5] = blue;
+            out[6] = alpha;
+            in  += 3;
+            out += 7;
+        }
+    }
+    void make_basis( GLfloat nx, GLfloat ny, GLfloat nz, GLfloat* basis )
+    {
+        // Builds an orthonormal basis with the normalised n as the last column
+        GLfloat length = std::sqrt( nx * nx + ny * ny + nz * nz );
+        if( length < 1e-6f ) { nx = 0.0f; ny = 0.0f; nz = 1.0f; length = 1.0f; }
+        nx /= length; ny /= length; nz /= length;
+
+        // Cross with whichever axis is furthest from the normal
+        const bool use_x = std::fabs( nx ) < 0.9f;
+        GLfloat ux = use_x ? 0.0f : -nz;
+        GLfloat uy = use_x ? nz   : 0.0f;
+        GLfloat uz = use_x ? -ny  : nx;
+        length = std::sqrt( ux * ux + uy * uy + uz * uz );
+        ux /= length; uy /= length; uz /= length;
+
+        basis[0] = ux; basis[1] = uy; basis[2] = uz;
+        basis[3] = ny * uz - nz * uy;
+        basis[4] = nz * ux - nx * uz;
+        basis[5] = nx * uy - ny * ux;
+        basis[6] = nx; basis[7] = ny; basis[8] = nz;
+    }
+    const Vector<GLfloat>& get_unit_sphere( int detail )
+    {
+        if( detail < 0 ) detail = 0;
+        if( detail > MAX_SPHERE_DETAIL_ ) detail = MAX_SPHERE_DETAIL_;
+
+        Vector<GLfloat>& mesh = unit_spheres_[detail];
+        if( !mesh.empty() ) return mesh;
+
+        // Start with an icosahedron
+        const GLfloat t = (1.0f + std::sqrt( 5.0f )) * 0.5f;
+        const GLfloat points[12][3] = {
+            { -1,  t,  0 }, {  1,  t,  0 }, { -1, -t,  0 }, {  1, -t,  0 },
+            {  0, -1,  t }, {  0,  1,  t }, {  0, -1, -t }, {  0,  1, -t },
+            {  t,  0, -1 }, {  t,  0,  1 }, { -t,  0, -1 }, { -t,  0,  1 } };
+        const int faces[20][3] = {
+            { 0, 11,  5 }, { 0,  5,  1 }, {  0,  1,  7 }, {  0,  7, 10 }, { 0, 10, 11 },
+            { 1,  5,  9 }, { 5, 11,  4 }, { 11, 10,  2 }, { 10,  7,  6 }, { 7,  1,  8 },
+            { 3,  9,  4 }, { 3,  4,  2 }, {  3,  2,  6 }, {  3,  6,  8 }, { 3,  8,  9 },
+            { 4,  9,  5 }, { 2,  4, 11 }, {  6,  2, 10 }, {  8,  6,  7 }, { 9,  8,  1 } };
+
+        const GLfloat inv_length = 1.0f / std::sqrt( 1.0f + t * t );
+        for( const auto& face : faces )
+            for( int corner : face )
+                for( int axis = 0; axis < 3; axis++ )
+                    mesh.push_back( points[corner][axis] * inv_length );
+
+        // Then split every triangle into four, pushing the new points out onto the sphere
+        for( int level = 0; level < detail; level++ )
+        {
+            Vector<GLfloat> split;
+            split.reserve( mesh.size() * 4 );
+
+            for( size_t i = 0; i < mesh.size(); i += 9 )
+            {
+                const GLfloat* a = &mesh[i];
+                const GLfloat* b = &mesh[i + 3];
+                const GLfloat* c = &mesh[i + 6];
+                GLfloat mid[3][3];
+                const GLfloat* ends[3][2] = { { a, b }, { b, c }, { c, a } };
+                for( int m = 0; m < 3; m++ )
+                {
+                    GLfloat mx = ends[m][0][0] + ends[m][1][0];
+                    GLfloat my = ends[m][0][1] + ends[m][1][1];
+                    GLfloat mz = ends[m][0][2] + ends[m][1][2];
+                    GLfloat inv = 1.0f / std::sqrt( mx * mx + my * my + mz * mz );
+                    mid[m][0] = mx * inv; mid[m][1] = my * inv; mid[m][2] = mz * inv;
+                }
+
+                const GLfloat* triangles[4][3] = {
+                    { a, mid[0], mid[2] },
+                    { b, mid[1], mid[0] },
+                    { c, mid[2], mid[1] },
+                    { mid[0], mid[1], mid[2] } };
+                for( const auto& tri : triangles )
+                    for( const GLfloat* p : tri )
+                        split.insert( split.end(), p, p + 3 );
+            }
+
+            mesh.swap( split );
+        }
+
+        return mesh;
+    }
+    UnitMesh& find_unit_mesh( UnitMesh* meshes, int segments )
+    {
+        // Moves the match to the front, or if there isn't one reuses the least recently used
+        UnitMesh* found = std::find_if( meshes, meshes + UNIT_MESH_CACHE_SIZE_ - 1,
+            [segments]( const UnitMesh& mesh ) { return mesh.segments == segments; } );
+        std::rotate( meshes, found, found + 1 );
+        return meshes[0];
+    }
+    const Vector<GLfloat>& get_unit_circle( int segments )
+    {
+        if( segments < 3 ) segments = 3;
+        UnitMesh& mesh = find_unit_mesh( unit_circles_, segments );
+        if( mesh.segments == segments ) return mesh.positions;
+
+        // A fan of triangles in the xy plane with radius 1
+        mesh.positions.clear();
+        const GLfloat frac = (PI*2) / (GLfloat)segments;
+        for( int i = 0; i < segments; i++ )
+        {
+            const GLfloat triangle[9] = {
+                0.0f, 0.0f, 0.0f,
+                std::sin(frac*i), std::cos(frac*i), 0.0f,
+                std::sin(frac*(i+1)), std::cos(frac*(i+1)), 0.0f };
+            mesh.positions.insert( mesh.positions.end(), triangle, triangle + 9 );
+        }
+
+        mesh.segments = segments;
+        return mesh.positions;
+    }
+    const Vector<GLfloat>& get_unit_cylinder( int segments )
+    {
+        if( segments < 3 ) segments = 3;
+        UnitMesh& mesh = find_unit_mesh( unit_cylinders_, segments );
+        if( mesh.segments == segments ) return mesh.positions;
+
+        // Radius 1 around the z axis, from z = 0 to z = 1, with both ends capped
+        mesh.positions.clear();
+        const GLfloat frac = (PI*2) / (GLfloat)segments;
+        for( int i = 0; i < segments; i++ )
+        {
+            const GLfloat x1 = std::sin(frac*i),     y1 = std::cos(frac*i);
+            const GLfloat x2 = std::sin(frac*(i+1)), y2 = std::cos(frac*(i+1));
+            const GLfloat triangles[36] = {
+                // Side
+                x1, y1, 0.0f,   x2, y2, 0.0f,   x2, y2, 1.0f,
+                x1, y1, 0.0f,   x2, y2, 1.0f,   x1, y1, 1.0f,
+                // Caps
+                0.0f, 0.0f, 0.0f,   x2, y2, 0.0f,   x1, y1, 0.0f,
+                0.0f, 0.0f, 1.0f,   x1, y1, 1.0f,   x2, y2, 1.0f };
+            mesh.positions.insert( mesh.positions.end(), triangles, triangles + 36 );
+        }
+
+        mesh.segments = segments;
+        return mesh.positions;
+    }
+    void push_debug_line( GLfloat x1, GLfloat y1, GLfloat z1, GLfloat x2, GLfloat y2, GLfloat z2, GLint frames, Uint32 expires )
+    {
+        auto to_byte = []( float c ) -> GLubyte {
+            return (GLubyte)(( c < 0.0f ? 0.0f : c > 1.0f ? 1.0f : c ) * 255.0f + 0.5f);
+        };
+        const GLubyte rgba[4] = { to_byte( red ), to_byte( green ), to_byte( blue ), to_byte( alpha ) };
+        GLuint colour;
+        std::memcpy( &colour, rgba, sizeof(colour) );
+
+        DebugLines& l = debug_lines_;
+        if( fixed_capacity_ && l.x1.size() == l.x1.capacity() ) return;
+
+        l.x1.push_back( x1 ); l.y1.push_back( y1 ); l.z1.push_back( z1 );
+        l.x2.push_back( x2 ); l.y2.push_back( y2 ); l.z2.push_back( z2 );
+        l.colour.push_back( colour );
+        l.frames_left.push_back( frames );
+        l.expires.push_back( expires );
+    }
     void send_ortho_matrix()
     {
         GLfloat xs =  2.0f / width_;     // x scale
@@ -75,6 +75,12 @@ const GLchar* frag_src = GLSL(
 //
 // Change this to customise the namespace of the library (or rather, the name of the class)
 #define TJH_SHADER_TYPENAME Shader
+// Change this to customise the name of the uniform buffer helper class
+#define TJH_SHADER_UNIFORM_BUFFER_TYPENAME UniformBuffer
+// Change this to customise the name of the program pipeline class
+#define TJH_SHADER_PIPELINE_TYPENAME Pipeline
+// Change this to customise the name of the vertex layout class
+#define TJH_SHADER_VERTEX_LAYOUT_TYPENAME VertexLayout
 // Change this to use a custom printf like function for your platform, for example SDL_Log
 #define TJH_SHADER_PRINTF printf
 // Either set this correctly or comment it out if you would preffer tjh_shader.h did not include glew
@@ -86,7 +92,7 @@ const GLchar* frag_src = GLSL(
 // - make sure we can recompile the shader cleanly by setting the source strings
 //   embedding file IO in the shader class is not necessarily best practice, though good for getting stuff going
 // - multiple output buffers
-// - OPTIMISATION: only reload files that changed
+// - DONE: OPTIMISATION: only reload files that changed
 // - test OpenGL ES compatability
 // - DONE: apply rule of 3/5/0. Delete copy constructors but implemenet move constructors?
 //  - TEST: that I did the move copy/assignment correctly???
@@ -96,12 +102,18 @@ const GLchar* frag_src = GLSL(
 #ifdef TJH_SHADER_GLEW_H
     #include TJH_SHADER_GLEW_H
 #endif
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+class TJH_SHADER_VERTEX_LAYOUT_TYPENAME;
 
 class TJH_SHADER_TYPENAME
 {
 public:
-    TJH_SHADER_TYPENAME() {};
+    TJH_SHADER_TYPENAME();
     ~TJH_SHADER_TYPENAME();
 
     // Do not allow copy construction or assignment
@@ -115,6 +127,24 @@ public:
     // Returns true if shader compilation was a success, false if there was an error
     bool compileAndLink();
 
+    // Starts compiling and linking but does not wait for the driver to finish, poll isReady()
+    // and once it returns true isLinked() says whether it worked. Drivers that support
+    // GL_KHR_parallel_shader_compile will compile in the background, on other drivers the
+    // work happens when isReady() is first called. Returns false if something went wrong
+    // before the work could be handed to the driver.
+    bool compileAndLinkAsync();
+
+    // Returns true when the shader is no longer compiling
+    bool isReady();
+    // Returns true if the last compile and link finished successfully
+    bool isLinked() const { return linked_; }
+
+    // Compiles and links a whole batch of shaders, submitting all the work to the driver
+    // before waiting on any of it so the driver can keep all its threads busy.
+    // Returns true if every shader compiled and linked ok
+    static bool compileAndLinkAll( TJH_SHADER_TYPENAME* const* shaders, size_t count );
+    static bool compileAndLinkAll( std::initializer_list<TJH_SHADER_TYPENAME*> shaders ) { return compileAndLinkAll( shaders.begin(), shaders.size() ); }
+
     // Can be used to explicitly clean up OpenGL resources, automatically called by destructor
     void shutdown();
 
@@ -123,9 +153,87 @@ public:
     // NOTE: things like uniform locations may change as a result!
     bool reload();
 
+    // Reloads only the shaders whose source files have changed since they were loaded, cheap
+    // enough to call every frame. Changes are picked up with inotify on Linux, elsewhere the
+    // files are polled at most once every setReloadPollInterval() milliseconds. A file whose
+    // contents are the same as before (saved without edits) doesn't trigger a reload.
+    // When the driver compiles in the background the new program is swapped in on a later
+    // call once it is ready, until then (or if it fails to compile) the old one keeps working.
+    // Returns the number of shaders that were swapped to a new program by this call
+    static int reloadChanged();
+    static void setReloadPollInterval( int milliseconds ) { reload_poll_interval_ms_ = milliseconds; }
+
     // Call this so we know where to look for the shaders
     static void setShaderBasePath( std::string path ) { shader_base_path_ = path; }
 
+    // Linked programs are saved to this directory and loaded from it on the next run instead
+    // of being compiled from source. Entries are keyed by a hash of the sources and the GL
+    // vendor, renderer and version, if the driver rejects a binary the shader is compiled
+    // from source and the entry replaced. An empty path (the default) disables the cache.
+    // Requires GL_ARB_get_program_binary (core since 4.1), otherwise the cache is ignored.
+    static void setProgramBinaryCachePath( std::string path ) { binary_cache_path_ = path; }
+
+    struct ProgramBinaryCacheStats {
+        int hits            = 0;    // Loaded from the cache
+        int misses          = 0;    // Nothing in the cache, compiled from source
+        int invalidations   = 0;    // The driver rejected the cached binary, compiled from source
+    };
+    static const ProgramBinaryCacheStats& getProgramBinaryCacheStats() { return binary_cache_stats_; }
+
+    // Where the time went the last time the program was built, in milliseconds. The times are
+    // how long this thread spent on each step, so with background compiling the compile and
+    // link times are only the time spent waiting for the driver to finish.
+    struct Stats {
+        double load_ms              = 0.0;  // Reading the source files
+        double preprocess_ms        = 0.0;  // Includes and defines
+        double cache_lookup_ms      = 0.0;  // Hashing the sources and trying the binary cache
+        double compile_ms[4]        = {};   // Per stage: vertex, fragment, geometry, compute
+        double link_ms              = 0.0;
+        bool from_binary_cache      = false;
+        GLint binary_size           = 0;    // Bytes, as reported by the driver
+        GLint active_uniforms       = 0;
+        GLint active_attributes     = 0;
+        GLint active_uniform_blocks = 0;
+        GLint shared_stages         = 0;    // Stages reused from another program instead of compiled
+        double warm_up_ms           = 0.0;  // Time spent in warmUp(), not part of totalMs()
+
+        double totalMs() const {
+            return load_ms + preprocess_ms + cache_lookup_ms + compile_ms[0] + compile_ms[1] + compile_ms[2] + compile_ms[3] + link_ms;
+        }
+    };
+    const Stats& getStats() const { return stats_; }
+
+    // Used in reports, defaults to the first source file
+    void setName( const std::string& name ) { name_ = name; }
+    std::string getName() const;
+
+    // The stats of every shader that has a program, slowest first, as a table or as JSON
+    // [{"name":"...","total_ms":1.2,"load_ms":0.1,...},...]
+    static std::string getStatsReport();
+    static std::string getStatsJson();
+
+    // WARM UP
+    //
+    // Even after the program links most drivers leave some of the work until the first draw
+    // that uses it, which shows up as a hitch the first time something appears on screen.
+    // warmUp() does that first draw during loading instead: a degenerate draw into a 1x1
+    // offscreen framebuffer, once with no vertex buffers and once for each layout added with
+    // addWarmUpLayout(). GL state it touches is put back afterwards. Compute programs and
+    // programs without a vertex stage are skipped. Vertex shaders with side effects (storage
+    // buffer or image writes) will see a few vertices run.
+    //
+    // shader.compileAndLink();
+    // layout.init( shader, { {"pos", 3, GL_FLOAT, GL_FALSE} } );
+    // shader.addWarmUpLayout( layout );
+    // ... load everything else
+    // Shader::warmUpAll();
+
+    // Returns false if the program didn't link
+    bool warmUp();
+    // Warms every linked shader, returns how many were warmed
+    static int warmUpAll();
+    void addWarmUpLayout( const TJH_SHADER_VERTEX_LAYOUT_TYPENAME& layout );
+
     struct VertexAttribArrayDesc {
         std::string name;
         GLint count;
@@ -133,70 +241,507 @@ public:
         GLboolean normalized;
     };
 
-    // NOTE: preliminary reading suggest this is bound to the VAO, not the shader.
-    // If so this would have to be called for each shader bound, how could I indicate this?
+    // NOTE: this state belongs to the VAO, not the shader. To set up many VAOs with the same
+    // layout build a TJH_SHADER_VERTEX_LAYOUT_TYPENAME once and apply that instead.
     // Saves calling a whole heap of gl functions, use it like so:
     // shader.setVertexAttribArray({ {"pos", 3, GL_FLOAT, GL_FALSE}, {"col", 3, GL_FLOAT, GL_FALSE} });
+    // Attributes the shader doesn't use still take up space in the vertex but are skipped.
+    // Integer inputs, matrices and arrays are set up as TJH_SHADER_VERTEX_LAYOUT_TYPENAME::init() describes.
     bool setVertexAttribArrays( GLuint vao, const std::initializer_list<VertexAttribArrayDesc>& desc_list );
 
+    // Everything the program exposes, found when it is linked
+    struct AttributeInfo {
+        std::string name;
+        GLint location;
+        GLenum type;        // Such as GL_FLOAT_VEC3
+        GLint size;         // Number of elements for arrays, otherwise 1
+    };
+    struct UniformInfo {
+        std::string name;   // Arrays are named "name[0]"
+        GLint location;
+        GLenum type;
+        GLint size;
+    };
+    struct UniformBlockInfo {
+        std::string name;
+        GLuint index;
+        GLuint binding;
+        GLint data_size;    // In bytes
+    };
+    const std::vector<AttributeInfo>& getAttributes() const { return attributes_; }
+    const std::vector<UniformInfo>& getUniforms() const { return uniforms_; }
+    const std::vector<UniformBlockInfo>& getUniformBlocks() const { return uniform_blocks_; }
+    // Returns nullptr if the program has no active attribute with that name
+    const AttributeInfo* findAttribute( const GLchar* name ) const;
+
     // Returns true if the source files were loaded successfully
     // false if they could not be loaded
     bool loadVertexSourceFile( std::string filename );
     bool loadFragmentSourceFile( std::string filename ); 
     bool loadGeometrySourceFile( std::string filename ); 
+    // A compute shader is a program on its own, it can't be combined with the other stages
+    bool loadComputeSourceFile( std::string filename );
 
     // Sets the shader source strings directly
     void setVertexSourceString( const std::string& source );
     void setFragmentSourceString( const std::string& source );
     void setGeometrySourceString( const std::string& source );
+    void setComputeSourceString( const std::string& source );
+
+    // Sources are preprocessed before they are compiled:
+    //  - #include "file" (or <file>) is replaced by the file, found relative to the shader
+    //    base path. Included files can include others, use #pragma once to include a file once.
+    //    Included files are watched by reloadChanged() too.
+    //  - the defines are added after the #version line (or at the top if there isn't one)
+    //  - #line directives are added so compile errors name the original file and line
+    //  - directives inside // and /* */ comments are left alone
+    struct Define {
+        std::string name;
+        std::string value;
+    };
+    // Takes effect the next time the shader is compiled
+    void setDefines( const std::vector<Define>& defines ) { defines_ = defines; }
+    const std::vector<Define>& getDefines() const { return defines_; }
+
+    // Returns this shader compiled with 'defines' added to its own, for example:
+    // Shader* skinned = shader.getVariant({ {"SKINNED", "1"}, {"MAX_BONES", "64"} });
+    // Each set of defines is compiled the first time it is asked for, later calls return the
+    // same shader (the order of the defines doesn't matter). Variants belong to this shader and
+    // are destroyed with it. Returns nullptr if the variant failed to compile.
+    TJH_SHADER_TYPENAME* getVariant( const std::vector<Define>& defines );
+
+    // A separable program holds only some of the stages and is mixed with other separable
+    // programs in a TJH_SHADER_PIPELINE_TYPENAME, so each stage is linked once rather than once
+    // for every combination. Set this before compiling, then only the stages that were given
+    // sources are compiled (a separable shader doesn't need both a vertex and fragment stage).
+    // Requires GL 4.1 or GL_ARB_separate_shader_objects. Some drivers want the vertex stage
+    // to redeclare gl_PerVertex when it is used this way.
+    void setSeparable( bool separable ) { separable_ = separable; }
+    bool isSeparable() const { return separable_; }
+    // The stages in the program, such as GL_VERTEX_SHADER_BIT | GL_FRAGMENT_SHADER_BIT
+    GLbitfield getStages() const { return stages_; }
 
     // Bind the shader to the OpenGL context, ready for use
     void bind()   const { glUseProgram( program_ ); }
     void unbind() const { glUseProgram( 0 ); }
 
     // Don't forget to bind shaders before trying to get uniforms or attributes
+    // Uniform and attribute locations are looked up once when the program is linked and cached
     GLint getUniformLocation( const GLchar* name ) const;
     GLint getAttribLocation( const GLchar* name ) const;
     GLuint getProgram() const { return program_; }
 
+    // Set uniforms on the bound shader, these skip the OpenGL call entirely if the uniform
+    // already has the same value. Matrices are column major, just like OpenGL expects
+    // Separable shaders don't need to be bound, their uniforms are set directly
+    void setInt( GLint location, GLint value );
+    void setFloat( GLint location, GLfloat value );
+    void setVec2( GLint location, GLfloat x, GLfloat y );
+    void setVec3( GLint location, GLfloat x, GLfloat y, GLfloat z );
+    void setVec4( GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w );
+    void setMat3( GLint location, const GLfloat* matrix );
+    void setMat4( GLint location, const GLfloat* matrix );
+
+    void setInt( const GLchar* name, GLint value )                                  { setInt( getUniformLocation( name ), value ); }
+    void setFloat( const GLchar* name, GLfloat value )                              { setFloat( getUniformLocation( name ), value ); }
+    void setVec2( const GLchar* name, GLfloat x, GLfloat y )                        { setVec2( getUniformLocation( name ), x, y ); }
+    void setVec3( const GLchar* name, GLfloat x, GLfloat y, GLfloat z )             { setVec3( getUniformLocation( name ), x, y, z ); }
+    void setVec4( const GLchar* name, GLfloat x, GLfloat y, GLfloat z, GLfloat w )  { setVec4( getUniformLocation( name ), x, y, z, w ); }
+    void setMat3( const GLchar* name, const GLfloat* matrix )                       { setMat3( getUniformLocation( name ), matrix ); }
+    void setMat4( const GLchar* name, const GLfloat* matrix )                       { setMat4( getUniformLocation( name ), matrix ); }
+
+    // Uniform blocks are bound automatically when the program links, every block with the
+    // same name shares the same binding point in every program. So update a block once
+    // (see TJH_SHADER_UNIFORM_BUFFER_TYPENAME below) and all the shaders using it see the change.
+    // Binding points are handed out in the order block names are first seen, call
+    // setUniformBlockBinding() before linking if you want to choose them yourself.
+    static GLuint getUniformBlockBinding( const std::string& block_name );
+    static void setUniformBlockBinding( const std::string& block_name, GLuint binding ) { uniform_block_bindings_[block_name] = binding; }
+
+    // Binds the named block in this program only, returns false if the block doesn't exist
+    bool bindUniformBlock( const GLchar* block_name, GLuint binding );
+
+    // COMPUTE (requires GL 4.3 or GL_ARB_compute_shader)
+    //
+    // Shader particles;
+    // particles.loadComputeSourceFile( "particles.comp" );
+    // particles.compileAndLink();
+    // particles.bindStorageBuffer( "Particles", particle_buffer );
+    // particles.dispatchThreads( particle_count, 1, 1, GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT );
+    // Shader::memoryBarrier();
+    // ... draw the particles
+
+    // The local_size the compute shader was compiled with, found when it is linked
+    const GLint* getWorkGroupSize() const { return work_group_size_; }
+
+    // Binds the program and runs the given number of work groups. 'barriers' says how the
+    // results will be read afterwards (GL_SHADER_STORAGE_BARRIER_BIT, GL_TEXTURE_FETCH_BARRIER_BIT,
+    // etc.). Nothing is issued until memoryBarrier() is called, so dispatches that don't
+    // depend on each other run back to back and then share one barrier. Call it before any
+    // dispatch or draw that reads what earlier dispatches wrote.
+    void dispatch( GLuint groups_x, GLuint groups_y = 1, GLuint groups_z = 1, GLbitfield barriers = GL_SHADER_STORAGE_BARRIER_BIT );
+    // Like dispatch() but in threads rather than groups, rounded up to whole work groups
+    void dispatchThreads( GLuint threads_x, GLuint threads_y = 1, GLuint threads_z = 1, GLbitfield barriers = GL_SHADER_STORAGE_BARRIER_BIT );
+    // Issues the barriers asked for by every dispatch since the last call, if there are any
+    static void memoryBarrier();
+
+    // Binds 'buffer' to a shader storage binding point, or to the binding of the named
+    // buffer block in this program. A size of 0 binds the whole buffer.
+    static void bindStorageBuffer( GLuint binding, GLuint buffer, GLintptr offset = 0, GLsizeiptr size = 0 );
+    bool bindStorageBuffer( const GLchar* block_name, GLuint buffer, GLintptr offset = 0, GLsizeiptr size = 0 );
+
 private:
+    friend class TJH_SHADER_VERTEX_LAYOUT_TYPENAME;
 
     // Loads the text file 'filename' and sets file_content to the content of the file
     // returns true on success
     bool load_file( std::string filename, std::string& file_content ) const;
+    // Adds to stats_.load_ms, which starts again from zero for the first file loaded after
+    // a compile
+    void add_load_ms( double ms );
+
+    // Starts compiling a new program from the current sources into pending_reload_
+    bool start_reload();
+    // Waits for pending_reload_ and swaps it in, returns true if it linked and was swapped
+    bool finish_reload();
+
+    // Reload registry, every shader with a source file is listed under each of its files
+    // so a change to one file can be traced back to the shaders that use it
+    void watch_file( const std::string& filename, const std::string& content );
+    void unwatch_file( const std::string& filename );
+    void unwatch_files();
+    // Moves this shader's entries in the registry over to 'replacement'
+    void move_watched_files( TJH_SHADER_TYPENAME* replacement );
+    // Fills 'changed' with the full paths of watched files that may have changed
+    static void find_changed_files( std::vector<std::string>& changed );
+
+    // Resolves includes and adds the defines and #line directives to a stage's source
+    // 'stage' indexes source_names_, returns false if an include could not be loaded
+    // 'output' points at the result, which is 'source' itself if there was nothing to do
+    // or 'scratch' if there was
+    bool preprocess( int stage, const std::string& filename, const std::string& source, std::string& scratch, const std::string*& output );
+    bool preprocess_file( int stage, int source_index, const std::string& source, std::string& output,
+                          int line_offset, int depth, std::vector<std::string>& included_once );
+
+    // Replaces the source string numbers in a driver's error log with the file names in 'names'
+    static std::string rewrite_log( const std::string& log, const std::vector<std::string>& names );
+
+    // Hands the work of compiling and linking to the driver without waiting for the result
+    // returns false if the work could not be submitted
+    bool submit_compile_and_link();
+    // Creates and compiles a shader, attaching it to program_ without waiting to check it compiled
+    // If another program already uses a stage with the same type and source, that one is shared
+    bool submit_shader( GLenum type, GLuint& shader, const std::string& source );
+    // Gives up this program's use of a shared stage, deleting it if nobody else is using it
+    static void release_shader( GLuint& shader );
+    // Waits for the driver and checks the results of submit_compile_and_link()
+    bool finish_compile_and_link();
+    // Frees the source strings once they are no longer needed
+    void clear_sources();
+
+    // Fills the attribute, uniform and block lists and uniform_locations_, called after linking
+    void reflect_program();
+
+    // Binds every active uniform block to its shared binding point and lists it in uniform_blocks_
+    void bind_uniform_blocks();
+
+    // Returns true and remembers the value if it differs from what was last uploaded to 'location'
+    bool uniform_changed( GLint location, const void* data, size_t size );
+
+    // For GL_KHR_parallel_shader_compile
+    static void enable_parallel_compile();
+    static bool parallel_compile_supported();
+
+    // Checks the given shader for errors, printing them if any were found, 'names' are the
+    // files the source was made from so they can be used in the errors
+    // returns true if the shader did compile ok
+    bool did_shader_compile_ok( GLuint shader, const std::vector<std::string>& names ) const;
 
-    // Tries to compile 'source' as a shader with the given 'type', stores result in 'shader'
-    // returns true on success
-    bool compile_shader( GLenum type, GLuint& shader, const std::string& source ) const;
+    // Checks the program linked, printing the errors if it did not
+    // returns true if the program did link ok
+    bool did_program_link_ok( GLuint program ) const;
 
-    // Checks the given shader for errors, printing them if any were found
-    // returns true if the shader did compile ok
-    bool did_shader_compile_ok( GLuint shader ) const;
+    // Returns the file a program made from these (preprocessed) sources would be stored in by
+    // the binary cache, or an empty string if the cache is disabled or not supported
+    std::string program_binary_cache_filename( const std::string& vertex, const std::string& fragment, const std::string& geometry, const std::string& compute ) const;
+
+    // Tries to replace program_ with the binary stored in 'filename', returns true on success
+    bool load_program_binary( const std::string& filename );
+
+    // Writes the linked program_ to 'filename' so it can be loaded next time
+    void save_program_binary( const std::string& filename ) const;
 
     // Converts GLenums such as GL_VERTEX_SHADER to a string
     std::string glenum_shader_to_string( GLenum shader ) const;
 
     // Get the size in bytes of a GL_xxx type such as GL_FLOAT or GL_SHORT
-    int glenum_type_to_size_in_bytes( GLenum type ) const;
+    static int glenum_type_to_size_in_bytes( GLenum type );
 
     GLuint program_             = 0;
     GLuint vertex_shader_       = 0;
     GLuint fragment_shader_     = 0;
     GLuint geometry_shader_     = 0;
+    GLuint compute_shader_      = 0;
 
     std::string vertex_source_filename_     = "";
     std::string fragment_source_filename_   = "";
     std::string geometry_source_filename_   = "";
+    std::string compute_source_filename_    = "";
 
     std::string vertex_source_              = "";
     std::string fragment_source_            = "";
     std::string geometry_source_            = "";
     bool tried_set_geometry_source_         = false;
+    std::string compute_source_             = "";
+    bool is_compute_                        = false;
+    GLint work_group_size_[3]               = { 0, 0, 0 };
+
+    bool separable_                         = false;
+    GLbitfield stages_                      = 0;
+
+    bool pending_link_                      = false;
+    bool linked_                            = false;
+    std::string binary_cache_filename_      = "";
+
+    // The new program while a reload is compiling
+    std::unique_ptr<TJH_SHADER_TYPENAME> pending_reload_;
+
+    std::vector<Define> defines_;
+    // Keyed by a hash of the sorted defines
+    std::unordered_map<uint64_t, std::unique_ptr<TJH_SHADER_TYPENAME>> variants_;
+    // Every file included by the last compile, so they can be watched for changes
+    std::vector<std::string> include_filenames_;
+    // The file each source string number refers to, for each stage (vertex, fragment, geometry, compute)
+    std::vector<std::string> source_names_[4];
+
+    // The last value uploaded to a uniform, so setting the same value again can be skipped
+    struct UniformValue {
+        GLsizei size = 0;   // In bytes, 0 if nothing has been uploaded yet
+        GLfloat data[16];
+    };
+
+    // Uniform name to location, mutable so misses can be remembered by getUniformLocation
+    mutable std::unordered_map<std::string, GLint> uniform_locations_;
+    // Indexed by uniform location
+    std::vector<UniformValue> uniform_values_;
+
+    std::vector<AttributeInfo> attributes_;
+    std::vector<UniformInfo> uniforms_;
+    std::vector<UniformBlockInfo> uniform_blocks_;
 
     static std::string shader_base_path_;
+    static std::unordered_map<std::string, GLuint> uniform_block_bindings_;
+    static std::string binary_cache_path_;
+    static ProgramBinaryCacheStats binary_cache_stats_;
+
+    // Compiled stages are shared between programs, counted so they are deleted with the last user
+    struct SharedStage {
+        uint64_t key    = 0;    // Hash of the type and source
+        int users       = 0;
+    };
+    static std::unordered_map<GLuint, SharedStage> shared_stages_;
+    static std::unordered_map<uint64_t, GLuint> shared_stage_lookup_;
+
+    // Barriers asked for by dispatches that haven't been issued yet
+    static GLbitfield pending_barriers_;
+
+    struct WatchedFile {
+        long long modified  = 0;    // Modification time when last checked
+        long long size      = 0;
+        uint64_t hash       = 0;    // Hash of the content when last loaded
+        std::vector<TJH_SHADER_TYPENAME*> shaders;
+    };
+    // Keyed by full path (base path + filename)
+    static std::unordered_map<std::string, WatchedFile> watched_files_;
+    // Shaders with a reload compiling in the background
+    static std::vector<TJH_SHADER_TYPENAME*> reloading_shaders_;
+    static int reload_poll_interval_ms_;
+    // inotify descriptor (-1 before it's opened) and the directory each watch descriptor is looking at
+    static int inotify_fd_;
+    static std::unordered_map<int, std::string> inotify_dirs_;
 
     // Set all member variables to their defaults without deleting resources
     void resetMembersToDefaults();
+
+    // Every shader, for reports and anything else that works on all of them at once
+    static std::vector<TJH_SHADER_TYPENAME*> all_shaders_;
+    // Takes this shader out of all_shaders_
+    void unregister();
+    // Every shader with a program, slowest first
+    static std::vector<const TJH_SHADER_TYPENAME*> sorted_by_total_time();
+
+    Stats stats_;
+    bool load_ms_used_ = false;     // stats_.load_ms was counted by a compile
+    std::string name_;
+
+    // The 1x1 framebuffer warm up draws go to, and the state to put back after
+    struct WarmUpTarget {
+        GLuint framebuffer              = 0;
+        GLuint renderbuffers[2]         = {};
+        GLuint vertex_buffer            = 0;
+        GLsizeiptr vertex_buffer_size   = 0;
+        GLint previous_framebuffer      = 0;
+        GLint previous_viewport[4]      = {};
+        GLint previous_program          = 0;
+        GLint previous_vao              = 0;
+        GLint previous_array_buffer     = 0;
+        GLint previous_renderbuffer     = 0;
+    };
+    static void begin_warm_up( WarmUpTarget& target );
+    static void end_warm_up( WarmUpTarget& target );
+    bool warm_up( WarmUpTarget& target );
+
+    // Copies, so layouts don't have to outlive the shader
+    std::vector<std::unique_ptr<TJH_SHADER_VERTEX_LAYOUT_TYPENAME>> warm_up_layouts_;
+};
+
+// Holds the data for a uniform block shared between programs, such as the view and
+// projection matrices. Cycles through 'buffer_count' copies of the block so writing
+// the next frame's data never has to wait for the GPU to finish with the last one.
+//
+// UniformBuffer camera;
+// camera.init( "Camera", sizeof(CameraData) );
+// ...
+// camera.update( &camera_data ); // once per frame, before drawing
+//
+// With persistent mapping (needs GL 4.4 or GL_ARB_buffer_storage) the buffer stays
+// mapped and is written directly, otherwise glBufferSubData is used.
+class TJH_SHADER_UNIFORM_BUFFER_TYPENAME
+{
+public:
+    TJH_SHADER_UNIFORM_BUFFER_TYPENAME() {}
+    ~TJH_SHADER_UNIFORM_BUFFER_TYPENAME() { shutdown(); }
+
+    TJH_SHADER_UNIFORM_BUFFER_TYPENAME( const TJH_SHADER_UNIFORM_BUFFER_TYPENAME& other ) = delete;
+    TJH_SHADER_UNIFORM_BUFFER_TYPENAME& operator = ( const TJH_SHADER_UNIFORM_BUFFER_TYPENAME& other ) = delete;
+
+    // Returns true if the buffer was created
+    bool init( const std::string& block_name, GLsizeiptr size, int buffer_count = 3, bool persistent_map = true );
+    void shutdown();
+
+    // Copies 'size' bytes (the whole block by default) into the next buffer and binds it
+    void update( const void* data, GLsizeiptr size = 0 );
+
+    GLuint getBinding() const { return binding_; }
+    GLuint getBuffer() const { return buffer_; }
+
+private:
+    static const int MAX_BUFFER_COUNT = 4;
+
+    GLuint buffer_          = 0;
+    GLuint binding_         = 0;
+    GLsizeiptr size_        = 0;    // Size of the block
+    GLsizeiptr stride_      = 0;    // Size of the block rounded up to the offset alignment
+    int buffer_count_       = 0;
+    int current_            = -1;
+    void* mapped_           = nullptr;
+    GLsync fences_[MAX_BUFFER_COUNT] = {};
+};
+
+// Mixes the stages of separable shaders at bind time, so swapping one stage for another
+// doesn't need a new program to be linked
+//
+// Shader vertex, lit, unlit; // each setSeparable( true ) and given one stage
+// Pipeline pipeline;
+// pipeline.init();
+// pipeline.useStages( vertex );
+// pipeline.useStages( lit );
+// pipeline.bind();
+// ...
+// pipeline.useStages( unlit ); // replaces the fragment stage, no linking needed
+//
+// The pipeline remembers which shader each stage came from, and bind() picks up the new
+// program when one of them has been reloaded. So the shaders must outlive the pipeline,
+// or have their stages cleared from it first.
+class TJH_SHADER_PIPELINE_TYPENAME
+{
+public:
+    TJH_SHADER_PIPELINE_TYPENAME() {}
+    ~TJH_SHADER_PIPELINE_TYPENAME() { shutdown(); }
+
+    TJH_SHADER_PIPELINE_TYPENAME( const TJH_SHADER_PIPELINE_TYPENAME& other ) = delete;
+    TJH_SHADER_PIPELINE_TYPENAME& operator = ( const TJH_SHADER_PIPELINE_TYPENAME& other ) = delete;
+
+    // Returns true if the pipeline was created
+    bool init();
+    void shutdown();
+
+    // Uses every stage in 'shader' (or only 'stages' of them), replacing what was used before
+    // Returns false if the shader isn't separable or isn't linked
+    bool useStages( const TJH_SHADER_TYPENAME& shader );
+    bool useStages( const TJH_SHADER_TYPENAME& shader, GLbitfield stages );
+    // Removes the given stages from the pipeline
+    void clearStages( GLbitfield stages );
+
+    // Checks the stages work together, printing the problem if they don't
+    bool validate() const;
+
+    // Programs bound with glUseProgram take priority over pipelines, so that is cleared
+    void bind() const;
+    void unbind() const { glBindProgramPipeline( 0 ); }
+
+    GLuint getPipeline() const { return pipeline_; }
+
+private:
+    // Vertex, fragment, geometry and compute, in that order
+    static const int STAGE_COUNT = 4;
+    static const GLbitfield stage_bits_[STAGE_COUNT];
+
+    struct StageSource {
+        const TJH_SHADER_TYPENAME* shader = nullptr;
+        GLuint program = 0;     // The shader's program when it was last attached
+    };
+
+    GLuint pipeline_ = 0;
+    mutable StageSource stage_sources_[STAGE_COUNT];
+};
+
+// A vertex format worked out once from a shader's attributes and then applied to as many
+// VAOs as you like, without looking anything up by name or allocating
+//
+// VertexLayout layout;
+// layout.init( shader, { {"pos", 3, GL_FLOAT, GL_FALSE}, {"col", 4, GL_UNSIGNED_BYTE, GL_TRUE} } );
+// for( auto& mesh : meshes ) layout.apply( mesh.vao, mesh.vbo );
+//
+// With GL 4.3 or GL_ARB_vertex_attrib_binding the format is set with glVertexAttribFormat
+// and the buffer attached separately, so setBuffer() can swap the buffer on its own.
+// Otherwise apply() falls back to glVertexAttribPointer.
+class TJH_SHADER_VERTEX_LAYOUT_TYPENAME
+{
+public:
+    // One per location, so a mat4 is four of these
+    struct Attribute {
+        GLuint location;
+        GLint count;
+        GLenum type;
+        GLboolean normalized;
+        bool integer;       // An int or uint input, set with the glVertexAttribI functions
+        GLuint offset;
+    };
+
+    // Attributes are interleaved in the order given, ones the shader doesn't use still take
+    // up space in the vertex. Returns false if any were not found in the shader.
+    // Integer inputs are picked up from the shader. Matrices and arrays give the count of
+    // the whole thing, { "model", 16, GL_FLOAT, GL_FALSE } for a mat4, and are spread across
+    // their locations.
+    bool init( const TJH_SHADER_TYPENAME& shader, const std::initializer_list<TJH_SHADER_TYPENAME::VertexAttribArrayDesc>& desc_list, GLuint binding = 0 );
+
+    // Sets up the attributes of 'vao' and reads them from 'buffer'
+    void apply( GLuint vao, GLuint buffer, GLintptr offset = 0 ) const;
+    // Points a vao that already has this layout at a different buffer
+    void setBuffer( GLuint vao, GLuint buffer, GLintptr offset = 0 ) const;
+
+    GLsizei getStride() const { return stride_; }
+    int getAttributeCount() const { return count_; }
+    const Attribute& getAttribute( int i ) const { return attributes_[i]; }
+
+private:
+    static const int MAX_ATTRIBUTES = 16;
+
+    Attribute attributes_[MAX_ATTRIBUTES];
+    int count_          = 0;
+    GLsizei stride_     = 0;
+    GLuint binding_     = 0;
 };
 
 #endif // END TJH_SHADER_H
@@ -205,11 +750,38 @@ private:
 #ifdef TJH_SHADER_IMPLEMENTATION
 
 #include <fstream>
-#include <sstream>
 #include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+    #define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 // Shader base path is found by SDL the first time it is needed
 std::string TJH_SHADER_TYPENAME::shader_base_path_ = "";
+std::unordered_map<std::string, GLuint> TJH_SHADER_TYPENAME::uniform_block_bindings_;
+std::string TJH_SHADER_TYPENAME::binary_cache_path_ = "";
+TJH_SHADER_TYPENAME::ProgramBinaryCacheStats TJH_SHADER_TYPENAME::binary_cache_stats_;
+std::unordered_map<std::string, TJH_SHADER_TYPENAME::WatchedFile> TJH_SHADER_TYPENAME::watched_files_;
+std::vector<TJH_SHADER_TYPENAME*> TJH_SHADER_TYPENAME::reloading_shaders_;
+int TJH_SHADER_TYPENAME::reload_poll_interval_ms_ = 250;
+int TJH_SHADER_TYPENAME::inotify_fd_ = -1;
+std::unordered_map<GLuint, TJH_SHADER_TYPENAME::SharedStage> TJH_SHADER_TYPENAME::shared_stages_;
+std::unordered_map<uint64_t, GLuint> TJH_SHADER_TYPENAME::shared_stage_lookup_;
+GLbitfield TJH_SHADER_TYPENAME::pending_barriers_ = 0;
+std::vector<TJH_SHADER_TYPENAME*> TJH_SHADER_TYPENAME::all_shaders_;
+std::unordered_map<int, std::string> TJH_SHADER_TYPENAME::inotify_dirs_;
 
 #ifdef _WIN32
     #define PATH_SEPERATOR '\\'
@@ -217,48 +789,242 @@ std::string TJH_SHADER_TYPENAME::shader_base_path_ = "";
     #define PATH_SEPERATOR '/'
 #endif
 
+// Returns true if the current context supports the named extension
+static bool tjh_shader_has_extension( const char* extension )
+{
+    GLint count = 0;
+    glGetIntegerv( GL_NUM_EXTENSIONS, &count );
+    for( GLint i = 0; i < count; i++ )
+    {
+        const char* name = reinterpret_cast<const char*>(glGetStringi( GL_EXTENSIONS, i ));
+        if( name && std::strcmp( name, extension ) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 64 bit FNV-1a hash of a file's content
+static uint64_t tjh_shader_hash( const std::string& content )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for( unsigned char c : content ) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Reads the whole file into 'content' with a single read, reusing content's memory if it is
+// big enough. Returns false if the file could not be read.
+static bool tjh_shader_read_file( const std::string& path, std::string& content )
+{
+    FILE* file = std::fopen( path.c_str(), "rb" );
+    if( !file ) {
+        return false;
+    }
+
+    long size = -1;
+    if( std::fseek( file, 0, SEEK_END ) == 0 ) {
+        size = std::ftell( file );
+    }
+    if( size < 0 || std::fseek( file, 0, SEEK_SET ) != 0 )
+    {
+        std::fclose( file );
+        return false;
+    }
+
+    content.resize( static_cast<size_t>(size) );
+    const size_t read = size > 0 ? std::fread( &content[0], 1, static_cast<size_t>(size), file ) : 0;
+    std::fclose( file );
+
+    content.resize( read );
+    return read == static_cast<size_t>(size);
+}
+
+// Milliseconds since 'start'
+static double tjh_shader_ms_since( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Returns the first character in [pos, end) that isn't whitespace or in a comment, or end.
+// 'in_comment' carries a /* */ comment on from one line to the next.
+static size_t tjh_shader_skip_comments( const std::string& source, size_t pos, size_t end, bool& in_comment )
+{
+    while( pos < end )
+    {
+        if( in_comment )
+        {
+            const size_t close = source.find( "*/", pos );
+            if( close >= end ) {
+                return end;
+            }
+            in_comment = false;
+            pos = close + 2;
+        }
+        else if( source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\r' ) {
+            pos++;
+        }
+        else if( source.compare( pos, 2, "//" ) == 0 ) {
+            return end;
+        }
+        else if( source.compare( pos, 2, "/*" ) == 0 )
+        {
+            in_comment = true;
+            pos += 2;
+        }
+        else {
+            return pos;
+        }
+    }
+    return end;
+}
+
+// Finds the line [start, end) that starts the next directive, skipping any in comments.
+// Returns the position of the directive's name, after the '#', or npos if it isn't one.
+static size_t tjh_shader_next_line( const std::string& source, size_t start, size_t& end, bool& in_comment )
+{
+    end = source.find( '\n', start );
+    if( end == std::string::npos ) {
+        end = source.size();
+    }
+
+    // Directives can have whitespace either side of the '#'
+    const size_t first = tjh_shader_skip_comments( source, start, end, in_comment );
+    size_t directive = std::string::npos;
+    if( first < end && source[first] == '#' ) {
+        directive = source.find_first_not_of( " \t", first + 1 );
+    }
+
+    // Anything else on the line can open a comment that carries on to the next one
+    for( size_t pos = first; pos < end; pos = tjh_shader_skip_comments( source, pos + 1, end, in_comment ) ) {}
+    return directive < end ? directive : std::string::npos;
+}
+
+// The position of the first '#word' directive's name outside of comments, or npos
+static size_t tjh_shader_find_directive( const std::string& source, const char* word )
+{
+    bool in_comment = false;
+    for( size_t start = 0, end = 0; start < source.size(); start = end + 1 )
+    {
+        const size_t directive = tjh_shader_next_line( source, start, end, in_comment );
+        if( directive != std::string::npos && source.compare( directive, std::strlen( word ), word ) == 0 ) {
+            return directive;
+        }
+    }
+    return std::string::npos;
+}
+
+// Works out how a vertex attribute is fed from its reflected type. Integer inputs have to
+// go through the glVertexAttribI functions or the shader reads garbage. Matrices take a
+// location per column and arrays one per element, 'count' components are split evenly
+// between them. Returns false if they can't be split.
+static bool tjh_shader_attribute_locations( const TJH_SHADER_TYPENAME::AttributeInfo& info, GLint count,
+                                            GLint& locations, GLint& components, bool& integer )
+{
+    GLint columns = 1;
+    switch( info.type )
+    {
+        case GL_FLOAT_MAT2: case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4: columns = 2; break;
+        case GL_FLOAT_MAT3: case GL_FLOAT_MAT3x2: case GL_FLOAT_MAT3x4: columns = 3; break;
+        case GL_FLOAT_MAT4: case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT4x3: columns = 4; break;
+        default: break;
+    }
+    switch( info.type )
+    {
+        case GL_INT: case GL_INT_VEC2: case GL_INT_VEC3: case GL_INT_VEC4:
+        case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+            integer = true;
+            break;
+        default:
+            integer = false;
+            break;
+    }
+
+    locations = columns * std::max( info.size, 1 );
+    components = count / locations;
+    if( components < 1 || components > 4 || components * locations != count )
+    {
+        TJH_SHADER_PRINTF( "ERROR: attribute '%s' takes %i locations, %i components can't be split between them\n",
+                           info.name.c_str(), locations, count );
+        return false;
+    }
+    return true;
+}
+
+// Constructor
+TJH_SHADER_TYPENAME::TJH_SHADER_TYPENAME()
+{
+    all_shaders_.push_back( this );
+}
 // Destructor
 TJH_SHADER_TYPENAME::~TJH_SHADER_TYPENAME()
 {
+    unregister();
+    unwatch_files();
     shutdown();
 }
 // Move constructor
-TJH_SHADER_TYPENAME::TJH_SHADER_TYPENAME( TJH_SHADER_TYPENAME&& other )
+TJH_SHADER_TYPENAME::TJH_SHADER_TYPENAME( TJH_SHADER_TYPENAME&& other ) : TJH_SHADER_TYPENAME()
 {
-    program_            = other.program_;
-    vertex_shader_      = other.vertex_shader_;
-    fragment_shader_    = other.fragment_shader_;
-    geometry_shader_    = other.geometry_shader_;
-
-    vertex_source_filename_     = other.vertex_source_filename_;
-    fragment_source_filename_   = other.fragment_source_filename_;
-    geometry_source_filename_   = other.geometry_source_filename_;
-
-    vertex_source_              = other.vertex_source_;
-    fragment_source_            = other.fragment_source_;
-    geometry_source_            = other.geometry_source_;
-    tried_set_geometry_source_  = other.tried_set_geometry_source_;
+    *this = std::move( other );
+}
 
-    other.resetMembersToDefaults();
+void TJH_SHADER_TYPENAME::unregister()
+{
+    all_shaders_.erase( std::remove( all_shaders_.begin(), all_shaders_.end(), this ), all_shaders_.end() );
 }
 // Move assignment operator
 TJH_SHADER_TYPENAME& TJH_SHADER_TYPENAME::operator = ( TJH_SHADER_TYPENAME&& other )
 {
     if( this != &other )
     {
+        unwatch_files();
+        shutdown();
+
+        // Has to happen while other still has its filenames
+        other.move_watched_files( this );
+
         program_            = other.program_;
         vertex_shader_      = other.vertex_shader_;
         fragment_shader_    = other.fragment_shader_;
         geometry_shader_    = other.geometry_shader_;
+        compute_shader_     = other.compute_shader_;
 
-        vertex_source_filename_     = other.vertex_source_filename_;
-        fragment_source_filename_   = other.fragment_source_filename_;
-        geometry_source_filename_   = other.geometry_source_filename_;
+        vertex_source_filename_     = std::move( other.vertex_source_filename_ );
+        fragment_source_filename_   = std::move( other.fragment_source_filename_ );
+        geometry_source_filename_   = std::move( other.geometry_source_filename_ );
+        compute_source_filename_    = std::move( other.compute_source_filename_ );
 
-        vertex_source_              = other.vertex_source_;
-        fragment_source_            = other.fragment_source_;
-        geometry_source_            = other.geometry_source_;
+        vertex_source_              = std::move( other.vertex_source_ );
+        fragment_source_            = std::move( other.fragment_source_ );
+        geometry_source_            = std::move( other.geometry_source_ );
         tried_set_geometry_source_  = other.tried_set_geometry_source_;
+        compute_source_             = std::move( other.compute_source_ );
+        is_compute_                 = other.is_compute_;
+        std::memcpy( work_group_size_, other.work_group_size_, sizeof(work_group_size_) );
+        separable_                  = other.separable_;
+        stages_                     = other.stages_;
+
+        pending_link_               = other.pending_link_;
+        linked_                     = other.linked_;
+        binary_cache_filename_      = std::move( other.binary_cache_filename_ );
+        uniform_locations_          = std::move( other.uniform_locations_ );
+        uniform_values_             = std::move( other.uniform_values_ );
+        attributes_                 = std::move( other.attributes_ );
+        uniforms_                   = std::move( other.uniforms_ );
+        uniform_blocks_             = std::move( other.uniform_blocks_ );
+        pending_reload_             = std::move( other.pending_reload_ );
+        defines_                    = std::move( other.defines_ );
+        variants_                   = std::move( other.variants_ );
+        include_filenames_          = std::move( other.include_filenames_ );
+        for( int i = 0; i < 4; i++ ) {
+            source_names_[i]        = std::move( other.source_names_[i] );
+        }
+        stats_                      = other.stats_;
+        load_ms_used_               = other.load_ms_used_;
+        name_                       = std::move( other.name_ );
+        warm_up_layouts_            = std::move( other.warm_up_layouts_ );
 
         other.resetMembersToDefaults();
     }
@@ -271,287 +1037,1584 @@ void TJH_SHADER_TYPENAME::resetMembersToDefaults()
     vertex_shader_       = 0;
     fragment_shader_     = 0;
     geometry_shader_     = 0;
+    compute_shader_      = 0;
 
     vertex_source_filename_     = "";
     fragment_source_filename_   = "";
     geometry_source_filename_   = "";
+    compute_source_filename_    = "";
 
     vertex_source_              = "";
     fragment_source_            = "";
     geometry_source_            = "";
     tried_set_geometry_source_  = false; 
+    compute_source_             = "";
+    is_compute_                 = false;
+    std::memset( work_group_size_, 0, sizeof(work_group_size_) );
+    separable_                  = false;
+    stages_                     = 0;
+
+    pending_link_               = false;
+    linked_                     = false;
+    binary_cache_filename_      = "";
+    uniform_locations_.clear();
+    uniform_values_.clear();
+    attributes_.clear();
+    uniforms_.clear();
+    uniform_blocks_.clear();
+    pending_reload_.reset();
+    defines_.clear();
+    variants_.clear();
+    include_filenames_.clear();
+    stats_                      = Stats();
+    load_ms_used_               = false;
+    name_.clear();
+    warm_up_layouts_.clear();
 }
 
 bool TJH_SHADER_TYPENAME::compileAndLink()
 {
-    program_ = glCreateProgram();
+    return submit_compile_and_link() && finish_compile_and_link();
+}
 
-    bool compiled_vertex_source = compile_shader( GL_VERTEX_SHADER, vertex_shader_, vertex_source_ );
-    if( compiled_vertex_source )
-    {
-        glAttachShader( program_, vertex_shader_ );
+bool TJH_SHADER_TYPENAME::compileAndLinkAsync()
+{
+    enable_parallel_compile();
+    return submit_compile_and_link();
+}
+
+bool TJH_SHADER_TYPENAME::compileAndLinkAll( TJH_SHADER_TYPENAME* const* shaders, size_t count )
+{
+    enable_parallel_compile();
+
+    // Give the driver everything up front so its threads can work through them
+    // while we wait on the first one
+    bool everything_ok = true;
+    for( size_t i = 0; i < count; i++ ) {
+        everything_ok = shaders[i]->submit_compile_and_link() && everything_ok;
+    }
+    for( size_t i = 0; i < count; i++ ) {
+        if( shaders[i]->pending_link_ ) {
+            everything_ok = shaders[i]->finish_compile_and_link() && everything_ok;
+        }
     }
+    return everything_ok;
+}
 
-    bool compiled_fragment_source = compile_shader( GL_FRAGMENT_SHADER, fragment_shader_, fragment_source_ );
-    if( compiled_fragment_source )
-    {
-        glAttachShader( program_, fragment_shader_ );
+bool TJH_SHADER_TYPENAME::isReady()
+{
+    if( !pending_link_ ) {
+        return true;
     }
 
-    // If the programmer tied to use a geometry shader, try to compile and attach it
-    bool compiled_geometry_source = false;
-    if( tried_set_geometry_source_ )
+    // Without the extension checking the status blocks until the driver is done
+    // so we might as well finish right now
+    if( parallel_compile_supported() )
     {
-        compiled_geometry_source = compile_shader( GL_GEOMETRY_SHADER, geometry_shader_, geometry_source_ );
-        if( compiled_geometry_source )
-        {
-            glAttachShader( program_, geometry_shader_ );
+        GLint complete = GL_FALSE;
+        glGetProgramiv( program_, GL_COMPLETION_STATUS_KHR, &complete );
+        if( complete != GL_TRUE ) {
+            return false;
         }
     }
 
-    bool everything_ok = compiled_fragment_source
-                         && compiled_vertex_source
-                         && (tried_set_geometry_source_ == compiled_geometry_source);
+    finish_compile_and_link();
+    return true;
+}
 
-    if( everything_ok ) {
-         // Link the shaders together into a program
-        glBindFragDataLocation( program_, 0, "outDiffuse" );
-        glLinkProgram( program_ );
+bool TJH_SHADER_TYPENAME::submit_compile_and_link()
+{
+    linked_ = false;
+
+    // Loading happens before this so keep that time, unless nothing was loaded since the
+    // last compile
+    const double load_ms = load_ms_used_ ? 0.0 : stats_.load_ms;
+    stats_ = Stats();
+    stats_.load_ms = load_ms;
+    load_ms_used_ = true;
+
+    // The includes may have changed since last time
+    for( const std::string& filename : include_filenames_ ) {
+        unwatch_file( filename );
     }
+    include_filenames_.clear();
 
-    // now cleanup the shaders
-    // TODO: it's possible we want to the same vertex/fagment/etc. shader multple times in different programs
-    // TODO: find a way of supporting this without the caller having to do extra work, on the other hand it might not be worth it
-    // TODO: will this cause a problem if I try to delete a shader that was never created?
-    //  If the shader is not created the value will be left at 0, which could be a valid shader
+    // Separable programs only have the stages they were given sources for
+    stages_ = GL_VERTEX_SHADER_BIT | GL_FRAGMENT_SHADER_BIT;
+    if( separable_ )
+    {
+        stages_ = 0;
+        if( !vertex_source_.empty() )   stages_ |= GL_VERTEX_SHADER_BIT;
+        if( !fragment_source_.empty() ) stages_ |= GL_FRAGMENT_SHADER_BIT;
+    }
+    if( tried_set_geometry_source_ ) {
+        stages_ |= GL_GEOMETRY_SHADER_BIT;
+    }
+    if( is_compute_ ) {
+        stages_ = GL_COMPUTE_SHADER_BIT;
+    }
+    if( stages_ == 0 )
+    {
+        TJH_SHADER_PRINTF( "ERROR: separable shader has no stages! (not loaded/set)\n" );
+        return false;
+    }
 
-    if( compiled_vertex_source ) {
-        glDetachShader( program_, vertex_shader_ );
+    // Resolve includes and defines, the binary cache is keyed on the result
+    // Sources with nothing to preprocess are used where they are rather than copied
+    std::string preprocessed[4];
+    const std::string* vertex   = &vertex_source_;
+    const std::string* fragment = &fragment_source_;
+    const std::string* geometry = &geometry_source_;
+    const std::string* compute  = &compute_source_;
+    auto start = std::chrono::steady_clock::now();
+    bool preprocessed_ok = (!(stages_ & GL_VERTEX_SHADER_BIT)   || preprocess( 0, vertex_source_filename_, vertex_source_, preprocessed[0], vertex ))
+                        && (!(stages_ & GL_FRAGMENT_SHADER_BIT) || preprocess( 1, fragment_source_filename_, fragment_source_, preprocessed[1], fragment ))
+                        && (!(stages_ & GL_GEOMETRY_SHADER_BIT) || preprocess( 2, geometry_source_filename_, geometry_source_, preprocessed[2], geometry ))
+                        && (!(stages_ & GL_COMPUTE_SHADER_BIT)  || preprocess( 3, compute_source_filename_, compute_source_, preprocessed[3], compute ));
+    stats_.preprocess_ms = tjh_shader_ms_since( start );
+    if( !preprocessed_ok )
+    {
+        clear_sources();
+        return false;
     }
 
-    if( compiled_fragment_source ) {
-        glDetachShader( program_, fragment_shader_ );
+    // Try the binary cache first, it is much faster than compiling
+    start = std::chrono::steady_clock::now();
+    binary_cache_filename_ = program_binary_cache_filename( *vertex, *fragment, *geometry, *compute );
+    const bool from_binary_cache = !binary_cache_filename_.empty() && load_program_binary( binary_cache_filename_ );
+    stats_.cache_lookup_ms = tjh_shader_ms_since( start );
+    if( from_binary_cache )
+    {
+        stats_.from_binary_cache = true;
+        binary_cache_filename_.clear();
+        reflect_program();
+        linked_ = true;
+        clear_sources();
+        return true;
     }
 
-    if( tried_set_geometry_source_ && compiled_geometry_source )
+    program_ = glCreateProgram();
+
+    // Only submit the work here, checking the results would make us wait for the driver
+    bool submitted_ok = (!(stages_ & GL_VERTEX_SHADER_BIT)   || submit_shader( GL_VERTEX_SHADER, vertex_shader_, *vertex ))
+                     && (!(stages_ & GL_FRAGMENT_SHADER_BIT) || submit_shader( GL_FRAGMENT_SHADER, fragment_shader_, *fragment ))
+                     && (!(stages_ & GL_GEOMETRY_SHADER_BIT) || submit_shader( GL_GEOMETRY_SHADER, geometry_shader_, *geometry ))
+                     && (!(stages_ & GL_COMPUTE_SHADER_BIT)  || submit_shader( GL_COMPUTE_SHADER, compute_shader_, *compute ));
+
+    if( !submitted_ok )
     {
-        glDetachShader( program_, geometry_shader_ );
+        clear_sources();
+        return false;
     }
 
-    // Clear all the strings
-    vertex_source_.clear();
-    vertex_source_.shrink_to_fit();
-    fragment_source_.clear();
-    fragment_source_.shrink_to_fit();
-    geometry_source_.clear();
-    geometry_source_.shrink_to_fit();
+    // Link the shaders together into a program
+    glBindFragDataLocation( program_, 0, "outDiffuse" );
+    if( separable_ ) {
+        glProgramParameteri( program_, GL_PROGRAM_SEPARABLE, GL_TRUE );
+    }
+    if( !binary_cache_filename_.empty() ) {
+        glProgramParameteri( program_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+    }
+    start = std::chrono::steady_clock::now();
+    glLinkProgram( program_ );
+    stats_.link_ms = tjh_shader_ms_since( start );
 
-    return everything_ok;
+    pending_link_ = true;
+    return true;
 }
 
-bool TJH_SHADER_TYPENAME::reload()
+bool TJH_SHADER_TYPENAME::finish_compile_and_link()
 {
-    GLuint new_program              = glCreateProgram();
-    GLuint new_vertex_shader        = 0;
-    GLuint new_fragment_shader      = 0;
-    GLuint new_geometry_shader      = 0;
-    bool compiled_new_shaders_ok    = false;
+    pending_link_ = false;
 
-    // Try to load and recompile the vertex shader
-    if( !vertex_source_filename_.empty() )
+    // Check the shaders first so compile errors are reported rather than the link error they cause
+    // Checking the status waits for the driver, so that is counted as compile time too
+    auto check_stage = [this]( int stage, GLbitfield bit, GLuint shader ) {
+        if( !(stages_ & bit) ) {
+            return true;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const bool compiled_ok = did_shader_compile_ok( shader, source_names_[stage] );
+        stats_.compile_ms[stage] += tjh_shader_ms_since( start );
+        return compiled_ok;
+    };
+    bool everything_ok = check_stage( 0, GL_VERTEX_SHADER_BIT, vertex_shader_ )
+                      && check_stage( 1, GL_FRAGMENT_SHADER_BIT, fragment_shader_ )
+                      && check_stage( 2, GL_GEOMETRY_SHADER_BIT, geometry_shader_ )
+                      && check_stage( 3, GL_COMPUTE_SHADER_BIT, compute_shader_ );
+
+    if( everything_ok )
     {
-        compiled_new_shaders_ok = loadVertexSourceFile( vertex_source_filename_ )
-                                && compile_shader( GL_VERTEX_SHADER, new_vertex_shader, vertex_source_ );
-        if( !compiled_new_shaders_ok )
-            TJH_SHADER_PRINTF("ERROR: failed to recompile vertex shader in program '%i'\n", program_ );
+        const auto start = std::chrono::steady_clock::now();
+        everything_ok = did_program_link_ok( program_ );
+        stats_.link_ms += tjh_shader_ms_since( start );
     }
 
-    // Try to load and recompile the fragment shader
-    if( !fragment_source_filename_.empty() && compiled_new_shaders_ok )
-    {
-        compiled_new_shaders_ok = loadFragmentSourceFile( fragment_source_filename_ )
-                                && compile_shader( GL_FRAGMENT_SHADER, new_fragment_shader, fragment_source_ );
-        if( !compiled_new_shaders_ok )
-            TJH_SHADER_PRINTF("ERROR: failed to recompile fragment shader in program '%i'\n", program_ );
+    if( everything_ok ) {
+        reflect_program();
     }
 
-    // Try to load and recompile the geometry shader
-    if( !geometry_source_filename_.empty() && compiled_new_shaders_ok )
-    {
-        compiled_new_shaders_ok = loadGeometrySourceFile( geometry_source_filename_ )
-                                && compile_shader( GL_GEOMETRY_SHADER, new_geometry_shader, geometry_source_ );
-        if( !compiled_new_shaders_ok )
-            TJH_SHADER_PRINTF("ERROR: failed to recompile geometry shader in program '%i'\n", program_ );
+    if( everything_ok && !binary_cache_filename_.empty() ) {
+        save_program_binary( binary_cache_filename_ );
     }
-    
-    if( compiled_new_shaders_ok )
-    {
-        // Attach and create the shader new programs
-        glBindFragDataLocation( new_program, 0, "outDiffuse" );
-        glAttachShader( new_program, new_vertex_shader );
-        glAttachShader( new_program, new_fragment_shader );
-        glAttachShader( new_program, new_geometry_shader );
-        glLinkProgram( new_program );
+    binary_cache_filename_.clear();
 
-        // Call shutdown to free the old resources
-        shutdown();
+    // now cleanup the shaders, they may be shared with other programs so are only
+    // detached here and released in shutdown()
+    if( stages_ & GL_VERTEX_SHADER_BIT )   glDetachShader( program_, vertex_shader_ );
+    if( stages_ & GL_FRAGMENT_SHADER_BIT ) glDetachShader( program_, fragment_shader_ );
+    if( stages_ & GL_GEOMETRY_SHADER_BIT ) glDetachShader( program_, geometry_shader_ );
+    if( stages_ & GL_COMPUTE_SHADER_BIT )  glDetachShader( program_, compute_shader_ );
 
-        // Now substitute our new resources
-        program_            = new_program;
-        vertex_shader_      = new_vertex_shader;
-        fragment_shader_    = new_vertex_shader;
-        geometry_shader_    = new_geometry_shader;
-    }
-    else
-    {
-        // If something went wrong, free any resources that were created
-        if( new_program ) {
-            glDeleteProgram( new_program );
-        }
-        if( new_vertex_shader ) {
-            glDeleteShader( new_vertex_shader );
-        }
-        if( new_fragment_shader ) {
-            glDeleteShader( new_fragment_shader );
-        }
-        if( new_geometry_shader ) {
-            glDeleteShader( new_geometry_shader );
-        }
-    }
+    clear_sources();
 
-    return compiled_new_shaders_ok;
+    linked_ = everything_ok;
+    return everything_ok;
 }
 
-void TJH_SHADER_TYPENAME::shutdown()
+void TJH_SHADER_TYPENAME::clear_sources()
 {
-    if( program_ ) {
-        glDeleteProgram( program_ );
-        program_ = 0;
+    // Stages set from a string are kept, reload() and getVariant() need them
+    // while stages from files can be read again
+    if( !vertex_source_filename_.empty() ) {
+        vertex_source_.clear();
+        vertex_source_.shrink_to_fit();
     }
-    if( vertex_shader_ ) {
-        glDeleteShader( vertex_shader_ );
-        vertex_shader_ = 0;
+    if( !fragment_source_filename_.empty() ) {
+        fragment_source_.clear();
+        fragment_source_.shrink_to_fit();
     }
-    if( fragment_shader_ ) {
-        glDeleteShader( fragment_shader_ );
-        fragment_shader_ = 0;
+    if( !geometry_source_filename_.empty() ) {
+        geometry_source_.clear();
+        geometry_source_.shrink_to_fit();
     }
-    if( geometry_shader_ ) {
-        glDeleteShader( geometry_shader_ );
-        geometry_shader_ = 0;
+    if( !compute_source_filename_.empty() ) {
+        compute_source_.clear();
+        compute_source_.shrink_to_fit();
     }
 }
 
-GLint TJH_SHADER_TYPENAME::getUniformLocation( const GLchar* name ) const
+void TJH_SHADER_TYPENAME::enable_parallel_compile()
 {
-    GLint uniform = glGetUniformLocation( program_, name );
-    if( uniform == -1 ) {
-        TJH_SHADER_PRINTF("ERROR: did not find uniform '%s' in shader program '%i'\n", name, program_ );
+    static bool enabled = false;
+    if( enabled || !parallel_compile_supported() ) {
+        return;
     }
-    return uniform;
-}
 
-GLint TJH_SHADER_TYPENAME::getAttribLocation( const GLchar* name ) const
-{
-    GLint attribute = glGetAttribLocation( program_, name );
-    if( attribute == -1 ) {
-        TJH_SHADER_PRINTF("ERROR: did not find attribute '%s' in shader program '%i'\n", name, program_ );
+    // Let the driver use as many threads as it likes
+#ifdef GL_KHR_parallel_shader_compile
+    if( glMaxShaderCompilerThreadsKHR ) {
+        glMaxShaderCompilerThreadsKHR( 0xFFFFFFFF );
     }
-    return attribute;
+#endif
+    enabled = true;
 }
 
-bool TJH_SHADER_TYPENAME::setVertexAttribArrays( GLuint vao, const std::initializer_list<VertexAttribArrayDesc>& desc_list )
+bool TJH_SHADER_TYPENAME::parallel_compile_supported()
 {
-    bool success = true;
-    std::vector<long unsigned> offset_list;
-
-    GLsizei stride = 0;
-    for( const auto& desc : desc_list )
-    {
-        int size = glenum_type_to_size_in_bytes( desc.type );
-        stride += size * desc.count;
-        offset_list.push_back( stride - size * desc.count );
-    }
-    
-    // Bind the vao so we know we are working with the right one
-    glBindVertexArray( vao );
-
-    // Manual loop counter because initalizer lists like ranged for loops
-    // but we also want and index for the vector
-    size_t i = 0;
-    for( const auto& desc : desc_list )
+    static int supported = -1;
+    if( supported == -1 )
     {
-        GLint attrib = getAttribLocation( desc.name.c_str() );
-        glEnableVertexAttribArray( attrib );
-    	glVertexAttribPointer(
-            attrib,
-            desc.count,
-            desc.type,
-            desc.normalized,
-            stride,
-            (void*)(offset_list[i]) );
-        i++;
+        supported = tjh_shader_has_extension( "GL_KHR_parallel_shader_compile" )
+                 || tjh_shader_has_extension( "GL_ARB_parallel_shader_compile" );
     }
-
-    return success;
+    return supported == 1;
 }
 
-bool TJH_SHADER_TYPENAME::loadVertexSourceFile( std::string filename )
+bool TJH_SHADER_TYPENAME::reload()
 {
-    vertex_source_filename_ = filename;
-    return load_file( filename, vertex_source_ );
-}
+    // Anything already compiling would be out of date
+    pending_reload_.reset();
+    reloading_shaders_.erase( std::remove( reloading_shaders_.begin(), reloading_shaders_.end(), this ), reloading_shaders_.end() );
 
-bool TJH_SHADER_TYPENAME::loadFragmentSourceFile( std::string filename )
-{
-    fragment_source_filename_ = filename;
-    return load_file( filename, fragment_source_ );
+    return start_reload() && finish_reload();
 }
 
-bool TJH_SHADER_TYPENAME::loadGeometrySourceFile( std::string filename )
+bool TJH_SHADER_TYPENAME::start_reload()
 {
-    geometry_source_filename_ = filename;
-    tried_set_geometry_source_ = true;
-    return load_file( filename, geometry_source_ );
-}
+    // Build the new program in a separate shader so the current one keeps working until
+    // the new one is known to be good
+    std::unique_ptr<TJH_SHADER_TYPENAME> next( new TJH_SHADER_TYPENAME );
+    next->unregister();
+    next->name_ = name_;
+    next->tried_set_geometry_source_ = tried_set_geometry_source_;
+    next->is_compute_ = is_compute_;
+    next->separable_ = separable_;
+    next->defines_ = defines_;
+
+    // Stages from files are read again, stages from strings reuse the source that was kept
+    auto reload_stage = [this]( const std::string& filename, const std::string& current, std::string& source ) {
+        if( filename.empty() ) {
+            source = current;
+            return true;
+        }
+        if( !load_file( filename, source ) ) {
+            return false;
+        }
+        watch_file( filename, source );
+        return true;
+    };
 
-void TJH_SHADER_TYPENAME::setVertexSourceString( const std::string& source )
-{
-    vertex_source_ = source;
-    vertex_source_filename_.clear();
-}
+    const auto start = std::chrono::steady_clock::now();
+    bool loaded_ok = (!(stages_ & GL_VERTEX_SHADER_BIT)   || reload_stage( vertex_source_filename_, vertex_source_, next->vertex_source_ ))
+                  && (!(stages_ & GL_FRAGMENT_SHADER_BIT) || reload_stage( fragment_source_filename_, fragment_source_, next->fragment_source_ ))
+                  && (!(stages_ & GL_GEOMETRY_SHADER_BIT) || reload_stage( geometry_source_filename_, geometry_source_, next->geometry_source_ ))
+                  && (!(stages_ & GL_COMPUTE_SHADER_BIT)  || reload_stage( compute_source_filename_, compute_source_, next->compute_source_ ));
+    next->stats_.load_ms = tjh_shader_ms_since( start );
+
+    if( !loaded_ok || !next->submit_compile_and_link() )
+    {
+        TJH_SHADER_PRINTF( "ERROR: failed to reload shader program '%i', keeping the old one\n", program_ );
+        return false;
+    }
+
+    pending_reload_ = std::move( next );
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::finish_reload()
+{
+    if( !pending_reload_ ) {
+        return false;
+    }
+
+    std::unique_ptr<TJH_SHADER_TYPENAME> next = std::move( pending_reload_ );
+    if( next->pending_link_ ) {
+        next->finish_compile_and_link();
+    }
+    if( !next->linked_ )
+    {
+        TJH_SHADER_PRINTF( "ERROR: failed to reload shader program '%i', keeping the old one\n", program_ );
+        return false;
+    }
+
+    // The new program's includes are watched by 'next', hand them over
+    for( const std::string& filename : include_filenames_ ) {
+        unwatch_file( filename );
+    }
+    next->move_watched_files( this );
+    include_filenames_.clear();
+    std::swap( include_filenames_, next->include_filenames_ );
+
+    // Swap in the new resources in one go, 'next' takes the old ones with it when it's destroyed
+    std::swap( program_, next->program_ );
+    std::swap( vertex_shader_, next->vertex_shader_ );
+    std::swap( fragment_shader_, next->fragment_shader_ );
+    std::swap( geometry_shader_, next->geometry_shader_ );
+    std::swap( compute_shader_, next->compute_shader_ );
+    std::swap( stages_, next->stages_ );
+    std::swap( work_group_size_, next->work_group_size_ );
+    std::swap( uniform_locations_, next->uniform_locations_ );
+    std::swap( uniform_values_, next->uniform_values_ );
+    std::swap( attributes_, next->attributes_ );
+    std::swap( uniforms_, next->uniforms_ );
+    std::swap( uniform_blocks_, next->uniform_blocks_ );
+    std::swap( stats_, next->stats_ );
+    load_ms_used_ = true;
+    linked_ = true;
+
+    return true;
+}
+
+int TJH_SHADER_TYPENAME::reloadChanged()
+{
+    int swapped = 0;
+
+    // Swap in the reloads that finished compiling since last time
+    for( size_t i = 0; i < reloading_shaders_.size(); )
+    {
+        TJH_SHADER_TYPENAME* shader = reloading_shaders_[i];
+        if( !shader->pending_reload_ || shader->pending_reload_->isReady() )
+        {
+            if( shader->finish_reload() ) {
+                swapped++;
+            }
+            reloading_shaders_[i] = reloading_shaders_.back();
+            reloading_shaders_.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+
+    std::vector<std::string> changed;
+    find_changed_files( changed );
+    if( changed.empty() ) {
+        return swapped;
+    }
+
+    // Only shaders using a file whose content is actually different need to be rebuilt
+    std::vector<TJH_SHADER_TYPENAME*> to_reload;
+    for( const std::string& path : changed )
+    {
+        auto it = watched_files_.find( path );
+        if( it == watched_files_.end() ) {
+            continue;
+        }
+
+        // Reuse the same memory for every file
+        static std::string buffer;
+        if( !tjh_shader_read_file( path, buffer ) ) {
+            continue; // Probably mid save, we'll be told again when it is written
+        }
+        const uint64_t hash = tjh_shader_hash( buffer );
+        if( hash == it->second.hash ) {
+            continue;
+        }
+        it->second.hash = hash;
+
+        for( TJH_SHADER_TYPENAME* shader : it->second.shaders ) {
+            if( std::find( to_reload.begin(), to_reload.end(), shader ) == to_reload.end() ) {
+                to_reload.push_back( shader );
+            }
+        }
+    }
+
+    if( to_reload.empty() ) {
+        return swapped;
+    }
+
+    if( parallel_compile_supported() )
+    {
+        // Let the driver compile them all in the background, they're swapped in on a later call
+        enable_parallel_compile();
+        for( TJH_SHADER_TYPENAME* shader : to_reload )
+        {
+            shader->pending_reload_.reset();
+            if( shader->start_reload()
+             && std::find( reloading_shaders_.begin(), reloading_shaders_.end(), shader ) == reloading_shaders_.end() ) {
+                reloading_shaders_.push_back( shader );
+            }
+        }
+    }
+    else
+    {
+        for( TJH_SHADER_TYPENAME* shader : to_reload ) {
+            if( shader->reload() ) {
+                swapped++;
+            }
+        }
+    }
+
+    return swapped;
+}
+
+void TJH_SHADER_TYPENAME::find_changed_files( std::vector<std::string>& changed )
+{
+    if( watched_files_.empty() ) {
+        return;
+    }
+
+#ifdef __linux__
+    if( inotify_fd_ == -1 )
+    {
+        // -2 remembers that inotify isn't available so we don't keep trying
+        inotify_fd_ = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+        if( inotify_fd_ == -1 ) {
+            inotify_fd_ = -2;
+        }
+
+        // Watch the directories rather than the files, editors often save by replacing the file
+        for( const auto& watched : watched_files_ )
+        {
+            const size_t slash = watched.first.find_last_of( '/' );
+            const std::string dir = slash == std::string::npos ? "" : watched.first.substr( 0, slash );
+
+            bool already_watched = false;
+            for( const auto& d : inotify_dirs_ ) {
+                if( d.second == dir ) { already_watched = true; break; }
+            }
+            if( already_watched || inotify_fd_ < 0 ) {
+                continue;
+            }
+
+            int wd = inotify_add_watch( inotify_fd_, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE );
+            if( wd != -1 ) {
+                inotify_dirs_[wd] = dir;
+            }
+        }
+
+        // Files were just loaded so nothing has changed yet, fall through to
+        // polling if inotify isn't available
+        if( inotify_fd_ >= 0 && !inotify_dirs_.empty() ) {
+            return;
+        }
+    }
+
+    if( inotify_fd_ >= 0 && !inotify_dirs_.empty() )
+    {
+        // One non blocking read, usually there's nothing there
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t length = 0;
+        while( (length = read( inotify_fd_, buffer, sizeof(buffer) )) > 0 )
+        {
+            for( ssize_t offset = 0; offset < length; )
+            {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+                auto dir = inotify_dirs_.find( event->wd );
+                if( event->len > 0 && dir != inotify_dirs_.end() )
+                {
+                    std::string path = dir->second.empty() ? event->name : dir->second + '/' + event->name;
+                    if( watched_files_.count( path ) && std::find( changed.begin(), changed.end(), path ) == changed.end() ) {
+                        changed.push_back( path );
+                    }
+                }
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return;
+    }
+#endif
+
+    // No file notifications, so check the modification times every now and again
+    static std::chrono::steady_clock::time_point last_poll;
+    const auto now = std::chrono::steady_clock::now();
+    if( now - last_poll < std::chrono::milliseconds( reload_poll_interval_ms_ ) ) {
+        return;
+    }
+    last_poll = now;
+
+    for( auto& watched : watched_files_ )
+    {
+        struct stat info;
+        if( stat( watched.first.c_str(), &info ) != 0 ) {
+            continue;
+        }
+        if( static_cast<long long>(info.st_mtime) != watched.second.modified
+         || static_cast<long long>(info.st_size) != watched.second.size )
+        {
+            watched.second.modified = static_cast<long long>(info.st_mtime);
+            watched.second.size = static_cast<long long>(info.st_size);
+            changed.push_back( watched.first );
+        }
+    }
+}
+
+void TJH_SHADER_TYPENAME::watch_file( const std::string& filename, const std::string& content )
+{
+    const std::string path = shader_base_path_ + filename;
+    WatchedFile& watched = watched_files_[path];
+    watched.hash = tjh_shader_hash( content );
+
+    struct stat info;
+    if( stat( path.c_str(), &info ) == 0 )
+    {
+        watched.modified = static_cast<long long>(info.st_mtime);
+        watched.size = static_cast<long long>(info.st_size);
+    }
+
+    if( std::find( watched.shaders.begin(), watched.shaders.end(), this ) == watched.shaders.end() ) {
+        watched.shaders.push_back( this );
+    }
+
+#ifdef __linux__
+    // Once inotify is running, new directories need their own watch
+    if( inotify_fd_ >= 0 && !inotify_dirs_.empty() )
+    {
+        const size_t slash = path.find_last_of( '/' );
+        const std::string dir = slash == std::string::npos ? "" : path.substr( 0, slash );
+        for( const auto& d : inotify_dirs_ ) {
+            if( d.second == dir ) return;
+        }
+        int wd = inotify_add_watch( inotify_fd_, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE );
+        if( wd != -1 ) {
+            inotify_dirs_[wd] = dir;
+        }
+    }
+#endif
+}
+
+void TJH_SHADER_TYPENAME::unwatch_file( const std::string& filename )
+{
+    auto it = watched_files_.find( shader_base_path_ + filename );
+    if( it == watched_files_.end() ) {
+        return;
+    }
+    std::vector<TJH_SHADER_TYPENAME*>& shaders = it->second.shaders;
+    shaders.erase( std::remove( shaders.begin(), shaders.end(), this ), shaders.end() );
+    if( shaders.empty() ) {
+        watched_files_.erase( it );
+    }
+}
+
+void TJH_SHADER_TYPENAME::unwatch_files()
+{
+    if( !vertex_source_filename_.empty() )   unwatch_file( vertex_source_filename_ );
+    if( !fragment_source_filename_.empty() ) unwatch_file( fragment_source_filename_ );
+    if( !geometry_source_filename_.empty() ) unwatch_file( geometry_source_filename_ );
+    if( !compute_source_filename_.empty() )  unwatch_file( compute_source_filename_ );
+    for( const std::string& filename : include_filenames_ ) {
+        unwatch_file( filename );
+    }
+    reloading_shaders_.erase( std::remove( reloading_shaders_.begin(), reloading_shaders_.end(), this ), reloading_shaders_.end() );
+}
+
+void TJH_SHADER_TYPENAME::move_watched_files( TJH_SHADER_TYPENAME* replacement )
+{
+    auto move_file = [this, replacement]( const std::string& filename ) {
+        auto it = watched_files_.find( shader_base_path_ + filename );
+        if( filename.empty() || it == watched_files_.end() ) {
+            return;
+        }
+        std::vector<TJH_SHADER_TYPENAME*>& shaders = it->second.shaders;
+        shaders.erase( std::remove( shaders.begin(), shaders.end(), replacement ), shaders.end() );
+        std::replace( shaders.begin(), shaders.end(), this, replacement );
+    };
+
+    move_file( vertex_source_filename_ );
+    move_file( fragment_source_filename_ );
+    move_file( geometry_source_filename_ );
+    move_file( compute_source_filename_ );
+    for( const std::string& filename : include_filenames_ ) {
+        move_file( filename );
+    }
+    std::replace( reloading_shaders_.begin(), reloading_shaders_.end(), this, replacement );
+}
+
+void TJH_SHADER_TYPENAME::shutdown()
+{
+    variants_.clear();
+    if( program_ ) {
+        glDeleteProgram( program_ );
+        program_ = 0;
+    }
+    release_shader( vertex_shader_ );
+    release_shader( fragment_shader_ );
+    release_shader( geometry_shader_ );
+    release_shader( compute_shader_ );
+}
+
+GLint TJH_SHADER_TYPENAME::getUniformLocation( const GLchar* name ) const
+{
+    auto it = uniform_locations_.find( name );
+    if( it != uniform_locations_.end() ) {
+        return it->second;
+    }
+
+    // Not an active uniform, remember that so the error is only printed once
+    TJH_SHADER_PRINTF("ERROR: did not find uniform '%s' in shader program '%i'\n", name, program_ );
+    uniform_locations_[name] = -1;
+    return -1;
+}
+
+void TJH_SHADER_TYPENAME::reflect_program()
+{
+    uniform_locations_.clear();
+    uniform_values_.clear();
+    attributes_.clear();
+    uniforms_.clear();
+
+    GLint count = 0;
+    GLint max_name_length = 0;
+    glGetProgramiv( program_, GL_ACTIVE_ATTRIBUTES, &count );
+    glGetProgramiv( program_, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_name_length );
+
+    std::vector<GLchar> buffer( static_cast<size_t>(max_name_length) + 1 );
+    for( GLint i = 0; i < count; i++ )
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveAttrib( program_, static_cast<GLuint>(i), max_name_length, &length, &size, &type, buffer.data() );
+
+        AttributeInfo attribute;
+        attribute.name.assign( buffer.data(), static_cast<size_t>(length) );
+        attribute.location = glGetAttribLocation( program_, attribute.name.c_str() );
+        attribute.type = type;
+        attribute.size = size;
+
+        // Built in attributes such as gl_VertexID don't have locations
+        if( attribute.location != -1 ) {
+            attributes_.push_back( attribute );
+        }
+    }
+
+    glGetProgramiv( program_, GL_ACTIVE_UNIFORMS, &count );
+    glGetProgramiv( program_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length );
+
+    buffer.resize( static_cast<size_t>(max_name_length) + 1 );
+    GLint max_location = -1;
+
+    for( GLint i = 0; i < count; i++ )
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform( program_, static_cast<GLuint>(i), max_name_length, &length, &size, &type, buffer.data() );
+
+        // Uniforms inside blocks don't have locations
+        std::string name( buffer.data(), static_cast<size_t>(length) );
+        GLint location = glGetUniformLocation( program_, name.c_str() );
+        if( location == -1 ) {
+            continue;
+        }
+
+        UniformInfo uniform;
+        uniform.name = name;
+        uniform.location = location;
+        uniform.type = type;
+        uniform.size = size;
+        uniforms_.push_back( uniform );
+
+        // Arrays are reported as "name[0]", but can be looked up as "name" too
+        uniform_locations_[name] = location;
+        const size_t array_suffix = name.rfind( "[0]" );
+        if( array_suffix != std::string::npos && array_suffix + 3 == name.size() )
+        {
+            const std::string base = name.substr( 0, array_suffix );
+            uniform_locations_[base] = location;
+
+            for( GLint element = 1; element < size; element++ )
+            {
+                const std::string element_name = base + "[" + std::to_string( element ) + "]";
+                const GLint element_location = glGetUniformLocation( program_, element_name.c_str() );
+                uniform_locations_[element_name] = element_location;
+                if( element_location > max_location ) max_location = element_location;
+            }
+        }
+
+        if( location > max_location ) max_location = location;
+    }
+
+    uniform_values_.resize( static_cast<size_t>(max_location + 1) );
+
+    bind_uniform_blocks();
+
+    if( stages_ & GL_COMPUTE_SHADER_BIT ) {
+        glGetProgramiv( program_, GL_COMPUTE_WORK_GROUP_SIZE, work_group_size_ );
+    }
+
+    stats_.active_uniforms = static_cast<GLint>(uniforms_.size());
+    stats_.active_attributes = static_cast<GLint>(attributes_.size());
+    stats_.active_uniform_blocks = static_cast<GLint>(uniform_blocks_.size());
+    glGetProgramiv( program_, GL_PROGRAM_BINARY_LENGTH, &stats_.binary_size );
+}
+
+std::string TJH_SHADER_TYPENAME::getName() const
+{
+    if( !name_.empty() )                    return name_;
+    if( !vertex_source_filename_.empty() )   return vertex_source_filename_;
+    if( !fragment_source_filename_.empty() ) return fragment_source_filename_;
+    if( !geometry_source_filename_.empty() ) return geometry_source_filename_;
+    if( !compute_source_filename_.empty() )  return compute_source_filename_;
+    return "<string " + std::to_string( program_ ) + ">";
+}
+
+std::vector<const TJH_SHADER_TYPENAME*> TJH_SHADER_TYPENAME::sorted_by_total_time()
+{
+    std::vector<const TJH_SHADER_TYPENAME*> shaders;
+    for( const TJH_SHADER_TYPENAME* shader : all_shaders_ ) {
+        if( shader->program_ ) {
+            shaders.push_back( shader );
+        }
+    }
+    std::sort( shaders.begin(), shaders.end(), []( const TJH_SHADER_TYPENAME* a, const TJH_SHADER_TYPENAME* b ) {
+        return a->stats_.totalMs() > b->stats_.totalMs();
+    });
+    return shaders;
+}
+
+std::string TJH_SHADER_TYPENAME::getStatsReport()
+{
+    std::string report;
+    char line[512];
+    snprintf( line, sizeof(line), "%-40s %9s %8s %8s %8s %8s %8s %8s %8s %8s %5s %8s %5s %8s\n",
+              "name", "total ms", "load", "preproc", "cache", "vert", "frag", "geom", "comp", "link",
+              "bin", "bytes", "unis", "warm" );
+    report += line;
+
+    double total = 0.0;
+    for( const TJH_SHADER_TYPENAME* shader : sorted_by_total_time() )
+    {
+        const Stats& s = shader->stats_;
+        snprintf( line, sizeof(line), "%-40.40s %9.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %5s %8i %5i %8.2f\n",
+                  shader->getName().c_str(), s.totalMs(), s.load_ms, s.preprocess_ms, s.cache_lookup_ms,
+                  s.compile_ms[0], s.compile_ms[1], s.compile_ms[2], s.compile_ms[3], s.link_ms,
+                  s.from_binary_cache ? "yes" : "no", s.binary_size, s.active_uniforms, s.warm_up_ms );
+        report += line;
+        total += s.totalMs();
+    }
+
+    snprintf( line, sizeof(line), "%-40s %9.2f\n", "total", total );
+    report += line;
+    return report;
+}
+
+std::string TJH_SHADER_TYPENAME::getStatsJson()
+{
+    std::string json = "[";
+    char numbers[512];
+    for( const TJH_SHADER_TYPENAME* shader : sorted_by_total_time() )
+    {
+        // File names are the only strings, they just need quotes and backslashes escaped
+        std::string name;
+        for( char c : shader->getName() )
+        {
+            if( c == '"' || c == '\\' ) name += '\\';
+            name += c;
+        }
+
+        const Stats& s = shader->stats_;
+        snprintf( numbers, sizeof(numbers),
+                  "\"total_ms\":%.3f,\"load_ms\":%.3f,\"preprocess_ms\":%.3f,\"cache_lookup_ms\":%.3f,"
+                  "\"compile_ms\":[%.3f,%.3f,%.3f,%.3f],\"link_ms\":%.3f,\"from_binary_cache\":%s,"
+                  "\"binary_size\":%i,\"active_uniforms\":%i,\"active_attributes\":%i,\"active_uniform_blocks\":%i,"
+                  "\"shared_stages\":%i,\"warm_up_ms\":%.3f",
+                  s.totalMs(), s.load_ms, s.preprocess_ms, s.cache_lookup_ms,
+                  s.compile_ms[0], s.compile_ms[1], s.compile_ms[2], s.compile_ms[3], s.link_ms,
+                  s.from_binary_cache ? "true" : "false",
+                  s.binary_size, s.active_uniforms, s.active_attributes, s.active_uniform_blocks,
+                  s.shared_stages, s.warm_up_ms );
+
+        if( json.size() > 1 ) json += ',';
+        json += "{\"name\":\"" + name + "\"," + numbers + "}";
+    }
+    json += "]";
+    return json;
+}
+
+void TJH_SHADER_TYPENAME::addWarmUpLayout( const TJH_SHADER_VERTEX_LAYOUT_TYPENAME& layout )
+{
+    warm_up_layouts_.emplace_back( new TJH_SHADER_VERTEX_LAYOUT_TYPENAME( layout ) );
+}
+
+bool TJH_SHADER_TYPENAME::warmUp()
+{
+    WarmUpTarget target;
+    begin_warm_up( target );
+    const bool warmed = warm_up( target );
+    end_warm_up( target );
+    return warmed;
+}
+
+int TJH_SHADER_TYPENAME::warmUpAll()
+{
+    // One framebuffer for the lot
+    WarmUpTarget target;
+    begin_warm_up( target );
+    int warmed = 0;
+    for( TJH_SHADER_TYPENAME* shader : all_shaders_ )
+    {
+        if( shader->program_ && shader->warm_up( target ) ) {
+            warmed++;
+        }
+    }
+    end_warm_up( target );
+    return warmed;
+}
+
+void TJH_SHADER_TYPENAME::begin_warm_up( WarmUpTarget& target )
+{
+    glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &target.previous_framebuffer );
+    glGetIntegerv( GL_VIEWPORT, target.previous_viewport );
+    glGetIntegerv( GL_CURRENT_PROGRAM, &target.previous_program );
+    glGetIntegerv( GL_VERTEX_ARRAY_BINDING, &target.previous_vao );
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &target.previous_array_buffer );
+    glGetIntegerv( GL_RENDERBUFFER_BINDING, &target.previous_renderbuffer );
+
+    // The formats most draws go to, the compiled code can depend on them
+    glGenRenderbuffers( 2, target.renderbuffers );
+    glBindRenderbuffer( GL_RENDERBUFFER, target.renderbuffers[0] );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, 1, 1 );
+    glBindRenderbuffer( GL_RENDERBUFFER, target.renderbuffers[1] );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 1, 1 );
+    glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+    glGenFramebuffers( 1, &target.framebuffer );
+    glBindFramebuffer( GL_DRAW_FRAMEBUFFER, target.framebuffer );
+    glFramebufferRenderbuffer( GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.renderbuffers[0] );
+    glFramebufferRenderbuffer( GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.renderbuffers[1] );
+    glViewport( 0, 0, 1, 1 );
+
+    glGenBuffers( 1, &target.vertex_buffer );
+}
+
+void TJH_SHADER_TYPENAME::end_warm_up( WarmUpTarget& target )
+{
+    glBindFramebuffer( GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(target.previous_framebuffer) );
+    glViewport( target.previous_viewport[0], target.previous_viewport[1], target.previous_viewport[2], target.previous_viewport[3] );
+    glUseProgram( static_cast<GLuint>(target.previous_program) );
+    glBindVertexArray( static_cast<GLuint>(target.previous_vao) );
+    glBindBuffer( GL_ARRAY_BUFFER, static_cast<GLuint>(target.previous_array_buffer) );
+    glBindRenderbuffer( GL_RENDERBUFFER, static_cast<GLuint>(target.previous_renderbuffer) );
+
+    glDeleteFramebuffers( 1, &target.framebuffer );
+    glDeleteRenderbuffers( 2, target.renderbuffers );
+    glDeleteBuffers( 1, &target.vertex_buffer );
+    target = WarmUpTarget();
+}
+
+bool TJH_SHADER_TYPENAME::warm_up( WarmUpTarget& target )
+{
+    if( pending_link_ ) {
+        finish_compile_and_link();
+    }
+    if( !linked_ ) {
+        return false;
+    }
+    if( !(stages_ & GL_VERTEX_SHADER_BIT) ) {
+        return true;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // A geometry shader only accepts the primitive it was written for, six vertices is
+    // at least one of any of them. All the vertices are at the origin so nothing is drawn.
+    GLint mode = GL_TRIANGLES;
+    if( stages_ & GL_GEOMETRY_SHADER_BIT ) {
+        glGetProgramiv( program_, GL_GEOMETRY_INPUT_TYPE, &mode );
+    }
+    const GLsizei vertex_count = 6;
+
+    glUseProgram( program_ );
+
+    GLuint vao = 0;
+    glGenVertexArrays( 1, &vao );
+    glBindVertexArray( vao );
+    glDrawArrays( static_cast<GLenum>(mode), 0, vertex_count );
+
+    for( const auto& layout : warm_up_layouts_ )
+    {
+        // Zeros, big enough for the widest layout
+        const GLsizeiptr size = static_cast<GLsizeiptr>(layout->getStride()) * vertex_count;
+        if( size > target.vertex_buffer_size )
+        {
+            std::vector<char> zeros( static_cast<size_t>(size), 0 );
+            glBindBuffer( GL_ARRAY_BUFFER, target.vertex_buffer );
+            glBufferData( GL_ARRAY_BUFFER, size, zeros.data(), GL_STATIC_DRAW );
+            target.vertex_buffer_size = size;
+        }
+
+        // A fresh VAO each time so attributes from the last layout don't linger
+        glDeleteVertexArrays( 1, &vao );
+        glGenVertexArrays( 1, &vao );
+        layout->apply( vao, target.vertex_buffer );
+        glDrawArrays( static_cast<GLenum>(mode), 0, vertex_count );
+    }
+
+    glDeleteVertexArrays( 1, &vao );
+
+    // Wait for the driver so the time is what the first real draw would have cost
+    glFinish();
+    stats_.warm_up_ms = tjh_shader_ms_since( start );
+    return true;
+}
+
+GLuint TJH_SHADER_TYPENAME::getUniformBlockBinding( const std::string& block_name )
+{
+    auto it = uniform_block_bindings_.find( block_name );
+    if( it != uniform_block_bindings_.end() ) {
+        return it->second;
+    }
+
+    // Hand out the lowest binding point nobody is using yet
+    GLuint binding = 0;
+    bool taken = true;
+    while( taken )
+    {
+        taken = false;
+        for( const auto& b : uniform_block_bindings_ ) {
+            if( b.second == binding ) { taken = true; binding++; break; }
+        }
+    }
+
+    GLint max_bindings = 0;
+    glGetIntegerv( GL_MAX_UNIFORM_BUFFER_BINDINGS, &max_bindings );
+    if( binding >= static_cast<GLuint>(max_bindings) ) {
+        TJH_SHADER_PRINTF( "ERROR: ran out of uniform buffer binding points for block '%s'\n", block_name.c_str() );
+    }
+
+    uniform_block_bindings_[block_name] = binding;
+    return binding;
+}
+
+bool TJH_SHADER_TYPENAME::bindUniformBlock( const GLchar* block_name, GLuint binding )
+{
+    GLuint index = glGetUniformBlockIndex( program_, block_name );
+    if( index == GL_INVALID_INDEX )
+    {
+        TJH_SHADER_PRINTF( "ERROR: did not find uniform block '%s' in shader program '%i'\n", block_name, program_ );
+        return false;
+    }
+    glUniformBlockBinding( program_, index, binding );
+    return true;
+}
+
+void TJH_SHADER_TYPENAME::bind_uniform_blocks()
+{
+    uniform_blocks_.clear();
+
+    GLint count = 0;
+    GLint max_name_length = 0;
+    glGetProgramiv( program_, GL_ACTIVE_UNIFORM_BLOCKS, &count );
+    glGetProgramiv( program_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_name_length );
+
+    std::vector<GLchar> buffer( static_cast<size_t>(max_name_length) + 1 );
+    for( GLint i = 0; i < count; i++ )
+    {
+        GLsizei length = 0;
+        glGetActiveUniformBlockName( program_, static_cast<GLuint>(i), max_name_length, &length, buffer.data() );
+        UniformBlockInfo block;
+        block.name.assign( buffer.data(), static_cast<size_t>(length) );
+        block.index = static_cast<GLuint>(i);
+        block.binding = getUniformBlockBinding( block.name );
+        glGetActiveUniformBlockiv( program_, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.data_size );
+
+        glUniformBlockBinding( program_, block.index, block.binding );
+        uniform_blocks_.push_back( block );
+    }
+}
+
+void TJH_SHADER_TYPENAME::dispatch( GLuint groups_x, GLuint groups_y, GLuint groups_z, GLbitfield barriers )
+{
+    if( !(stages_ & GL_COMPUTE_SHADER_BIT) )
+    {
+        TJH_SHADER_PRINTF( "ERROR: shader program '%i' is not a compute shader\n", program_ );
+        return;
+    }
+
+    glUseProgram( program_ );
+    glDispatchCompute( groups_x, groups_y, groups_z );
+    pending_barriers_ |= barriers;
+}
+
+void TJH_SHADER_TYPENAME::dispatchThreads( GLuint threads_x, GLuint threads_y, GLuint threads_z, GLbitfield barriers )
+{
+    auto groups = []( GLuint threads, GLint size ) {
+        return size > 0 ? (threads + static_cast<GLuint>(size) - 1) / static_cast<GLuint>(size) : threads;
+    };
+    dispatch( groups( threads_x, work_group_size_[0] ),
+              groups( threads_y, work_group_size_[1] ),
+              groups( threads_z, work_group_size_[2] ),
+              barriers );
+}
+
+void TJH_SHADER_TYPENAME::memoryBarrier()
+{
+    if( pending_barriers_ )
+    {
+        glMemoryBarrier( pending_barriers_ );
+        pending_barriers_ = 0;
+    }
+}
+
+void TJH_SHADER_TYPENAME::bindStorageBuffer( GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size )
+{
+    if( size > 0 ) {
+        glBindBufferRange( GL_SHADER_STORAGE_BUFFER, binding, buffer, offset, size );
+    }
+    else {
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, binding, buffer );
+    }
+}
+
+bool TJH_SHADER_TYPENAME::bindStorageBuffer( const GLchar* block_name, GLuint buffer, GLintptr offset, GLsizeiptr size )
+{
+    const GLuint index = glGetProgramResourceIndex( program_, GL_SHADER_STORAGE_BLOCK, block_name );
+    if( index == GL_INVALID_INDEX )
+    {
+        TJH_SHADER_PRINTF( "ERROR: did not find buffer block '%s' in shader program '%i'\n", block_name, program_ );
+        return false;
+    }
+
+    const GLenum property = GL_BUFFER_BINDING;
+    GLint binding = 0;
+    glGetProgramResourceiv( program_, GL_SHADER_STORAGE_BLOCK, index, 1, &property, 1, NULL, &binding );
+    bindStorageBuffer( static_cast<GLuint>(binding), buffer, offset, size );
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::uniform_changed( GLint location, const void* data, size_t size )
+{
+    if( location < 0 || static_cast<size_t>(location) >= uniform_values_.size() ) {
+        return location != -1;
+    }
+
+    UniformValue& value = uniform_values_[location];
+    if( value.size == static_cast<GLsizei>(size) && std::memcmp( value.data, data, size ) == 0 ) {
+        return false;
+    }
+
+    value.size = static_cast<GLsizei>(size);
+    std::memcpy( value.data, data, size );
+    return true;
+}
+
+void TJH_SHADER_TYPENAME::setInt( GLint location, GLint value )
+{
+    if( uniform_changed( location, &value, sizeof(value) ) ) {
+        if( separable_ ) glProgramUniform1i( program_, location, value );
+        else             glUniform1i( location, value );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setFloat( GLint location, GLfloat value )
+{
+    if( uniform_changed( location, &value, sizeof(value) ) ) {
+        if( separable_ ) glProgramUniform1f( program_, location, value );
+        else             glUniform1f( location, value );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setVec2( GLint location, GLfloat x, GLfloat y )
+{
+    const GLfloat value[2] = { x, y };
+    if( uniform_changed( location, value, sizeof(value) ) ) {
+        if( separable_ ) glProgramUniform2fv( program_, location, 1, value );
+        else             glUniform2fv( location, 1, value );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setVec3( GLint location, GLfloat x, GLfloat y, GLfloat z )
+{
+    const GLfloat value[3] = { x, y, z };
+    if( uniform_changed( location, value, sizeof(value) ) ) {
+        if( separable_ ) glProgramUniform3fv( program_, location, 1, value );
+        else             glUniform3fv( location, 1, value );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setVec4( GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w )
+{
+    const GLfloat value[4] = { x, y, z, w };
+    if( uniform_changed( location, value, sizeof(value) ) ) {
+        if( separable_ ) glProgramUniform4fv( program_, location, 1, value );
+        else             glUniform4fv( location, 1, value );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setMat3( GLint location, const GLfloat* matrix )
+{
+    if( uniform_changed( location, matrix, sizeof(GLfloat) * 9 ) ) {
+        if( separable_ ) glProgramUniformMatrix3fv( program_, location, 1, GL_FALSE, matrix );
+        else             glUniformMatrix3fv( location, 1, GL_FALSE, matrix );
+    }
+}
+
+void TJH_SHADER_TYPENAME::setMat4( GLint location, const GLfloat* matrix )
+{
+    if( uniform_changed( location, matrix, sizeof(GLfloat) * 16 ) ) {
+        if( separable_ ) glProgramUniformMatrix4fv( program_, location, 1, GL_FALSE, matrix );
+        else             glUniformMatrix4fv( location, 1, GL_FALSE, matrix );
+    }
+}
+
+const TJH_SHADER_TYPENAME::AttributeInfo* TJH_SHADER_TYPENAME::findAttribute( const GLchar* name ) const
+{
+    // There are only ever a handful of attributes
+    for( const AttributeInfo& attribute : attributes_ ) {
+        if( attribute.name == name ) {
+            return &attribute;
+        }
+    }
+    return nullptr;
+}
+
+GLint TJH_SHADER_TYPENAME::getAttribLocation( const GLchar* name ) const
+{
+    const AttributeInfo* attribute = findAttribute( name );
+    if( !attribute ) {
+        TJH_SHADER_PRINTF("ERROR: did not find attribute '%s' in shader program '%i'\n", name, program_ );
+        return -1;
+    }
+    return attribute->location;
+}
+
+bool TJH_SHADER_TYPENAME::setVertexAttribArrays( GLuint vao, const std::initializer_list<VertexAttribArrayDesc>& desc_list )
+{
+    bool success = true;
+
+    GLsizei stride = 0;
+    for( const auto& desc : desc_list ) {
+        stride += glenum_type_to_size_in_bytes( desc.type ) * desc.count;
+    }
+    
+    // Bind the vao so we know we are working with the right one
+    glBindVertexArray( vao );
+
+    size_t offset = 0;
+    for( const auto& desc : desc_list )
+    {
+        const size_t size = static_cast<size_t>(glenum_type_to_size_in_bytes( desc.type ) * desc.count);
+        const AttributeInfo* info = findAttribute( desc.name.c_str() );
+        GLint locations, components;
+        bool integer;
+        if( !info )
+        {
+            TJH_SHADER_PRINTF("ERROR: did not find attribute '%s' in shader program '%i'\n", desc.name.c_str(), program_ );
+            success = false;
+        }
+        else if( !tjh_shader_attribute_locations( *info, desc.count, locations, components, integer ) ) {
+            success = false;
+        }
+        else
+        {
+            const size_t column_size = size / static_cast<size_t>(locations);
+            for( GLint i = 0; i < locations; i++ )
+            {
+                const GLuint attrib = static_cast<GLuint>(info->location + i);
+                void* pointer = reinterpret_cast<void*>(offset + column_size * static_cast<size_t>(i));
+                glEnableVertexAttribArray( attrib );
+                if( integer ) {
+                    glVertexAttribIPointer( attrib, components, desc.type, stride, pointer );
+                }
+                else {
+                    glVertexAttribPointer( attrib, components, desc.type, desc.normalized, stride, pointer );
+                }
+            }
+        }
+        offset += size;
+    }
+
+    return success;
+}
+
+void TJH_SHADER_TYPENAME::add_load_ms( double ms )
+{
+    if( load_ms_used_ ) {
+        stats_.load_ms = 0.0;
+        load_ms_used_ = false;
+    }
+    stats_.load_ms += ms;
+}
+
+bool TJH_SHADER_TYPENAME::loadVertexSourceFile( std::string filename )
+{
+    if( !vertex_source_filename_.empty() && vertex_source_filename_ != filename ) {
+        unwatch_file( vertex_source_filename_ );
+    }
+    vertex_source_filename_ = filename;
+    const auto start = std::chrono::steady_clock::now();
+    const bool loaded_ok = load_file( filename, vertex_source_ );
+    add_load_ms( tjh_shader_ms_since( start ) );
+    if( !loaded_ok ) {
+        return false;
+    }
+    watch_file( filename, vertex_source_ );
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::loadFragmentSourceFile( std::string filename )
+{
+    if( !fragment_source_filename_.empty() && fragment_source_filename_ != filename ) {
+        unwatch_file( fragment_source_filename_ );
+    }
+    fragment_source_filename_ = filename;
+    const auto start = std::chrono::steady_clock::now();
+    const bool loaded_ok = load_file( filename, fragment_source_ );
+    add_load_ms( tjh_shader_ms_since( start ) );
+    if( !loaded_ok ) {
+        return false;
+    }
+    watch_file( filename, fragment_source_ );
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::loadGeometrySourceFile( std::string filename )
+{
+    if( !geometry_source_filename_.empty() && geometry_source_filename_ != filename ) {
+        unwatch_file( geometry_source_filename_ );
+    }
+    geometry_source_filename_ = filename;
+    tried_set_geometry_source_ = true;
+    const auto start = std::chrono::steady_clock::now();
+    const bool loaded_ok = load_file( filename, geometry_source_ );
+    add_load_ms( tjh_shader_ms_since( start ) );
+    if( !loaded_ok ) {
+        return false;
+    }
+    watch_file( filename, geometry_source_ );
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::loadComputeSourceFile( std::string filename )
+{
+    if( !compute_source_filename_.empty() && compute_source_filename_ != filename ) {
+        unwatch_file( compute_source_filename_ );
+    }
+    compute_source_filename_ = filename;
+    is_compute_ = true;
+    const auto start = std::chrono::steady_clock::now();
+    const bool loaded_ok = load_file( filename, compute_source_ );
+    add_load_ms( tjh_shader_ms_since( start ) );
+    if( !loaded_ok ) {
+        return false;
+    }
+    watch_file( filename, compute_source_ );
+    return true;
+}
+
+void TJH_SHADER_TYPENAME::setVertexSourceString( const std::string& source )
+{
+    vertex_source_ = source;
+    if( !vertex_source_filename_.empty() ) {
+        unwatch_file( vertex_source_filename_ );
+        vertex_source_filename_.clear();
+    }
+}
 
 void TJH_SHADER_TYPENAME::setFragmentSourceString( const std::string& source )
 {
-    fragment_source_ = source;
-    fragment_source_filename_.clear();
+    fragment_source_ = source;
+    if( !fragment_source_filename_.empty() ) {
+        unwatch_file( fragment_source_filename_ );
+        fragment_source_filename_.clear();
+    }
+}
+
+void TJH_SHADER_TYPENAME::setGeometrySourceString( const std::string& source )
+{
+    geometry_source_ = source;
+    if( !geometry_source_filename_.empty() ) {
+        unwatch_file( geometry_source_filename_ );
+        geometry_source_filename_.clear();
+    }
+    tried_set_geometry_source_ = true;
+}
+
+void TJH_SHADER_TYPENAME::setComputeSourceString( const std::string& source )
+{
+    compute_source_ = source;
+    if( !compute_source_filename_.empty() ) {
+        unwatch_file( compute_source_filename_ );
+        compute_source_filename_.clear();
+    }
+    is_compute_ = true;
+}
+
+TJH_SHADER_TYPENAME* TJH_SHADER_TYPENAME::getVariant( const std::vector<Define>& defines )
+{
+    // Later defines replace earlier ones with the same name
+    std::vector<Define> all = defines_;
+    for( const Define& define : defines )
+    {
+        auto same = std::find_if( all.begin(), all.end(), [&define]( const Define& d ) { return d.name == define.name; } );
+        if( same != all.end() ) {
+            same->value = define.value;
+        }
+        else {
+            all.push_back( define );
+        }
+    }
+    std::sort( all.begin(), all.end(), []( const Define& a, const Define& b ) { return a.name < b.name; } );
+
+    std::string key;
+    for( const Define& define : all ) {
+        key += define.name + '=' + define.value + '\n';
+    }
+    const uint64_t hash = tjh_shader_hash( key );
+
+    auto it = variants_.find( hash );
+    if( it != variants_.end() ) {
+        return it->second->linked_ ? it->second.get() : nullptr;
+    }
+
+    // Variants load their own copy of the files so they are reloaded along with this shader
+    std::unique_ptr<TJH_SHADER_TYPENAME> variant( new TJH_SHADER_TYPENAME );
+    variant->defines_ = all;
+    variant->separable_ = separable_;
+
+    bool loaded_ok = true;
+    if( !vertex_source_filename_.empty() )   loaded_ok = variant->loadVertexSourceFile( vertex_source_filename_ ) && loaded_ok;
+    else if( !vertex_source_.empty() )       variant->setVertexSourceString( vertex_source_ );
+    if( !fragment_source_filename_.empty() ) loaded_ok = variant->loadFragmentSourceFile( fragment_source_filename_ ) && loaded_ok;
+    else if( !fragment_source_.empty() )     variant->setFragmentSourceString( fragment_source_ );
+    if( !geometry_source_filename_.empty() ) loaded_ok = variant->loadGeometrySourceFile( geometry_source_filename_ ) && loaded_ok;
+    else if( tried_set_geometry_source_ )    variant->setGeometrySourceString( geometry_source_ );
+    if( !compute_source_filename_.empty() )  loaded_ok = variant->loadComputeSourceFile( compute_source_filename_ ) && loaded_ok;
+    else if( is_compute_ )                   variant->setComputeSourceString( compute_source_ );
+
+    if( loaded_ok ) {
+        variant->compileAndLink();
+    }
+
+    // Failures are remembered too so they aren't compiled again every time they're asked for,
+    // if the source is fixed reloadChanged() will rebuild them
+    TJH_SHADER_TYPENAME* result = variant->linked_ ? variant.get() : nullptr;
+    variants_[hash] = std::move( variant );
+    return result;
+}
+
+bool TJH_SHADER_TYPENAME::preprocess( int stage, const std::string& filename, const std::string& source, std::string& scratch, const std::string*& output )
+{
+    std::vector<std::string>& names = source_names_[stage];
+    names.clear();
+    names.push_back( filename );
+
+    // Nothing to do, use the source as it is
+    if( defines_.empty() && source.find( "#include" ) == std::string::npos )
+    {
+        output = &source;
+        return true;
+    }
+    output = &scratch;
+
+    // Before GLSL 3.30 '#line n' numbers the line after it n + 1 rather than n
+    int line_offset = 0;
+    const size_t version = tjh_shader_find_directive( source, "version" );
+    if( version != std::string::npos && std::atoi( source.c_str() + version + 7 ) < 330
+     && source.compare( version, std::string::npos, "version 300 es", 0, 14 ) != 0 ) {
+        line_offset = -1;
+    }
+
+    scratch.clear();
+    scratch.reserve( source.size() + 256 );
+
+    // Without a #version the defines go first
+    if( version == std::string::npos )
+    {
+        for( const Define& define : defines_ ) {
+            scratch += "#define " + define.name + ' ' + define.value + '\n';
+        }
+        scratch += "#line " + std::to_string( 1 + line_offset ) + " 0\n";
+    }
+
+    std::vector<std::string> included_once;
+    return preprocess_file( stage, 0, source, scratch, line_offset, 0, included_once );
+}
+
+bool TJH_SHADER_TYPENAME::preprocess_file( int stage, int source_index, const std::string& source, std::string& output,
+                                           int line_offset, int depth, std::vector<std::string>& included_once )
+{
+    static const int MAX_INCLUDE_DEPTH = 32;
+    // Copied because including files adds to 'names'
+    std::vector<std::string>& names = source_names_[stage];
+    const std::string name = names[source_index];
+    const std::string current_name = name.empty() ? std::string( "<string>" ) : name;
+
+    auto line_directive = [&]( int line, int index ) {
+        return "#line " + std::to_string( line + line_offset ) + ' ' + std::to_string( index ) + '\n';
+    };
+
+    int line_number = 0;
+    size_t start = 0;
+    bool in_comment = false;
+    while( start < source.size() )
+    {
+        // Commented out directives are passed through as they are
+        size_t end = 0;
+        const size_t directive = tjh_shader_next_line( source, start, end, in_comment );
+        line_number++;
+
+        auto is_directive = [&]( const char* word ) {
+            const size_t length = std::strlen( word );
+            return directive < end && source.compare( directive, length, word ) == 0;
+        };
+
+        if( is_directive( "include" ) )
+        {
+            // Find the name between "" or <>
+            size_t open = source.find_first_of( "\"<", directive + 7 );
+            size_t close = open < end ? source.find_first_of( source[open] == '<' ? ">" : "\"", open + 1 ) : std::string::npos;
+            if( open >= end || close >= end )
+            {
+                TJH_SHADER_PRINTF( "ERROR: %s:%i: malformed #include\n", current_name.c_str(), line_number );
+                return false;
+            }
+            const std::string include_name = source.substr( open + 1, close - open - 1 );
+
+            if( depth >= MAX_INCLUDE_DEPTH )
+            {
+                TJH_SHADER_PRINTF( "ERROR: %s:%i: #include nested too deeply, is '%s' including itself?\n",
+                                   current_name.c_str(), line_number, include_name.c_str() );
+                return false;
+            }
+
+            if( std::find( included_once.begin(), included_once.end(), include_name ) == included_once.end() )
+            {
+                std::string include_source;
+                if( !load_file( include_name, include_source ) )
+                {
+                    TJH_SHADER_PRINTF( "ERROR: %s:%i: could not include '%s'\n", current_name.c_str(), line_number, include_name.c_str() );
+                    return false;
+                }
+                watch_file( include_name, include_source );
+                if( std::find( include_filenames_.begin(), include_filenames_.end(), include_name ) == include_filenames_.end() ) {
+                    include_filenames_.push_back( include_name );
+                }
+
+                const int include_index = static_cast<int>(names.size());
+                names.push_back( include_name );
+                output += line_directive( 1, include_index );
+                if( !preprocess_file( stage, include_index, include_source, output, line_offset, depth + 1, included_once ) ) {
+                    return false;
+                }
+                if( !output.empty() && output.back() != '\n' ) {
+                    output += '\n';
+                }
+            }
+            output += line_directive( line_number + 1, source_index );
+        }
+        else if( is_directive( "pragma" ) && source.find( "once", directive + 6 ) < end )
+        {
+            included_once.push_back( name );
+            output += '\n';
+        }
+        else if( depth == 0 && is_directive( "version" ) )
+        {
+            output.append( source, start, end - start );
+            output += '\n';
+            for( const Define& define : defines_ ) {
+                output += "#define " + define.name + ' ' + define.value + '\n';
+            }
+            output += line_directive( line_number + 1, source_index );
+        }
+        else
+        {
+            output.append( source, start, end - start );
+            output += '\n';
+        }
+
+        start = end + 1;
+    }
+
+    return true;
 }
 
-void TJH_SHADER_TYPENAME::setGeometrySourceString( const std::string& source )
+std::string TJH_SHADER_TYPENAME::rewrite_log( const std::string& log, const std::vector<std::string>& names )
 {
-    geometry_source_ = source;
-    geometry_source_filename_.clear();
-    tried_set_geometry_source_ = true;
+    // Drivers start error lines with the source string number followed by the line, such as
+    // "0:12(5): error" or "ERROR: 0:12:" or "0(12) : error", replace the number with the file
+    std::string result;
+    result.reserve( log.size() );
+    for( size_t i = 0; i < log.size(); )
+    {
+        const bool token_start = i == 0 || log[i - 1] == ' ' || log[i - 1] == '\n';
+        if( token_start && std::isdigit( static_cast<unsigned char>(log[i]) ) )
+        {
+            size_t end = i;
+            while( end < log.size() && std::isdigit( static_cast<unsigned char>(log[end]) ) ) {
+                end++;
+            }
+            const size_t index = static_cast<size_t>(std::atoi( log.c_str() + i ));
+            if( end + 1 < log.size() && (log[end] == ':' || log[end] == '(')
+             && std::isdigit( static_cast<unsigned char>(log[end + 1]) )
+             && index < names.size() && !names[index].empty() )
+            {
+                result += names[index];
+                i = end;
+                continue;
+            }
+            result.append( log, i, end - i );
+            i = end;
+            continue;
+        }
+        result += log[i++];
+    }
+    return result;
 }
 
 bool TJH_SHADER_TYPENAME::load_file( std::string filename, std::string& file_content ) const
 {   
-    std::ifstream file( shader_base_path_ + filename );
-    if( !file.good() )
+    if( !tjh_shader_read_file( shader_base_path_ + filename, file_content ) )
     {
         TJH_SHADER_PRINTF("ERROR: Could not load '%s%s'!\n", shader_base_path_.c_str(), filename.c_str() );
         return false;
     }
-
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-
-    file_content = buffer.str();
-
     return true;
 }
 
-bool TJH_SHADER_TYPENAME::compile_shader( GLenum type, GLuint& shader, const std::string& source ) const
+bool TJH_SHADER_TYPENAME::submit_shader( GLenum type, GLuint& shader, const std::string& source )
 {
     if( source.empty() )
     {
@@ -559,6 +2622,24 @@ bool TJH_SHADER_TYPENAME::compile_shader( GLenum type, GLuint& shader, const std
         return false;
     }
 
+    // Let go of whatever this stage was using before
+    release_shader( shader );
+
+    const int stage = type == GL_VERTEX_SHADER ? 0 : type == GL_FRAGMENT_SHADER ? 1 : type == GL_GEOMETRY_SHADER ? 2 : 3;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Reuse the stage if another program has already compiled it
+    const uint64_t key = tjh_shader_hash( source ) ^ (static_cast<uint64_t>(type) * 0x9E3779B97F4A7C15ULL);
+    auto shared = shared_stage_lookup_.find( key );
+    if( shared != shared_stage_lookup_.end() )
+    {
+        shader = shared->second;
+        shared_stages_[shader].users++;
+        stats_.shared_stages++;
+        glAttachShader( program_, shader );
+        return true;
+    }
+
     shader = glCreateShader( type );
     if( shader == 0 )
     {
@@ -566,16 +2647,42 @@ bool TJH_SHADER_TYPENAME::compile_shader( GLenum type, GLuint& shader, const std
         return false;
     }
 
-    // Shader strings have to be converted to const GLchar* so OpenGL can compile them
-    const GLchar* source_ptr = static_cast<const GLchar*>(source.c_str());
-
-    glShaderSource( shader, 1, &source_ptr, NULL );
+    // Passing the length saves the driver looking for the end of the string
+    const GLchar* source_ptr = static_cast<const GLchar*>(source.data());
+    const GLint source_length = static_cast<GLint>(source.size());
+    glShaderSource( shader, 1, &source_ptr, &source_length );
     glCompileShader( shader );
+    glAttachShader( program_, shader );
+    stats_.compile_ms[stage] += tjh_shader_ms_since( start );
+
+    SharedStage& shared_stage = shared_stages_[shader];
+    shared_stage.key = key;
+    shared_stage.users = 1;
+    shared_stage_lookup_[key] = shader;
+
+    return true;
+}
+
+void TJH_SHADER_TYPENAME::release_shader( GLuint& shader )
+{
+    if( !shader ) {
+        return;
+    }
 
-    return did_shader_compile_ok( shader );
+    auto it = shared_stages_.find( shader );
+    if( it == shared_stages_.end() || --it->second.users <= 0 )
+    {
+        if( it != shared_stages_.end() )
+        {
+            shared_stage_lookup_.erase( it->second.key );
+            shared_stages_.erase( it );
+        }
+        glDeleteShader( shader );
+    }
+    shader = 0;
 }
 
-bool TJH_SHADER_TYPENAME::did_shader_compile_ok( GLuint shader ) const
+bool TJH_SHADER_TYPENAME::did_shader_compile_ok( GLuint shader, const std::vector<std::string>& names ) const
 {
     // Check the shader was compiled succesfully
     GLint status;
@@ -587,15 +2694,33 @@ bool TJH_SHADER_TYPENAME::did_shader_compile_ok( GLuint shader ) const
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
 
         // Now get the error log itself
-        std::vector<GLchar> buffer;
-        buffer.reserve( static_cast<size_t>(log_length) );
+        std::vector<GLchar> buffer( static_cast<size_t>(log_length) + 1, '\0' );
         glGetShaderInfoLog( shader, log_length, NULL, buffer.data() );
 
-        // Print the error
-        // TODO: if we have the source then could we print the line that was broken?
+        // Print the error, with the line numbers pointing at the original files
         GLint type;
         glGetShaderiv( shader, GL_SHADER_TYPE, &type );
         TJH_SHADER_PRINTF( "ERROR: compiling shader %s\n", glenum_shader_to_string(static_cast<GLenum>(type)).c_str() );
+        TJH_SHADER_PRINTF( "%s", rewrite_log( buffer.data(), names ).c_str() );
+        return false;
+    }
+
+    return true;
+}
+
+bool TJH_SHADER_TYPENAME::did_program_link_ok( GLuint program ) const
+{
+    GLint status;
+    glGetProgramiv( program, GL_LINK_STATUS, &status );
+    if( status != GL_TRUE )
+    {
+        GLint log_length = 0;
+        glGetProgramiv( program, GL_INFO_LOG_LENGTH, &log_length );
+
+        std::vector<GLchar> buffer( static_cast<size_t>(log_length) + 1, '\0' );
+        glGetProgramInfoLog( program, log_length, NULL, buffer.data() );
+
+        TJH_SHADER_PRINTF( "ERROR: linking shader program '%i'\n", program );
         TJH_SHADER_PRINTF( "%s", buffer.data() );
         return false;
     }
@@ -603,6 +2728,131 @@ bool TJH_SHADER_TYPENAME::did_shader_compile_ok( GLuint shader ) const
     return true;
 }
 
+std::string TJH_SHADER_TYPENAME::program_binary_cache_filename( const std::string& vertex, const std::string& fragment, const std::string& geometry, const std::string& compute ) const
+{
+    if( binary_cache_path_.empty() ) {
+        return "";
+    }
+
+    GLint binary_formats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats );
+    if( binary_formats == 0 ) {
+        return "";
+    }
+
+    // 64 bit FNV-1a hash of everything that affects the binary
+    uint64_t hash = 14695981039346656037ULL;
+    auto hash_bytes = [&hash]( const void* data, size_t size ) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for( size_t i = 0; i < size; i++ ) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    auto hash_string = [&hash_bytes]( const char* str ) {
+        // Include the terminator so "ab" + "c" is not the same as "a" + "bc"
+        if( str ) hash_bytes( str, std::strlen( str ) + 1 );
+    };
+
+    hash_string( vertex.c_str() );
+    hash_string( fragment.c_str() );
+    hash_string( tried_set_geometry_source_ ? geometry.c_str() : "" );
+    hash_string( compute.c_str() );
+    hash_string( separable_ ? "separable" : "" );
+    hash_string( reinterpret_cast<const char*>(glGetString( GL_VENDOR )) );
+    hash_string( reinterpret_cast<const char*>(glGetString( GL_RENDERER )) );
+    hash_string( reinterpret_cast<const char*>(glGetString( GL_VERSION )) );
+
+    char name[32];
+    snprintf( name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash) );
+
+    std::string filename = binary_cache_path_;
+    if( filename.back() != '/' && filename.back() != PATH_SEPERATOR ) {
+        filename += PATH_SEPERATOR;
+    }
+    return filename + name;
+}
+
+bool TJH_SHADER_TYPENAME::load_program_binary( const std::string& filename )
+{
+    std::ifstream file( filename, std::ios::binary );
+    if( !file.good() )
+    {
+        binary_cache_stats_.misses++;
+        return false;
+    }
+
+    // The file is the binary format, the length, then the binary itself
+    GLenum format = 0;
+    GLint length = 0;
+    file.read( reinterpret_cast<char*>(&format), sizeof(format) );
+    file.read( reinterpret_cast<char*>(&length), sizeof(length) );
+
+    // The length must be exactly what's left of the file, a corrupt one could be anything
+    // up to 2GB so it's checked before allocating
+    const std::streampos binary_start = file.tellg();
+    file.seekg( 0, std::ios::end );
+    const std::streamoff remaining = file.tellg() - binary_start;
+    file.seekg( binary_start );
+    if( !file.good() || length <= 0 || length != remaining )
+    {
+        binary_cache_stats_.invalidations++;
+        return false;
+    }
+
+    std::vector<char> binary( static_cast<size_t>(length) );
+    file.read( binary.data(), binary.size() );
+
+    if( !file.good() )
+    {
+        binary_cache_stats_.invalidations++;
+        return false;
+    }
+
+    GLuint program = glCreateProgram();
+    if( separable_ ) {
+        glProgramParameteri( program, GL_PROGRAM_SEPARABLE, GL_TRUE );
+    }
+    glProgramBinary( program, format, binary.data(), length );
+
+    // Drivers reject binaries after an update and such, that isn't an error
+    GLint status = GL_FALSE;
+    glGetProgramiv( program, GL_LINK_STATUS, &status );
+    if( status != GL_TRUE )
+    {
+        glDeleteProgram( program );
+        binary_cache_stats_.invalidations++;
+        return false;
+    }
+
+    program_ = program;
+    binary_cache_stats_.hits++;
+    return true;
+}
+
+void TJH_SHADER_TYPENAME::save_program_binary( const std::string& filename ) const
+{
+    GLint length = 0;
+    glGetProgramiv( program_, GL_PROGRAM_BINARY_LENGTH, &length );
+    if( length <= 0 ) {
+        return;
+    }
+
+    GLenum format = 0;
+    std::vector<char> binary( static_cast<size_t>(length) );
+    glGetProgramBinary( program_, length, &length, &format, binary.data() );
+
+    std::ofstream file( filename, std::ios::binary | std::ios::trunc );
+    if( !file.good() )
+    {
+        TJH_SHADER_PRINTF( "ERROR: could not write program binary '%s'\n", filename.c_str() );
+        return;
+    }
+
+    file.write( reinterpret_cast<const char*>(&format), sizeof(format) );
+    file.write( reinterpret_cast<const char*>(&length), sizeof(length) );
+    file.write( binary.data(), length );
+}
+
 std::string TJH_SHADER_TYPENAME::glenum_shader_to_string( GLenum shader ) const
 {
     switch( shader )
@@ -617,7 +2867,7 @@ std::string TJH_SHADER_TYPENAME::glenum_shader_to_string( GLenum shader ) const
     }
 }
 
-int TJH_SHADER_TYPENAME::glenum_type_to_size_in_bytes( GLenum type ) const
+int TJH_SHADER_TYPENAME::glenum_type_to_size_in_bytes( GLenum type )
 {
     switch( type )
     {
@@ -637,6 +2887,334 @@ int TJH_SHADER_TYPENAME::glenum_type_to_size_in_bytes( GLenum type ) const
     }
 }
 
+// UNIFORM BUFFER //////////////////////////////////////////////////////////////
+
+bool TJH_SHADER_UNIFORM_BUFFER_TYPENAME::init( const std::string& block_name, GLsizeiptr size, int buffer_count, bool persistent_map )
+{
+    shutdown();
+
+    if( buffer_count < 1 ) buffer_count = 1;
+    if( buffer_count > MAX_BUFFER_COUNT ) buffer_count = MAX_BUFFER_COUNT;
+
+    // Each copy has to start on an offset the driver is happy to bind from
+    GLint alignment = 1;
+    glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+    if( alignment < 1 ) alignment = 1;
+
+    size_ = size;
+    stride_ = ((size + alignment - 1) / alignment) * alignment;
+    buffer_count_ = buffer_count;
+    current_ = -1;
+    binding_ = TJH_SHADER_TYPENAME::getUniformBlockBinding( block_name );
+
+    GLint major = 0, minor = 0;
+    glGetIntegerv( GL_MAJOR_VERSION, &major );
+    glGetIntegerv( GL_MINOR_VERSION, &minor );
+    const bool can_persistent_map = major > 4 || (major == 4 && minor >= 4)
+                                 || tjh_shader_has_extension( "GL_ARB_buffer_storage" );
+
+    glGenBuffers( 1, &buffer_ );
+    glBindBuffer( GL_UNIFORM_BUFFER, buffer_ );
+
+    if( persistent_map && can_persistent_map )
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage( GL_UNIFORM_BUFFER, stride_ * buffer_count_, nullptr, flags );
+        mapped_ = glMapBufferRange( GL_UNIFORM_BUFFER, 0, stride_ * buffer_count_, flags );
+    }
+    else
+    {
+        glBufferData( GL_UNIFORM_BUFFER, stride_ * buffer_count_, nullptr, GL_DYNAMIC_DRAW );
+    }
+
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+    if( persistent_map && can_persistent_map && !mapped_ )
+    {
+        TJH_SHADER_PRINTF( "ERROR: could not map uniform buffer for block '%s'\n", block_name.c_str() );
+        shutdown();
+        return false;
+    }
+    return true;
+}
+
+void TJH_SHADER_UNIFORM_BUFFER_TYPENAME::shutdown()
+{
+    for( GLsync& fence : fences_ ) {
+        if( fence ) { glDeleteSync( fence ); fence = 0; }
+    }
+    if( buffer_ )
+    {
+        if( mapped_ )
+        {
+            glBindBuffer( GL_UNIFORM_BUFFER, buffer_ );
+            glUnmapBuffer( GL_UNIFORM_BUFFER );
+            glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+            mapped_ = nullptr;
+        }
+        glDeleteBuffers( 1, &buffer_ );
+        buffer_ = 0;
+    }
+    current_ = -1;
+}
+
+void TJH_SHADER_UNIFORM_BUFFER_TYPENAME::update( const void* data, GLsizeiptr size )
+{
+    if( !buffer_ ) {
+        return;
+    }
+    if( size <= 0 || size > size_ ) {
+        size = size_;
+    }
+
+    // Everything drawn with the current copy has been submitted now, so fence it
+    // off before moving on to the next one
+    if( current_ >= 0 && mapped_ )
+    {
+        if( fences_[current_] ) glDeleteSync( fences_[current_] );
+        fences_[current_] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    }
+    current_ = (current_ + 1) % buffer_count_;
+
+    const GLintptr offset = stride_ * current_;
+    if( mapped_ )
+    {
+        // Only waits if the GPU is more than buffer_count frames behind
+        if( fences_[current_] )
+        {
+            glClientWaitSync( fences_[current_], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED );
+            glDeleteSync( fences_[current_] );
+            fences_[current_] = 0;
+        }
+        std::memcpy( static_cast<char*>(mapped_) + offset, data, static_cast<size_t>(size) );
+    }
+    else
+    {
+        glBindBuffer( GL_UNIFORM_BUFFER, buffer_ );
+        glBufferSubData( GL_UNIFORM_BUFFER, offset, size, data );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    }
+
+    glBindBufferRange( GL_UNIFORM_BUFFER, binding_, buffer_, offset, size_ );
+}
+
+// VERTEX LAYOUT ////////////////////////////////////////////////////////////////
+
+// Returns true if glVertexAttribFormat and friends are available
+static bool tjh_shader_has_vertex_attrib_binding()
+{
+    static int supported = -1;
+    if( supported == -1 )
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv( GL_MAJOR_VERSION, &major );
+        glGetIntegerv( GL_MINOR_VERSION, &minor );
+        supported = major > 4 || (major == 4 && minor >= 3)
+                 || tjh_shader_has_extension( "GL_ARB_vertex_attrib_binding" );
+    }
+    return supported == 1;
+}
+
+bool TJH_SHADER_VERTEX_LAYOUT_TYPENAME::init( const TJH_SHADER_TYPENAME& shader, const std::initializer_list<TJH_SHADER_TYPENAME::VertexAttribArrayDesc>& desc_list, GLuint binding )
+{
+    bool success = true;
+    count_ = 0;
+    stride_ = 0;
+    binding_ = binding;
+
+    for( const auto& desc : desc_list )
+    {
+        const GLuint offset = static_cast<GLuint>(stride_);
+        stride_ += static_cast<GLsizei>(TJH_SHADER_TYPENAME::glenum_type_to_size_in_bytes( desc.type ) * desc.count);
+
+        const TJH_SHADER_TYPENAME::AttributeInfo* info = shader.findAttribute( desc.name.c_str() );
+        if( !info )
+        {
+            TJH_SHADER_PRINTF( "ERROR: did not find attribute '%s' in shader program '%i'\n", desc.name.c_str(), shader.getProgram() );
+            success = false;
+            continue;
+        }
+        GLint locations, components;
+        bool integer;
+        if( !tjh_shader_attribute_locations( *info, desc.count, locations, components, integer ) )
+        {
+            success = false;
+            continue;
+        }
+        if( count_ + locations > MAX_ATTRIBUTES )
+        {
+            TJH_SHADER_PRINTF( "ERROR: vertex layout needs more than %i attribute locations\n", MAX_ATTRIBUTES );
+            return false;
+        }
+
+        // Each column of a matrix, or element of an array, is an attribute of its own
+        const GLuint column_size = static_cast<GLuint>(TJH_SHADER_TYPENAME::glenum_type_to_size_in_bytes( desc.type ) * components);
+        for( GLint i = 0; i < locations; i++ )
+        {
+            Attribute& attribute = attributes_[count_++];
+            attribute.location = static_cast<GLuint>(info->location + i);
+            attribute.count = components;
+            attribute.type = desc.type;
+            attribute.normalized = desc.normalized;
+            attribute.integer = integer;
+            attribute.offset = offset + column_size * static_cast<GLuint>(i);
+        }
+    }
+
+    return success;
+}
+
+void TJH_SHADER_VERTEX_LAYOUT_TYPENAME::apply( GLuint vao, GLuint buffer, GLintptr offset ) const
+{
+    glBindVertexArray( vao );
+
+    if( tjh_shader_has_vertex_attrib_binding() )
+    {
+        for( int i = 0; i < count_; i++ )
+        {
+            const Attribute& a = attributes_[i];
+            glEnableVertexAttribArray( a.location );
+            if( a.integer ) {
+                glVertexAttribIFormat( a.location, a.count, a.type, a.offset );
+            }
+            else {
+                glVertexAttribFormat( a.location, a.count, a.type, a.normalized, a.offset );
+            }
+            glVertexAttribBinding( a.location, binding_ );
+        }
+        glBindVertexBuffer( binding_, buffer, offset, stride_ );
+        return;
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+    for( int i = 0; i < count_; i++ )
+    {
+        const Attribute& a = attributes_[i];
+        void* pointer = reinterpret_cast<void*>(static_cast<size_t>(offset) + a.offset);
+        glEnableVertexAttribArray( a.location );
+        if( a.integer ) {
+            glVertexAttribIPointer( a.location, a.count, a.type, stride_, pointer );
+        }
+        else {
+            glVertexAttribPointer( a.location, a.count, a.type, a.normalized, stride_, pointer );
+        }
+    }
+}
+
+void TJH_SHADER_VERTEX_LAYOUT_TYPENAME::setBuffer( GLuint vao, GLuint buffer, GLintptr offset ) const
+{
+    if( tjh_shader_has_vertex_attrib_binding() )
+    {
+        glBindVertexArray( vao );
+        glBindVertexBuffer( binding_, buffer, offset, stride_ );
+        return;
+    }
+
+    // The buffer is part of each attribute's pointer so they all have to be set again
+    apply( vao, buffer, offset );
+}
+
+// PIPELINE /////////////////////////////////////////////////////////////////////
+
+bool TJH_SHADER_PIPELINE_TYPENAME::init()
+{
+    shutdown();
+    glGenProgramPipelines( 1, &pipeline_ );
+    if( pipeline_ == 0 )
+    {
+        TJH_SHADER_PRINTF( "ERROR: could not create program pipeline\n" );
+        return false;
+    }
+    return true;
+}
+
+const GLbitfield TJH_SHADER_PIPELINE_TYPENAME::stage_bits_[TJH_SHADER_PIPELINE_TYPENAME::STAGE_COUNT] = {
+    GL_VERTEX_SHADER_BIT, GL_FRAGMENT_SHADER_BIT, GL_GEOMETRY_SHADER_BIT, GL_COMPUTE_SHADER_BIT };
+
+void TJH_SHADER_PIPELINE_TYPENAME::shutdown()
+{
+    if( pipeline_ ) {
+        glDeleteProgramPipelines( 1, &pipeline_ );
+        pipeline_ = 0;
+    }
+    for( StageSource& source : stage_sources_ ) {
+        source = StageSource();
+    }
+}
+
+bool TJH_SHADER_PIPELINE_TYPENAME::useStages( const TJH_SHADER_TYPENAME& shader )
+{
+    return useStages( shader, shader.getStages() );
+}
+
+bool TJH_SHADER_PIPELINE_TYPENAME::useStages( const TJH_SHADER_TYPENAME& shader, GLbitfield stages )
+{
+    if( !shader.isSeparable() || !shader.isLinked() )
+    {
+        TJH_SHADER_PRINTF( "ERROR: shader program '%i' must be separable and linked to be used in a pipeline\n", shader.getProgram() );
+        return false;
+    }
+    glUseProgramStages( pipeline_, stages & shader.getStages(), shader.getProgram() );
+    for( int i = 0; i < STAGE_COUNT; i++ )
+    {
+        if( stages & shader.getStages() & stage_bits_[i] ) {
+            stage_sources_[i].shader = &shader;
+            stage_sources_[i].program = shader.getProgram();
+        }
+    }
+    return true;
+}
+
+void TJH_SHADER_PIPELINE_TYPENAME::clearStages( GLbitfield stages )
+{
+    glUseProgramStages( pipeline_, stages, 0 );
+    for( int i = 0; i < STAGE_COUNT; i++ )
+    {
+        if( stages & stage_bits_[i] ) {
+            stage_sources_[i] = StageSource();
+        }
+    }
+}
+
+void TJH_SHADER_PIPELINE_TYPENAME::bind() const
+{
+    // A hot reload swaps the shader's program and deletes the old one, reattach any that changed
+    for( int i = 0; i < STAGE_COUNT; i++ )
+    {
+        StageSource& source = stage_sources_[i];
+        if( source.shader && source.shader->getProgram() != source.program )
+        {
+            source.program = source.shader->getProgram();
+            const bool has_stage = (source.shader->getStages() & stage_bits_[i]) != 0;
+            glUseProgramStages( pipeline_, stage_bits_[i], has_stage ? source.program : 0 );
+        }
+    }
+
+    glUseProgram( 0 );
+    glBindProgramPipeline( pipeline_ );
+}
+
+bool TJH_SHADER_PIPELINE_TYPENAME::validate() const
+{
+    glValidateProgramPipeline( pipeline_ );
+
+    GLint status = GL_FALSE;
+    glGetProgramPipelineiv( pipeline_, GL_VALIDATE_STATUS, &status );
+    if( status != GL_TRUE )
+    {
+        GLint log_length = 0;
+        glGetProgramPipelineiv( pipeline_, GL_INFO_LOG_LENGTH, &log_length );
+
+        std::vector<GLchar> buffer( static_cast<size_t>(log_length) + 1, '\0' );
+        glGetProgramPipelineInfoLog( pipeline_, log_length, NULL, buffer.data() );
+
+        TJH_SHADER_PRINTF( "ERROR: validating program pipeline '%i'\n", pipeline_ );
+        TJH_SHADER_PRINTF( "%s", buffer.data() );
+        return false;
+    }
+    return true;
+}
+
 // Prevent the macros from leaking into the global namespace
 #undef PATH_SEPERATOR
 
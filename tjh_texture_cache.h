@@ -72,20 +72,62 @@
 // - write ABOUT documentation
 // - add examples to USAGE documentation
 // - make it so defines can be changed from outside the file
-// - single textures are reloadable
-// - all textures are reloadable
 // - textures can be bound to different slots
 // - report errors
-// - called can request the number of channels
 
 ////// HEADER //////////////////////////////////////////////////////////////////
 
 #include TJH_TEXTURE_CACHE_GLEW_H_LOCATION
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace TJH_TEXTURE_CACHE_NAMESPACE
 {
-    struct TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    // Filenames are interned once so the cache can be indexed by a number rather than by
+    // hashing and comparing strings. Ids are never reused, even after cacheClear().
+    typedef uint32_t PathId;
+    PathId intern( const std::string& filename );
+    const std::string& getPath( PathId path );
+
+    // MIPMAPS AND FORMATS
+    //
+    // Images are stored with the number of channels asked for, as GL_R8, GL_RG8, GL_RGB8 or
+    // GL_RGBA8. One and two channel images are grey and grey + alpha, so they are swizzled
+    // to read back that way. Mipmaps can be made by the driver with glGenerateMipmap, or on
+    // the CPU with a gamma correct box filter which looks better and, with loadAsync(), runs
+    // on the loader threads. Mipmapped textures default to GL_LINEAR_MIPMAP_LINEAR.
+    //
+    // KTX (version 1.1) and DDS files are uploaded as they are, with whatever mip levels
+    // they contain, the channel count and mipmap options don't apply to them. BC1-BC7 and
+    // ETC2/EAC are supported as long as the driver supports them.
+    //
+    // Texture::LoadOptions options;
+    // options.mipmaps = Texture::CPU_MIPMAPS;
+    // Texture::Handle grass = Texture::load( "grass.png", options );
+    // Texture::Handle rock  = Texture::load( "rock_bc7.dds" );
+
+    enum Mipmaps
+    {
+        NO_MIPMAPS,
+        GPU_MIPMAPS,    // glGenerateMipmap
+        CPU_MIPMAPS,    // Box filtered in linear space, slower but sharper than most drivers
+    };
+
+    struct LoadOptions
+    {
+        char channels   = 4;
+        Mipmaps mipmaps = NO_MIPMAPS;
+    };
+
+    // What the cache knows about a texture, shared by every handle to it
+    struct TextureInfo
     {
+        std::string filename = "";
+        PathId path          = 0;
         int width            = -1;
         int height           = -1;
         GLint s_wrap         = GL_CLAMP_TO_EDGE;
@@ -94,17 +136,295 @@ namespace TJH_TEXTURE_CACHE_NAMESPACE
         GLint max_filter     = GL_LINEAR;
         GLuint texture       = 0;
         char channels        = 0;
-        std::string filename = "";
+        Mipmaps mipmaps      = NO_MIPMAPS;
+        GLenum format        = 0;       // Internal format, such as GL_RGBA8 or GL_COMPRESSED_RGBA_BPTC_UNORM
+        bool loading         = false;   // Waiting on loadAsync()
+        bool resident        = false;   // False while loading or evicted, the texture is a 1x1 placeholder
+        int levels           = 1;       // Mip levels allocated
+        size_t bytes         = 0;       // GPU memory the texture is using now, all levels
+        int pins             = 0;
+    };
+
+    // Handles are two integers and cheap to copy around. They refer to an entry in the cache
+    // and carry its generation, so a handle to a texture that was cleared becomes invalid
+    // rather than pointing at whatever reuses its entry.
+    struct TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    {
+        uint32_t index      = 0;
+        uint32_t generation = 0;    // Entries start at 1, so a default handle is never valid
+
+        bool isValid() const;
+        // The entry's info, or the defaults (texture 0) if the handle isn't valid
+        const TextureInfo& info() const;
+        GLuint getTexture() const { return info().texture; }
+        int    getWidth() const   { return info().width; }
+        int    getHeight() const  { return info().height; }
 
-        void bind();
+        // Set on the texture straight away, so they apply to every handle to it
+        void setWrap( GLint s_wrap, GLint t_wrap );
+        void setFilter( GLint min_filter, GLint max_filter );
+
+        // Pinned textures are never evicted, pins are counted so each pin() needs an unpin().
+        // Pinning an evicted texture loads it again straight away.
+        void pin() const;
+        void unpin() const;
+
+        // If it was evicted it's queued to load again, the placeholder is bound until then
+        void bind() const;
     };
-    
+    inline bool operator == ( TJH_TEXTURE_CACHE_HANDLE_TYPENAME a, TJH_TEXTURE_CACHE_HANDLE_TYPENAME b ) { return a.index == b.index && a.generation == b.generation; }
+    inline bool operator != ( TJH_TEXTURE_CACHE_HANDLE_TYPENAME a, TJH_TEXTURE_CACHE_HANDLE_TYPENAME b ) { return !(a == b); }
+
+    // Returns an invalid handle if the image couldn't be loaded
     TJH_TEXTURE_CACHE_HANDLE_TYPENAME
     load( const std::string& filename, char channels = 4);
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( PathId path, char channels = 4 );
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( const std::string& filename, const LoadOptions& options );
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( PathId path, const LoadOptions& options );
 
     void   cacheClear();    // Clear all the textures in the cache
     size_t cacheSize();     // Get the current number of items in the cache
-    void   cacheReload();   // Reload all textures in the cache from their source files
+
+    // HOT RELOADING
+    //
+    // cacheReload() reloads only the textures whose files have changed since they were
+    // loaded, and is cheap enough to call every frame even with thousands of textures in the
+    // cache. Changes are picked up with inotify on Linux, elsewhere (or for files in a
+    // directory inotify couldn't watch) the files' modification times and sizes are polled
+    // at most once every setReloadPollInterval() milliseconds.
+    // The new image is decoded on the loader threads and swapped into the same texture once
+    // it's ready, the old image stays in use until then. cacheReload() also uploads what has
+    // finished decoding, as update() does, so reloads finish even if you don't call that.
+    // Returns the number of textures that started reloading.
+    int  cacheReload();
+    void setReloadPollInterval( int milliseconds );
+    // Reloads one texture in the background whether its file changed or not, returns false
+    // if the handle isn't valid
+    bool reload( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle );
+
+    // ASYNC LOADING
+    //
+    // loadAsync() returns straight away with a handle whose texture holds a 1x1 grey
+    // placeholder. The image is decoded on a pool of worker threads and then uploaded into
+    // that same texture by update(), which you call once a frame on the GL thread. Uploads
+    // go through a ring of pixel buffer objects and stop once the frame's budget is spent,
+    // so a level with thousands of images streams in rather than stalling one frame.
+    //
+    // for( auto& name : level_images ) handles.push_back( Texture::loadAsync( name ) );
+    // ...
+    // Texture::update(); // once a frame
+    //
+    // NOTE: on Linux link with -pthread
+
+    // Called on the GL thread once the image is uploaded, or with ok = false if it failed.
+    // A failed load is dropped from the cache so its handle is no longer valid, and loading
+    // the file again has another go.
+    typedef std::function<void( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle, bool ok )> LoadCallback;
+
+    // Returns the cached handle if the file is already loaded or loading
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( const std::string& filename, char channels = 4, LoadCallback on_loaded = nullptr );
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( PathId path, char channels = 4, LoadCallback on_loaded = nullptr );
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( const std::string& filename, const LoadOptions& options, LoadCallback on_loaded = nullptr );
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( PathId path, const LoadOptions& options, LoadCallback on_loaded = nullptr );
+
+    // Uploads images that have finished decoding until either budget for this call is used,
+    // at least one image is uploaded per call. A budget of 0 is no limit.
+    void update();
+    void setUploadBudget( size_t bytes_per_frame, double milliseconds_per_frame );
+
+    // Decode threads, defaults to one less than the number of cores. Only takes effect
+    // before the first loadAsync() starts the pool.
+    void setLoaderThreadCount( int count );
+
+    // Block until the images are uploaded, ignoring the budget. Returns true if they all loaded.
+    bool wait( const TJH_TEXTURE_CACHE_HANDLE_TYPENAME* handles, size_t count );
+    inline bool wait( std::initializer_list<TJH_TEXTURE_CACHE_HANDLE_TYPENAME> handles ) { return wait( handles.begin(), handles.size() ); }
+    void waitAll();
+
+    bool   isLoaded( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle );  // False while loading or if it failed
+    size_t pendingCount();  // Images still decoding or waiting to upload
+
+    // MEMORY BUDGET
+    //
+    // The cache counts how much memory each texture uses, every mip level included. When the
+    // total goes over the budget the least recently bound textures are evicted: the storage
+    // is swapped for a 1x1 placeholder and the GL name and handles stay valid. Binding an
+    // evicted texture queues it on the loader threads and update() uploads it again, the
+    // placeholder is drawn until then. Frames are counted by update(), and nothing bound in
+    // the current frame is evicted, so a frame that uses more than the budget goes over it
+    // rather than loading the same textures from disk again and again.
+
+    void setMemoryBudget( size_t bytes );   // 0, the default, is no limit
+
+    struct CacheStats
+    {
+        size_t resident_bytes       = 0;
+        size_t budget_bytes         = 0;
+        size_t resident_textures    = 0;
+        size_t evictions            = 0;    // Since the program started
+        size_t reloads              = 0;    // Evicted textures loaded again
+    };
+    const CacheStats& getCacheStats();
+
+    // COOKED CACHE
+    //
+    // Decoding PNGs and JPEGs is slow, and so are CPU mipmaps. Once a cooked cache directory
+    // is set, the first load of an image writes its decoded pixels there. The cooked file is
+    // named after a hash of the source file's contents and the load options, so an edited
+    // image or different options never pick up a stale one. Later loads map the cooked file
+    // into memory and upload straight from it without decoding. KTX and DDS files are ready
+    // to upload already and aren't cooked. examples/tjh_texture_cooker.cpp fills the cache
+    // for a whole asset directory ahead of time.
+    //
+    // Texture::setCookedCacheDirectory( "cooked" );
+
+    // The directory must exist. Empty, the default, turns cooking off.
+    void setCookedCacheDirectory( const std::string& directory );
+    // Decodes the image and writes it to the cooked cache, or does nothing if it's there
+    // already. Doesn't touch the GL so it can be called from any thread. Returns false if
+    // the image couldn't be decoded or written, KTX and DDS files are left as they are.
+    bool cook( const std::string& filename, const LoadOptions& options = LoadOptions() );
+
+    // ATLASES AND ARRAYS
+    //
+    // Binding hundreds of small textures one at a time stops sprites from being batched.
+    // An Atlas packs images into a few large pages as they are added, a TextureArray puts
+    // images of the same size into the layers of GL_TEXTURE_2D_ARRAYs. Either way a batch
+    // can draw many different images with one bind.
+    //
+    // Texture::Atlas icons;
+    // icons.init();
+    // Texture::Region sword = icons.add( "icons/sword.png" );
+    // sword.bind();
+    // ... draw with texcoords from (sword.u0, sword.v0) to (sword.u1, sword.v1)
+    //
+    // Files are decoded the same way load() decodes them, so cooked files are used. Images
+    // loaded with loadAsync() can be packed from its callback as each one arrives:
+    //
+    // Texture::loadAsync( "icons/shield.png", Texture::LoadOptions(), [&]( Texture::Handle handle, bool ok ) {
+    //     if( ok ) shield = icons.add( handle );
+    // });
+    //
+    // Pages and layers are RGBA8 without mipmaps, so compressed KTX and DDS files can't be
+    // added, uncompressed ones can.
+
+    // Where an image ended up
+    struct Region
+    {
+        GLuint texture  = 0;                // 0 if the image couldn't be added
+        GLenum target   = GL_TEXTURE_2D;    // GL_TEXTURE_2D_ARRAY for a TextureArray
+        int page        = -1;               // Index of the atlas page or array texture
+        int layer       = 0;                // Always 0 in an atlas
+        int x           = 0;                // Position and size in pixels
+        int y           = 0;
+        int width       = 0;
+        int height      = 0;
+        float u0        = 0.0f;
+        float v0        = 0.0f;
+        float u1        = 0.0f;
+        float v1        = 0.0f;
+
+        void bind() const { glBindTexture( target, texture ); }
+    };
+
+    // Pages are RGBA8, packed with a skyline bottom-left packer. Images are placed as they
+    // are added and pages are never repacked, so regions handed out stay valid.
+    class Atlas
+    {
+    public:
+        Atlas() {}
+        ~Atlas() { shutdown(); }
+
+        // Owns GL textures, so no copying
+        Atlas( const Atlas& other ) = delete;
+        Atlas& operator = ( const Atlas& other ) = delete;
+
+        // 'padding' pixels around each image are filled with copies of its edge, so linear
+        // filtering at the edge doesn't blend with a neighbour or with transparent black.
+        // The page size is limited to GL_MAX_TEXTURE_SIZE.
+        void init( int page_size = 2048, int padding = 1 );
+        void shutdown();
+
+        // Packs the image into the first page with room, adding a page if none has any.
+        // Adding a name that is already in the atlas returns the region it already has.
+        Region add( const std::string& filename );
+        Region add( PathId path );
+        // Copies the loaded texture in under its filename, reading it back from the GL rather
+        // than decoding the file again. Decodes the file if the texture isn't resident.
+        Region add( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle );
+        Region add( const std::string& name, const unsigned char* rgba, int width, int height );
+
+        int    getPageCount() const { return static_cast<int>(pages_.size()); }
+        GLuint getPageTexture( int page ) const { return pages_[page].texture; }
+        int    getPageSize() const { return page_size_; }
+
+    private:
+        // The skyline is the top edge of everything packed so far, left to right
+        struct SkylineNode {
+            int x;
+            int y;
+            int width;
+        };
+        struct Page {
+            GLuint texture = 0;
+            std::vector<SkylineNode> skyline;
+        };
+
+        // Finds the lowest spot a width x height rectangle fits, returns false if it doesn't
+        bool find_position( const Page& page, int width, int height, int& x, int& y, size_t& node ) const;
+        void add_skyline_level( Page& page, size_t node, int x, int y, int width, int height );
+        void add_page();
+
+        std::vector<Page> pages_;
+        std::unordered_map<std::string, Region> regions_;
+        int page_size_  = 0;
+        int padding_    = 1;
+    };
+
+    // Images are grouped by size, each size gets GL_TEXTURE_2D_ARRAYs of 'layers_per_array'
+    // RGBA8 layers. Every region covers the whole layer, so the UVs are always 0 to 1.
+    class TextureArray
+    {
+    public:
+        TextureArray() {}
+        ~TextureArray() { shutdown(); }
+
+        TextureArray( const TextureArray& other ) = delete;
+        TextureArray& operator = ( const TextureArray& other ) = delete;
+
+        // Layers are allocated up front when an array is created
+        void init( int layers_per_array = 64 );
+        void shutdown();
+
+        // Puts the image in the next free layer of an array its size, creating one if needed.
+        // Handles are copied in as Atlas::add() copies them.
+        Region add( const std::string& filename );
+        Region add( PathId path );
+        Region add( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle );
+        Region add( const std::string& name, const unsigned char* rgba, int width, int height );
+
+        int    getArrayCount() const { return static_cast<int>(arrays_.size()); }
+        GLuint getArrayTexture( int page ) const { return arrays_[page].texture; }
+
+    private:
+        struct Array {
+            GLuint texture  = 0;
+            int width       = 0;
+            int height      = 0;
+            int used        = 0;
+        };
+
+        std::vector<Array> arrays_;
+        std::unordered_map<std::string, Region> regions_;
+        int layers_per_array_ = 64;
+    };
 }
 
 #endif // END HEADER
@@ -114,106 +434,2348 @@ namespace TJH_TEXTURE_CACHE_NAMESPACE
 #ifdef TJH_TEXTURE_CACHE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+// S3TC is an extension so these aren't always in the GL headers
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT         0x83F0
+    #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT        0x83F1
+    #define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT        0x83F2
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT        0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT        0x8C4C
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT  0x8C4D
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT  0x8C4E
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT  0x8C4F
+#endif
 
 namespace TJH_TEXTURE_CACHE_NAMESPACE
 {
     // 'PRIVATE' MEMBER VARIABLES
-    std::map<std::string, TJH_TEXTURE_CACHE_HANDLE_TYPENAME> texture_cache_;
 
-    // LIBRARY FUNCTIONS ///////////////////////////////////////////////////////
-    
-    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
-    load( const std::string& filename, char channels )
+    // Cache entries are kept in a vector and reused through a free list, a handle's index
+    // is the entry's position. The generation is bumped whenever an entry is freed.
+    const uint32_t NO_ENTRY = 0xFFFFFFFF;
+
+    struct CacheEntry
+    {
+        TextureInfo info;
+        uint32_t generation = 1;
+        bool used           = false;
+        std::vector<LoadCallback> callbacks;    // Waiting on an async load
+        // Links in the eviction list, only resident textures that aren't pinned are in it
+        uint32_t lru_prev   = NO_ENTRY;
+        uint32_t lru_next   = NO_ENTRY;
+        bool in_lru         = false;
+        // The file as it was when last read, to spot changes when polling
+        long long modified  = 0;
+        long long file_size = 0;
+        bool watched        = false;    // Changes come from inotify, otherwise it's polled
+        bool reloading      = false;    // A new image is being decoded
+        bool restoring      = false;    // ...because it was evicted and then bound
+        uint64_t bound_frame = 0;       // Frame it was last bound or uploaded in
+        bool reload_again   = false;    // The file changed again while it was
+        LoadOptions options;            // As it was loaded, for reloading
+    };
+    std::vector<CacheEntry> cache_entries_;
+    std::vector<uint32_t> free_entries_;
+    size_t cache_count_ = 0;
+
+    // Most recently bound at the head, evictions come off the tail
+    uint32_t lru_head_ = NO_ENTRY;
+    uint32_t lru_tail_ = NO_ENTRY;
+    CacheStats cache_stats_;
+    uint64_t frame_ = 0;    // Counted by update()
+
+    // inotify descriptor (-1 before it's opened, -2 if it isn't available) and the directory
+    // each watch descriptor is looking at, as it appears at the front of the filenames
+    int inotify_fd_ = -1;
+    std::unordered_map<int, std::string> inotify_dirs_;
+    int reload_poll_interval_ms_ = 250;
+
+    // Interned paths, and for each path the entry it's cached in plus one (0 if it isn't)
+    std::unordered_map<std::string, PathId> path_ids_;
+    std::vector<std::string> paths_;
+    std::vector<uint32_t> entry_by_path_;
+
+    // Async loading, the job and decoded queues are shared with the worker threads and
+    // guarded by loader_mutex_, everything else is only touched on the GL thread
+    // Decoded pixels or the contents of a compressed texture file, every mip level one
+    // after the other
+    struct Image
+    {
+        unsigned char* data         = nullptr;  // Freed with stbi_image_free, unless it's mapped
+        void* mapping               = nullptr;  // A cooked file mapped into memory, data points into it
+        size_t mapping_size         = 0;
+        size_t size                 = 0;
+        int width                   = 0;
+        int height                  = 0;
+        int levels                  = 1;
+        char channels               = 0;
+        GLenum compressed_format    = 0;        // 0 if it's uncompressed
+    };
+
+    struct DecodeJob
+    {
+        std::string filename;
+        LoadOptions options;
+        uint32_t index;
+        uint32_t generation;
+    };
+    struct DecodedImage
+    {
+        Image image;
+        bool ok             = false;
+        uint32_t index      = 0;        // Entry it's for, ignored if the generation no longer matches
+        uint32_t generation = 0;
+    };
+    struct LoaderThreads
+    {
+        std::vector<std::thread> threads;
+        ~LoaderThreads();
+    };
+
+    std::mutex loader_mutex_;
+    std::condition_variable jobs_ready_;
+    std::condition_variable images_ready_;
+    std::deque<DecodeJob> decode_jobs_;
+    std::deque<DecodedImage> decoded_images_;
+    bool stop_loader_threads_ = false;
+    LoaderThreads loader_threads_;
+    int loader_thread_count_ = 0;
+    size_t pending_count_ = 0;
+
+    size_t upload_budget_bytes_ = 8 * 1024 * 1024;
+    double upload_budget_ms_    = 2.0;
+    GLuint upload_buffers_[3]   = {};
+    int next_upload_buffer_     = 0;
+
+    // Cooked images are a header padded to 64 bytes followed by every level
+    const uint32_t COOKED_VERSION       = 1;
+    const uint32_t COOKED_HEADER_BYTES  = 64;
+    struct CookedHeader
     {
-        auto it = texture_cache_.find(filename);
-        if( it != texture_cache_.end() )
+        char magic[8];              // "TJHTEX\r\n"
+        uint32_t version;
+        uint32_t header_bytes;
+        uint64_t key;               // Hash of the source file and load options
+        uint64_t data_bytes;
+        int32_t width;
+        int32_t height;
+        int32_t levels;
+        int32_t channels;
+        uint32_t compressed_format;
+        uint32_t mipmaps;
+    };
+    // Read by the loader threads, so it's guarded
+    std::mutex cooked_mutex_;
+    std::string cooked_directory_;
+
+    // Returns the entry the handle refers to, or null if it's stale
+    CacheEntry* find_entry( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle )
+    {
+        if( handle.index >= cache_entries_.size() )
         {
-            // Return a copy of the version in the cache
-            TJH_TEXTURE_CACHE_PRINTF( "Retrieved '%s' from the cache.\n", filename.c_str() );
-            return it->second;
+            return nullptr;
+        }
+        CacheEntry& entry = cache_entries_[handle.index];
+        return (entry.used && entry.generation == handle.generation) ? &entry : nullptr;
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle_for_entry( uint32_t index )
+    {
+        TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle;
+        handle.index = index;
+        handle.generation = cache_entries_[index].generation;
+        return handle;
+    }
+
+    bool read_file_stamp( const std::string& filename, long long& modified, long long& size )
+    {
+        struct stat info;
+        if( stat( filename.c_str(), &info ) != 0 )
+        {
+            return false;
+        }
+        modified = static_cast<long long>(info.st_mtime);
+        size = static_cast<long long>(info.st_size);
+        return true;
+    }
+
+    // Watches the directory the file is in, rather than the file, as editors often save by
+    // replacing the file. Returns false if it can't be watched (no inotify, or out of
+    // watches) and the file has to be polled instead.
+    bool watch_directory( const std::string& filename )
+    {
+#ifdef __linux__
+        if( inotify_fd_ == -1 )
+        {
+            inotify_fd_ = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+            if( inotify_fd_ == -1 )
+            {
+                inotify_fd_ = -2;
+            }
+        }
+        if( inotify_fd_ < 0 )
+        {
+            return false;
+        }
+
+        const size_t slash = filename.find_last_of( '/' );
+        const std::string dir = slash == std::string::npos ? "" : filename.substr( 0, slash + 1 );
+        for( const auto& watched : inotify_dirs_ )
+        {
+            if( watched.second == dir )
+            {
+                return true;
+            }
+        }
+
+        const int wd = inotify_add_watch( inotify_fd_, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+        if( wd == -1 )
+        {
+            return false;
+        }
+        inotify_dirs_[wd] = dir;
+        return true;
+#else
+        (void)filename;
+        return false;
+#endif
+    }
+
+    // Falls back to polling for every entry in the directory
+    void unwatch_directory( const std::string& dir )
+    {
+        for( CacheEntry& entry : cache_entries_ )
+        {
+            const std::string& filename = entry.info.filename;
+            if( entry.used && filename.compare( 0, dir.size(), dir ) == 0 &&
+                filename.find( '/', dir.size() ) == std::string::npos )
+            {
+                entry.watched = false;
+            }
+        }
+    }
+
+    // NOTE: may grow cache_entries_, so references into it don't survive this
+    uint32_t add_entry( PathId path, const LoadOptions& options )
+    {
+        uint32_t index;
+        if( !free_entries_.empty() )
+        {
+            index = free_entries_.back();
+            free_entries_.pop_back();
         }
         else
         {
-            // Load the texture in anew
-            TJH_TEXTURE_CACHE_HANDLE_TYPENAME result;
-            result.channels = channels;
-            result.filename = filename;
+            index = static_cast<uint32_t>(cache_entries_.size());
+            cache_entries_.emplace_back();
+        }
+
+        CacheEntry& entry = cache_entries_[index];
+        entry.used = true;
+        entry.info = TextureInfo();
+        entry.info.filename = paths_[path];
+        entry.info.path = path;
+        entry.info.channels = options.channels;
+        entry.info.mipmaps = options.mipmaps;
+        if( options.mipmaps != NO_MIPMAPS )
+        {
+            entry.info.min_filter = GL_LINEAR_MIPMAP_LINEAR;
+        }
+        entry.options = options;
+        entry.reloading = false;
+        entry.restoring = false;
+        entry.reload_again = false;
+        entry.bound_frame = frame_;
+        entry_by_path_[path] = index + 1;
+        cache_count_++;
+        read_file_stamp( entry.info.filename, entry.modified, entry.file_size );
+        entry.watched = watch_directory( entry.info.filename );
+        return index;
+    }
+
+    // Sets the info's wrap and filter modes on the texture, which must be bound
+    void apply_parameters( const TextureInfo& info )
+    {
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, info.s_wrap );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, info.t_wrap );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, info.min_filter );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, info.max_filter );
+    }
+
+    // FORMATS /////////////////////////////////////////////////////////////////
 
-            unsigned char* data = nullptr;
-            int n; // This is the number of channels that the image originally had, currently we don't care
+    // Block compressed formats, all of them use 4x4 blocks
+    struct CompressedFormat
+    {
+        GLenum format;
+        int block_bytes;
+        char channels;
+    };
+    const CompressedFormat compressed_formats_[] =
+    {
+        { GL_COMPRESSED_RGB_S3TC_DXT1_EXT,                  8, 3 },
+        { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,                 8, 4 },
+        { GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,                16, 4 },
+        { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,                16, 4 },
+        { GL_COMPRESSED_SRGB_S3TC_DXT1_EXT,                 8, 3 },
+        { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,           8, 4 },
+        { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,          16, 4 },
+        { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,          16, 4 },
+        { GL_COMPRESSED_RED_RGTC1,                          8, 1 },
+        { GL_COMPRESSED_SIGNED_RED_RGTC1,                   8, 1 },
+        { GL_COMPRESSED_RG_RGTC2,                          16, 2 },
+        { GL_COMPRESSED_SIGNED_RG_RGTC2,                   16, 2 },
+        { GL_COMPRESSED_RGBA_BPTC_UNORM,                   16, 4 },
+        { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,             16, 4 },
+        { GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT,             16, 3 },
+        { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,           16, 3 },
+        { GL_COMPRESSED_RGB8_ETC2,                          8, 3 },
+        { GL_COMPRESSED_SRGB8_ETC2,                         8, 3 },
+        { GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,      8, 4 },
+        { GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,     8, 4 },
+        { GL_COMPRESSED_RGBA8_ETC2_EAC,                    16, 4 },
+        { GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,             16, 4 },
+        { GL_COMPRESSED_R11_EAC,                            8, 1 },
+        { GL_COMPRESSED_SIGNED_R11_EAC,                     8, 1 },
+        { GL_COMPRESSED_RG11_EAC,                          16, 2 },
+        { GL_COMPRESSED_SIGNED_RG11_EAC,                   16, 2 },
+    };
 
-            data = stbi_load( filename.c_str(), &result.width, &result.height, &n, result.channels );
-            if( !data )
+    const CompressedFormat* find_compressed_format( GLenum format )
+    {
+        for( const CompressedFormat& compressed : compressed_formats_ )
+        {
+            if( compressed.format == format )
             {
-                TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", filename.c_str() );
-                return result;
+                return &compressed;
             }
+        }
+        return nullptr;
+    }
 
-            // TODO: error checking if the texture failed to gen
-            glGenTextures( 1, &result.texture );
-            glBindTexture( GL_TEXTURE_2D, result.texture );
+    int full_mip_count( int width, int height )
+    {
+        int levels = 1;
+        for( int size = std::max( width, height ); size > 1; size /= 2 )
+        {
+            levels++;
+        }
+        return levels;
+    }
 
-            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA,
-                result.width, result.height,
-                0, GL_RGBA, GL_UNSIGNED_BYTE, data );
+    // Bytes of one level as it is in the Image
+    size_t level_bytes( const Image& image, int level )
+    {
+        const size_t width = static_cast<size_t>(std::max( 1, image.width >> level ));
+        const size_t height = static_cast<size_t>(std::max( 1, image.height >> level ));
+        if( image.compressed_format )
+        {
+            const CompressedFormat* format = find_compressed_format( image.compressed_format );
+            return ((width + 3) / 4) * ((height + 3) / 4) * static_cast<size_t>(format->block_bytes);
+        }
+        return width * height * static_cast<size_t>(image.channels);
+    }
 
-            stbi_image_free(data);
+    // What the texture takes up on the GPU, assuming drivers pad RGB8 out to four bytes
+    size_t texture_bytes( const Image& image, int levels )
+    {
+        size_t bytes = 0;
+        for( int level = 0; level < levels; level++ )
+        {
+            bytes += level_bytes( image, level );
+            if( !image.compressed_format && image.channels == 3 )
+            {
+                bytes += level_bytes( image, level ) / 3;
+            }
+        }
+        return bytes;
+    }
 
-            texture_cache_[filename] = result;
-            TJH_TEXTURE_CACHE_PRINTF( "Added '%s' to the texture cache.\n", filename.c_str() );
+    GLenum internal_format( const Image& image )
+    {
+        static const GLenum formats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        if( image.compressed_format )
+        {
+            return image.compressed_format;
+        }
+        return (image.channels >= 1 && image.channels <= 4) ? formats[image.channels - 1] : GL_RGBA8;
+    }
 
-            return result;
+    void free_image( Image& image )
+    {
+        if( image.mapping )
+        {
+#ifndef _WIN32
+            munmap( image.mapping, image.mapping_size );
+#endif
+            image.mapping = nullptr;
+        }
+        else
+        {
+            stbi_image_free( image.data );
         }
+        image.data = nullptr;
     }
 
-    void cacheClear()
+    // Checks the driver can take the image's size and format
+    bool can_upload( const Image& image, const std::string& filename )
     {
-        // Iterate over the entire map and delete all the textures
-        for( const auto& t : texture_cache_ )
+        static GLint max_size = 0;
+        if( max_size == 0 )
+        {
+            glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_size );
+        }
+        if( max_size > 0 && (image.width > max_size || image.height > max_size) )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is %ix%i, bigger than the driver's largest texture (%i)\n",
+                                      filename.c_str(), image.width, image.height, max_size );
+            return false;
+        }
+        if( !image.compressed_format )
+        {
+            return true;
+        }
+
+        static std::vector<GLint> supported;
+        if( supported.empty() )
+        {
+            GLint count = 0;
+            glGetIntegerv( GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count );
+            supported.resize( static_cast<size_t>(std::max( count, 0 )) + 1, 0 );
+            glGetIntegerv( GL_COMPRESSED_TEXTURE_FORMATS, supported.data() );
+        }
+        if( std::find( supported.begin(), supported.end(), static_cast<GLint>(image.compressed_format) ) != supported.end() )
         {
-            glDeleteTextures( 1, &t.second.texture );
+            return true;
         }
-        // Then clear the map itself
-        texture_cache_.clear();
+
+        TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is in compressed format 0x%04X which the driver doesn't support\n",
+                                  filename.c_str(), image.compressed_format );
+        return false;
     }
 
-    size_t cacheSize()
+    uint32_t read_u32( const unsigned char* bytes )
     {
-        return texture_cache_.size();
+        uint32_t value;
+        memcpy( &value, bytes, 4 );
+        return value;
     }
 
-    void cacheReload()
+    // No GL goes past this, so anything bigger is a corrupt header. The driver's real limit
+    // is checked by can_upload() on the GL thread.
+    const int MAX_IMAGE_SIZE = 65536;
+
+    // Copies every level from 'file' once the format and size are known, 'level_prefix' is
+    // the size KTX puts in front of each level
+    bool copy_levels( const unsigned char* file, size_t file_size, size_t offset, bool level_prefix, const std::string& filename, Image& image )
     {
-        for( auto& t : texture_cache_ )
+        // The header's sizes come straight from the file, so don't trust them
+        if( image.width < 1 || image.height < 1 || image.width > MAX_IMAGE_SIZE || image.height > MAX_IMAGE_SIZE ||
+            image.levels < 1 || image.levels > full_mip_count( image.width, image.height ) )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' has a bad size (%ix%i with %i levels)\n",
+                                      filename.c_str(), image.width, image.height, image.levels );
+            return false;
+        }
+
+        image.size = 0;
+        for( int level = 0; level < image.levels; level++ )
+        {
+            image.size += level_bytes( image, level );
+        }
+        if( offset > file_size || image.size > file_size - offset )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is truncated or its levels are the wrong size\n", filename.c_str() );
+            return false;
+        }
+        image.data = static_cast<unsigned char*>(STBI_MALLOC( image.size ));
+        if( !image.data )
         {
-            unsigned char* data = nullptr;
-            int n;
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: out of memory loading '%s'\n", filename.c_str() );
+            return false;
+        }
 
-            data = stbi_load( t.second.filename.c_str(), &t.second.width, &t.second.height, &n, t.second.channels );
-            if( !data )
+        size_t copied = 0;
+        for( int level = 0; level < image.levels; level++ )
+        {
+            const size_t bytes = level_bytes( image, level );
+            if( level_prefix )
             {
-                TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", t.second.filename.c_str() );
-                continue;
+                if( offset + 4 > file_size || read_u32( file + offset ) != bytes )
+                {
+                    break;
+                }
+                offset += 4;
             }
+            if( offset + bytes > file_size )
+            {
+                break;
+            }
+            memcpy( image.data + copied, file + offset, bytes );
+            copied += bytes;
+            offset += level_prefix ? (bytes + 3) & ~static_cast<size_t>(3) : bytes;
+        }
+
+        if( copied != image.size )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is truncated or its levels are the wrong size\n", filename.c_str() );
+            free_image( image );
+            return false;
+        }
+        return true;
+    }
+
+    bool read_ktx( const unsigned char* file, size_t size, const std::string& filename, Image& image )
+    {
+        if( size < 64 || read_u32( file + 12 ) != 0x04030201 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is not a little endian KTX file\n", filename.c_str() );
+            return false;
+        }
+        if( read_u32( file + 44 ) > 1 || read_u32( file + 48 ) > 0 || read_u32( file + 52 ) != 1 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is not a 2D texture, only 2D KTX files are supported\n", filename.c_str() );
+            return false;
+        }
+
+        const uint32_t type = read_u32( file + 16 );
+        const uint32_t format = read_u32( file + 24 );
+        const uint32_t internal = read_u32( file + 28 );
+        image.width = static_cast<int>(read_u32( file + 36 ));
+        image.height = static_cast<int>(std::max<uint32_t>( 1, read_u32( file + 40 ) ));
+        image.levels = static_cast<int>(std::max<uint32_t>( 1, read_u32( file + 56 ) ));
+
+        if( type == 0 && find_compressed_format( internal ) )
+        {
+            image.compressed_format = internal;
+            image.channels = find_compressed_format( internal )->channels;
+        }
+        else if( type == GL_UNSIGNED_BYTE && format == GL_RGBA )
+        {
+            image.channels = 4;
+        }
+        else
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' has format 0x%04X, KTX files must be RGBA8 or a supported compressed format\n",
+                                      filename.c_str(), internal );
+            return false;
+        }
+
+        return copy_levels( file, size, 64 + read_u32( file + 60 ), true, filename, image );
+    }
 
-            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA,
-                t.second.width, t.second.height,
-                0, GL_RGBA, GL_UNSIGNED_BYTE, data );
+    bool read_dds( const unsigned char* file, size_t size, const std::string& filename, Image& image )
+    {
+        if( size < 128 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is truncated\n", filename.c_str() );
+            return false;
+        }
+
+        auto four_cc = []( const char* code ) {
+            return static_cast<uint32_t>(code[0]) | static_cast<uint32_t>(code[1]) << 8 |
+                   static_cast<uint32_t>(code[2]) << 16 | static_cast<uint32_t>(code[3]) << 24;
+        };
 
-            stbi_image_free(data);
+        const uint32_t flags = read_u32( file + 8 );
+        image.height = static_cast<int>(read_u32( file + 12 ));
+        image.width = static_cast<int>(read_u32( file + 16 ));
+        image.levels = (flags & 0x20000) ? static_cast<int>(std::max<uint32_t>( 1, read_u32( file + 28 ) )) : 1;
+        bool cube_or_volume = (read_u32( file + 112 ) & 0x200) || ((flags & 0x800000) && read_u32( file + 24 ) > 1);
+
+        const uint32_t pixel_flags = read_u32( file + 80 );
+        const uint32_t code = read_u32( file + 84 );
+        size_t offset = 128;
+        GLenum format = 0;
+        bool rgba8 = false;
+
+        if( pixel_flags & 0x4 )
+        {
+            if(      code == four_cc( "DXT1" ) )                            format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+            else if( code == four_cc( "DXT3" ) )                            format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+            else if( code == four_cc( "DXT5" ) )                            format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            else if( code == four_cc( "ATI1" ) || code == four_cc( "BC4U" ) ) format = GL_COMPRESSED_RED_RGTC1;
+            else if( code == four_cc( "BC4S" ) )                            format = GL_COMPRESSED_SIGNED_RED_RGTC1;
+            else if( code == four_cc( "ATI2" ) || code == four_cc( "BC5U" ) ) format = GL_COMPRESSED_RG_RGTC2;
+            else if( code == four_cc( "BC5S" ) )                            format = GL_COMPRESSED_SIGNED_RG_RGTC2;
+            else if( code == four_cc( "DX10" ) && size >= 148 )
+            {
+                // The extended header names a DXGI_FORMAT, which is how BC6H and BC7 are stored
+                offset = 148;
+                if( read_u32( file + 132 ) != 3 || (read_u32( file + 136 ) & 0x4) || read_u32( file + 140 ) > 1 )
+                {
+                    cube_or_volume = true;
+                }
+                switch( read_u32( file + 128 ) )
+                {
+                    case 28: rgba8 = true; break;
+                    case 71: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+                    case 72: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+                    case 74: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+                    case 75: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; break;
+                    case 77: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+                    case 78: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+                    case 80: format = GL_COMPRESSED_RED_RGTC1; break;
+                    case 81: format = GL_COMPRESSED_SIGNED_RED_RGTC1; break;
+                    case 83: format = GL_COMPRESSED_RG_RGTC2; break;
+                    case 84: format = GL_COMPRESSED_SIGNED_RG_RGTC2; break;
+                    case 95: format = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; break;
+                    case 96: format = GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; break;
+                    case 98: format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+                    case 99: format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+                    default: break;
+                }
+            }
+        }
+        else if( (pixel_flags & 0x40) && read_u32( file + 88 ) == 32 && read_u32( file + 92 ) == 0xFF &&
+                 read_u32( file + 96 ) == 0xFF00 && read_u32( file + 100 ) == 0xFF0000 && read_u32( file + 104 ) == 0xFF000000 )
+        {
+            rgba8 = true;
+        }
 
-            TJH_TEXTURE_CACHE_PRINTF( "Reloaded '%s'.\n", t.second.filename.c_str() );
+        if( cube_or_volume )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is not a 2D texture, only 2D DDS files are supported\n", filename.c_str() );
+            return false;
+        }
+        if( !format && !rgba8 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is in a DDS format that isn't supported\n", filename.c_str() );
+            return false;
         }
+
+        image.compressed_format = format;
+        image.channels = format ? find_compressed_format( format )->channels : 4;
+        return copy_levels( file, size, offset, false, filename, image );
     }
 
-    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::bind()
+    // Lookup tables to go between sRGB and linear, 12 bits is plenty on the way back
+    struct SrgbTables
+    {
+        float to_linear[256];
+        unsigned char from_linear[4096];
+
+        SrgbTables()
+        {
+            for( int i = 0; i < 256; i++ )
+            {
+                const float c = i / 255.0f;
+                to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow( (c + 0.055f) / 1.055f, 2.4f );
+            }
+            for( int i = 0; i < 4096; i++ )
+            {
+                const float l = i / 4095.0f;
+                const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow( l, 1.0f / 2.4f ) - 0.055f;
+                from_linear[i] = static_cast<unsigned char>(c * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    // Replaces the image's single level with a full mip chain. Each level averages 2x2
+    // pixels of the one above, colour in linear space so the smaller levels don't darken,
+    // alpha as it is.
+    void generate_mipmaps( Image& image )
     {
-        glBindTexture( GL_TEXTURE_2D, texture );
-        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, s_wrap );
-        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, t_wrap );
-        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter );
-        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, max_filter );
+        static const SrgbTables tables;
+
+        Image mipmapped = image;
+        mipmapped.levels = full_mip_count( image.width, image.height );
+        mipmapped.size = 0;
+        for( int level = 0; level < mipmapped.levels; level++ )
+        {
+            mipmapped.size += level_bytes( mipmapped, level );
+        }
+        mipmapped.data = static_cast<unsigned char*>(STBI_MALLOC( mipmapped.size ));
+        memcpy( mipmapped.data, image.data, level_bytes( image, 0 ) );
+
+        const int channels = image.channels;
+        const int alpha = (channels == 2 || channels == 4) ? channels - 1 : -1;
+        const unsigned char* source = mipmapped.data;
+        unsigned char* destination = mipmapped.data + level_bytes( mipmapped, 0 );
+
+        for( int level = 1; level < mipmapped.levels; level++ )
+        {
+            const int source_width = std::max( 1, image.width >> (level - 1) );
+            const int source_height = std::max( 1, image.height >> (level - 1) );
+            const int width = std::max( 1, image.width >> level );
+            const int height = std::max( 1, image.height >> level );
+
+            for( int y = 0; y < height; y++ )
+            {
+                const unsigned char* row0 = source + static_cast<size_t>(std::min( y * 2, source_height - 1 )) * source_width * channels;
+                const unsigned char* row1 = source + static_cast<size_t>(std::min( y * 2 + 1, source_height - 1 )) * source_width * channels;
+                for( int x = 0; x < width; x++ )
+                {
+                    const int x0 = std::min( x * 2, source_width - 1 ) * channels;
+                    const int x1 = std::min( x * 2 + 1, source_width - 1 ) * channels;
+                    unsigned char* out = destination + (static_cast<size_t>(y) * width + x) * channels;
+                    for( int c = 0; c < channels; c++ )
+                    {
+                        if( c == alpha )
+                        {
+                            out[c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                            continue;
+                        }
+                        const float linear = (tables.to_linear[row0[x0 + c]] + tables.to_linear[row0[x1 + c]] +
+                                              tables.to_linear[row1[x0 + c]] + tables.to_linear[row1[x1 + c]]) * 0.25f;
+                        out[c] = tables.from_linear[static_cast<int>(linear * 4095.0f + 0.5f)];
+                    }
+                }
+            }
+
+            source = destination;
+            destination += level_bytes( mipmapped, level );
+        }
+
+        free_image( image );
+        image = mipmapped;
+    }
+
+    bool read_file( const std::string& filename, std::vector<unsigned char>& contents )
+    {
+        FILE* file = fopen( filename.c_str(), "rb" );
+        if( !file )
+        {
+            return false;
+        }
+        contents.clear();
+        if( fseek( file, 0, SEEK_END ) == 0 )
+        {
+            const long size = ftell( file );
+            if( size > 0 && fseek( file, 0, SEEK_SET ) == 0 )
+            {
+                contents.resize( static_cast<size_t>(size) );
+                contents.resize( fread( contents.data(), 1, contents.size(), file ) );
+            }
+        }
+        fclose( file );
+        return true;
+    }
+
+    // FNV-1a over eight bytes at a time, plenty to tell files apart without slowing loads down
+    uint64_t hash_bytes( const unsigned char* bytes, size_t size, uint64_t hash = 0xCBF29CE484222325ull )
+    {
+        const uint64_t prime = 0x100000001B3ull;
+        size_t i = 0;
+        for( ; i + 8 <= size; i += 8 )
+        {
+            uint64_t word;
+            memcpy( &word, bytes + i, 8 );
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 32;
+        }
+        for( ; i < size; i++ )
+        {
+            hash = (hash ^ bytes[i]) * prime;
+        }
+        return hash;
+    }
+
+    // Works out where the cooked copy of an image lives, returns false if cooking is off
+    bool cooked_path( const std::vector<unsigned char>& contents, const LoadOptions& options, std::string& path, uint64_t& key )
+    {
+        {
+            std::lock_guard<std::mutex> lock( cooked_mutex_ );
+            path = cooked_directory_;
+        }
+        if( path.empty() )
+        {
+            return false;
+        }
+
+        const unsigned char settings[] = { static_cast<unsigned char>(options.channels),
+                                           static_cast<unsigned char>(options.mipmaps),
+                                           static_cast<unsigned char>(COOKED_VERSION) };
+        key = hash_bytes( settings, sizeof(settings), hash_bytes( contents.data(), contents.size() ) );
+
+        char name[32];
+        snprintf( name, sizeof(name), "%016llx.tex", static_cast<unsigned long long>(key) );
+        if( path.back() != '/' && path.back() != '\\' )
+        {
+            path += '/';
+        }
+        path += name;
+        return true;
+    }
+
+    // Checks a cooked file is whole and is the one asked for, and fills in the image from
+    // its header. The image's data is left pointing at the levels in 'bytes'. The image is
+    // only changed if every check passes.
+    bool read_cooked_header( const unsigned char* bytes, size_t size, uint64_t key, Image& image )
+    {
+        CookedHeader header;
+        if( size < COOKED_HEADER_BYTES )
+        {
+            return false;
+        }
+        memcpy( &header, bytes, sizeof(header) );
+        if( memcmp( header.magic, "TJHTEX\r\n", 8 ) != 0 || header.version != COOKED_VERSION ||
+            header.header_bytes != COOKED_HEADER_BYTES || header.key != key ||
+            header.data_bytes != size - COOKED_HEADER_BYTES || header.width < 1 || header.height < 1 ||
+            header.levels < 1 || header.levels > full_mip_count( header.width, header.height ) ||
+            header.channels < 1 || header.channels > 4 ||
+            (header.compressed_format && !find_compressed_format( header.compressed_format )) )
+        {
+            return false;
+        }
+
+        Image cooked;
+        cooked.width = header.width;
+        cooked.height = header.height;
+        cooked.levels = header.levels;
+        cooked.channels = static_cast<char>(header.channels);
+        cooked.compressed_format = header.compressed_format;
+        cooked.size = 0;
+        for( int level = 0; level < cooked.levels; level++ )
+        {
+            cooked.size += level_bytes( cooked, level );
+        }
+        if( cooked.size != header.data_bytes )
+        {
+            return false;
+        }
+
+        cooked.data = const_cast<unsigned char*>(bytes) + COOKED_HEADER_BYTES;
+        cooked.mapping = image.mapping;
+        cooked.mapping_size = image.mapping_size;
+        image = cooked;
+        return true;
+    }
+
+    bool read_cooked( const std::string& path, uint64_t key, Image& image )
+    {
+#ifndef _WIN32
+        const int file = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if( file == -1 )
+        {
+            return false;
+        }
+        struct stat status;
+        void* mapping = MAP_FAILED;
+        if( fstat( file, &status ) == 0 && status.st_size >= static_cast<off_t>(COOKED_HEADER_BYTES) )
+        {
+            mapping = mmap( nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0 );
+        }
+        close( file );
+        if( mapping == MAP_FAILED )
+        {
+            return false;
+        }
+
+        image.mapping = mapping;
+        image.mapping_size = static_cast<size_t>(status.st_size);
+        if( !read_cooked_header( static_cast<const unsigned char*>(mapping), image.mapping_size, key, image ) )
+        {
+            free_image( image );
+            return false;
+        }
+        return true;
+#else
+        // No mmap here, so the levels are read into memory of their own
+        std::vector<unsigned char> contents;
+        if( !read_file( path, contents ) || !read_cooked_header( contents.data(), contents.size(), key, image ) )
+        {
+            image.data = nullptr;
+            return false;
+        }
+        unsigned char* data = static_cast<unsigned char*>(STBI_MALLOC( image.size ));
+        memcpy( data, image.data, image.size );
+        image.data = data;
+        return true;
+#endif
+    }
+
+    // Written to a temporary file and renamed into place, so a crash or another process
+    // cooking the same image never leaves a half written file behind
+    bool write_cooked( const std::string& path, uint64_t key, const LoadOptions& options, const Image& image )
+    {
+        unsigned char block[COOKED_HEADER_BYTES] = {};
+        CookedHeader header;
+        memcpy( header.magic, "TJHTEX\r\n", 8 );
+        header.version = COOKED_VERSION;
+        header.header_bytes = COOKED_HEADER_BYTES;
+        header.key = key;
+        header.data_bytes = image.size;
+        header.width = image.width;
+        header.height = image.height;
+        header.levels = image.levels;
+        header.channels = image.channels;
+        header.compressed_format = image.compressed_format;
+        header.mipmaps = static_cast<uint32_t>(options.mipmaps);
+        memcpy( block, &header, sizeof(header) );
+
+        const std::string temporary = path + "." +
+            std::to_string( std::hash<std::thread::id>()( std::this_thread::get_id() ) ) + "." +
+            std::to_string( std::chrono::steady_clock::now().time_since_epoch().count() );
+        FILE* file = fopen( temporary.c_str(), "wb" );
+        if( !file )
+        {
+            return false;
+        }
+        bool ok = fwrite( block, 1, sizeof(block), file ) == sizeof(block) &&
+                  fwrite( image.data, 1, image.size, file ) == image.size;
+        ok = (fclose( file ) == 0) && ok;
+
+        // If someone else got there first their file is just as good
+        if( !ok || rename( temporary.c_str(), path.c_str() ) != 0 )
+        {
+            remove( temporary.c_str() );
+            struct stat status;
+            return ok && stat( path.c_str(), &status ) == 0;
+        }
+        return true;
+    }
+
+    // Reads the file and decodes it, or copies the levels out if it's a KTX or DDS file.
+    // Safe to call from the loader threads, the GL isn't touched. 'cook_failed' is set if
+    // the image should have gone in the cooked cache but couldn't be written.
+    bool decode_image( const std::string& filename, const LoadOptions& options, Image& image, bool* cook_failed = nullptr )
+    {
+        image = Image();
+        if( cook_failed )
+        {
+            *cook_failed = false;
+        }
+
+        std::vector<unsigned char> contents;
+        if( !read_file( filename, contents ) )
+        {
+            return false;
+        }
+
+        static const unsigned char ktx_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        if( contents.size() >= 12 && memcmp( contents.data(), ktx_identifier, 12 ) == 0 )
+        {
+            return read_ktx( contents.data(), contents.size(), filename, image );
+        }
+        if( contents.size() >= 4 && memcmp( contents.data(), "DDS ", 4 ) == 0 )
+        {
+            return read_dds( contents.data(), contents.size(), filename, image );
+        }
+
+        // Pixels cooked by an earlier load are uploaded as they are
+        std::string cooked_file;
+        uint64_t key = 0;
+        const bool cooking = cooked_path( contents, options, cooked_file, key );
+        if( cooking && read_cooked( cooked_file, key, image ) )
+        {
+            return true;
+        }
+        image = Image();
+
+        int n; // This is the number of channels that the image originally had, currently we don't care
+        image.data = stbi_load_from_memory( contents.data(), static_cast<int>(contents.size()),
+                                            &image.width, &image.height, &n, options.channels );
+        if( !image.data )
+        {
+            return false;
+        }
+        image.channels = options.channels;
+        image.size = level_bytes( image, 0 );
+
+        if( options.mipmaps == CPU_MIPMAPS )
+        {
+            generate_mipmaps( image );
+        }
+
+        if( cooking && !write_cooked( cooked_file, key, options, image ) )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to write cooked image '%s' for '%s'\n", cooked_file.c_str(), filename.c_str() );
+            if( cook_failed )
+            {
+                *cook_failed = true;
+            }
+        }
+        return true;
+    }
+
+    // Uploads every level of the image into the info's texture, returns the number of levels
+    // the texture ends up with. 'pixels' is the image's data, or null to read it from the
+    // start of the bound GL_PIXEL_UNPACK_BUFFER.
+    int upload_image( TextureInfo& info, const Image& image, const unsigned char* pixels )
+    {
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+        glBindTexture( GL_TEXTURE_2D, info.texture );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+        size_t offset = 0;
+        for( int level = 0; level < image.levels; level++ )
+        {
+            const GLsizei width = std::max( 1, image.width >> level );
+            const GLsizei height = std::max( 1, image.height >> level );
+            const size_t bytes = level_bytes( image, level );
+            const void* level_pixels = reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(pixels) + offset);
+            if( image.compressed_format )
+            {
+                glCompressedTexImage2D( GL_TEXTURE_2D, level, image.compressed_format, width, height, 0, static_cast<GLsizei>(bytes), level_pixels );
+            }
+            else
+            {
+                glTexImage2D( GL_TEXTURE_2D, level, internal_format( image ), width, height, 0, formats[image.channels - 1], GL_UNSIGNED_BYTE, level_pixels );
+            }
+            offset += bytes;
+        }
+
+        int levels = image.levels;
+        if( info.mipmaps == GPU_MIPMAPS && levels == 1 && !image.compressed_format )
+        {
+            glGenerateMipmap( GL_TEXTURE_2D );
+            levels = full_mip_count( image.width, image.height );
+        }
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+
+        // Files that come with their own mipmaps get the same filtering as generated ones
+        if( levels > 1 && info.levels == 1 && info.min_filter == GL_LINEAR )
+        {
+            info.min_filter = GL_LINEAR_MIPMAP_LINEAR;
+        }
+        apply_parameters( info );
+
+        // Grey and grey + alpha read back as grey rather than red
+        const GLint grey[4]       = { GL_RED, GL_RED, GL_RED, GL_ONE };
+        const GLint grey_alpha[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+        const GLint identity[4]   = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+        const bool uncompressed = !image.compressed_format;
+        glTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                          uncompressed && image.channels == 1 ? grey : uncompressed && image.channels == 2 ? grey_alpha : identity );
+
+        return levels;
+    }
+
+    const unsigned char placeholder_pixel_[4] = { 128, 128, 128, 255 };
+
+    // Swaps the texture's storage for a single grey pixel, freeing the other levels
+    void upload_placeholder( TextureInfo& info )
+    {
+        const GLint identity[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+
+        glBindTexture( GL_TEXTURE_2D, info.texture );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        for( int level = 1; level < info.levels; level++ )
+        {
+            glTexImage2D( GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+        }
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder_pixel_ );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+        glTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, identity );
+        info.levels = 1;
+        info.bytes = 4;
+    }
+
+    void lru_unlink( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        if( !entry.in_lru )
+        {
+            return;
+        }
+        if( entry.lru_prev != NO_ENTRY ) cache_entries_[entry.lru_prev].lru_next = entry.lru_next;
+        else                             lru_head_ = entry.lru_next;
+        if( entry.lru_next != NO_ENTRY ) cache_entries_[entry.lru_next].lru_prev = entry.lru_prev;
+        else                             lru_tail_ = entry.lru_prev;
+        entry.lru_prev = entry.lru_next = NO_ENTRY;
+        entry.in_lru = false;
+    }
+
+    // Moves the entry to the front of the eviction list, if it's allowed to be evicted at all
+    void lru_touch( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        if( lru_head_ == index || !entry.info.resident || entry.info.pins > 0 )
+        {
+            return;
+        }
+        lru_unlink( index );
+        entry.lru_next = lru_head_;
+        if( lru_head_ != NO_ENTRY ) cache_entries_[lru_head_].lru_prev = index;
+        lru_head_ = index;
+        if( lru_tail_ == NO_ENTRY ) lru_tail_ = index;
+        entry.in_lru = true;
+    }
+
+    // Records what the texture takes up now that the image is in it
+    void set_resident( uint32_t index, const Image& image, int levels )
+    {
+        TextureInfo& info = cache_entries_[index].info;
+        if( info.resident )
+        {
+            cache_stats_.resident_bytes -= info.bytes;
+        }
+        else
+        {
+            cache_stats_.resident_textures++;
+        }
+
+        info.width = image.width;
+        info.height = image.height;
+        info.channels = image.channels;
+        info.format = internal_format( image );
+        info.levels = levels;
+        info.bytes = texture_bytes( image, levels );
+        info.resident = true;
+        cache_stats_.resident_bytes += info.bytes;
+        cache_entries_[index].bound_frame = frame_;
+        lru_touch( index );
+    }
+
+    void evict( uint32_t index )
+    {
+        TextureInfo& info = cache_entries_[index].info;
+        lru_unlink( index );
+
+        cache_stats_.resident_bytes -= info.bytes;
+        cache_stats_.resident_textures--;
+        cache_stats_.evictions++;
+        upload_placeholder( info );
+        info.resident = false;
+    }
+
+    // Deletes the texture and hands the entry back, handles to it become invalid and the
+    // next load of the path starts again
+    void free_entry( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        lru_unlink( index );
+        if( entry.info.resident )
+        {
+            cache_stats_.resident_bytes -= entry.info.bytes;
+            cache_stats_.resident_textures--;
+        }
+        glDeleteTextures( 1, &entry.info.texture );
+        entry_by_path_[entry.info.path] = 0;
+        entry.used = false;
+        entry.generation++;
+        entry.info = TextureInfo();
+        entry.callbacks.clear();
+        free_entries_.push_back( index );
+        cache_count_--;
+    }
+
+    // Stops at the first texture used this frame, everything before it in the list is newer
+    void enforce_memory_budget()
+    {
+        while( cache_stats_.budget_bytes && cache_stats_.resident_bytes > cache_stats_.budget_bytes &&
+               lru_tail_ != NO_ENTRY && cache_entries_[lru_tail_].bound_frame != frame_ )
+        {
+            evict( lru_tail_ );
+        }
+    }
+
+    // Loads an evicted texture back in from its file straight away
+    void reload_evicted( uint32_t index )
+    {
+        TextureInfo& info = cache_entries_[index].info;
+        Image image;
+        if( !decode_image( info.filename, cache_entries_[index].options, image ) || !can_upload( image, info.filename ) )
+        {
+            free_image( image );
+            // Leave the placeholder in rather than trying again on every bind
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to reload evicted image '%s'\n", info.filename.c_str() );
+            info.resident = true;
+            cache_stats_.resident_textures++;
+            cache_stats_.resident_bytes += info.bytes;
+            return;
+        }
+
+        const int levels = upload_image( info, image, image.data );
+        free_image( image );
+        cache_stats_.reloads++;
+        read_file_stamp( info.filename, cache_entries_[index].modified, cache_entries_[index].file_size );
+
+        set_resident( index, image, levels );
+        enforce_memory_budget();
+    }
+
+    void start_loader_threads();
+
+    void push_reload_job( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        read_file_stamp( entry.info.filename, entry.modified, entry.file_size );
+        entry.reloading = true;
+        pending_count_++;
+
+        start_loader_threads();
+        {
+            std::lock_guard<std::mutex> lock( loader_mutex_ );
+            decode_jobs_.push_back( DecodeJob{ entry.info.filename, entry.options, index, entry.generation } );
+        }
+        jobs_ready_.notify_one();
+    }
+
+    void queue_reload( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        if( entry.info.loading || entry.reloading )
+        {
+            // Whatever is being decoded may be from before the change
+            entry.reload_again = true;
+            return;
+        }
+        if( !entry.info.resident )
+        {
+            // Evicted, it'll be read from disk when it's next bound anyway
+            read_file_stamp( entry.info.filename, entry.modified, entry.file_size );
+            return;
+        }
+        push_reload_job( index );
+    }
+
+    // Brings an evicted texture back in the background, the placeholder is used until then
+    void queue_restore( uint32_t index )
+    {
+        CacheEntry& entry = cache_entries_[index];
+        if( entry.info.loading || entry.reloading )
+        {
+            return;
+        }
+        entry.restoring = true;
+        push_reload_job( index );
+    }
+
+    // Adds the entries whose files have changed to 'changed'
+    void find_changed_entries( std::vector<uint32_t>& changed )
+    {
+        auto add_path = [&changed]( const std::string& filename ) {
+            auto path = path_ids_.find( filename );
+            if( path == path_ids_.end() || !entry_by_path_[path->second] )
+            {
+                return;
+            }
+            const uint32_t index = entry_by_path_[path->second] - 1;
+            if( std::find( changed.begin(), changed.end(), index ) == changed.end() )
+            {
+                changed.push_back( index );
+            }
+        };
+
+#ifdef __linux__
+        if( inotify_fd_ >= 0 && !inotify_dirs_.empty() )
+        {
+            // One non blocking read, usually there's nothing there
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length = 0;
+            while( (length = read( inotify_fd_, buffer, sizeof(buffer) )) > 0 )
+            {
+                for( ssize_t offset = 0; offset < length; )
+                {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+                    auto dir = inotify_dirs_.find( event->wd );
+                    if( event->len > 0 && dir != inotify_dirs_.end() )
+                    {
+                        add_path( dir->second + event->name );
+                    }
+                    else if( (event->mask & IN_IGNORED) && dir != inotify_dirs_.end() )
+                    {
+                        // The directory was deleted or unmounted and took the watch with it,
+                        // poll the files that were in it from now on
+                        unwatch_directory( dir->second );
+                        inotify_dirs_.erase( dir );
+                    }
+                    offset += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+#endif
+
+        // Files without notifications (no inotify, or it ran out of watches) have their
+        // modification times checked every now and again
+        static std::chrono::steady_clock::time_point last_poll;
+        const auto now = std::chrono::steady_clock::now();
+        if( now - last_poll < std::chrono::milliseconds( reload_poll_interval_ms_ ) )
+        {
+            return;
+        }
+        last_poll = now;
+
+        for( uint32_t i = 0; i < cache_entries_.size(); i++ )
+        {
+            const CacheEntry& entry = cache_entries_[i];
+            long long modified, size;
+            if( entry.used && !entry.watched && read_file_stamp( entry.info.filename, modified, size ) &&
+                (modified != entry.modified || size != entry.file_size) &&
+                std::find( changed.begin(), changed.end(), i ) == changed.end() )
+            {
+                changed.push_back( i );
+            }
+        }
+    }
+
+    void loader_thread_main()
+    {
+        while( true )
+        {
+            DecodeJob job;
+            {
+                std::unique_lock<std::mutex> lock( loader_mutex_ );
+                jobs_ready_.wait( lock, []{ return stop_loader_threads_ || !decode_jobs_.empty(); } );
+                if( stop_loader_threads_ )
+                {
+                    return;
+                }
+                job = std::move( decode_jobs_.front() );
+                decode_jobs_.pop_front();
+            }
+
+            DecodedImage decoded;
+            decoded.ok = decode_image( job.filename, job.options, decoded.image );
+            decoded.index = job.index;
+            decoded.generation = job.generation;
+
+            {
+                std::lock_guard<std::mutex> lock( loader_mutex_ );
+                decoded_images_.push_back( decoded );
+            }
+            images_ready_.notify_all();
+        }
+    }
+
+    LoaderThreads::~LoaderThreads()
+    {
+        {
+            std::lock_guard<std::mutex> lock( loader_mutex_ );
+            stop_loader_threads_ = true;
+        }
+        jobs_ready_.notify_all();
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+        for( DecodedImage& decoded : decoded_images_ )
+        {
+            free_image( decoded.image );
+        }
+    }
+
+    void start_loader_threads()
+    {
+        if( !loader_threads_.threads.empty() )
+        {
+            return;
+        }
+
+        int count = loader_thread_count_;
+        if( count <= 0 )
+        {
+            count = std::max( 1, static_cast<int>(std::thread::hardware_concurrency()) - 1 );
+        }
+        for( int i = 0; i < count; i++ )
+        {
+            loader_threads_.threads.emplace_back( loader_thread_main );
+        }
+    }
+
+    // Copies the image into the next buffer in the ring and uploads from there, the driver
+    // can then return before the copy into the texture is done
+    void upload_decoded_image( DecodedImage& decoded )
+    {
+        const TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle = { decoded.index, decoded.generation };
+        CacheEntry* entry = find_entry( handle );
+        if( !entry || !(entry->info.loading || entry->reloading) )
+        {
+            free_image( decoded.image );
+            return;
+        }
+
+        TextureInfo& info = entry->info;
+        Image& image = decoded.image;
+        const bool reloaded = entry->reloading && !entry->restoring;
+        const bool ok = decoded.ok && can_upload( image, info.filename );
+        if( ok )
+        {
+            if( !upload_buffers_[0] )
+            {
+                glGenBuffers( 3, upload_buffers_ );
+            }
+
+            int levels = 0;
+            const GLsizeiptr size = static_cast<GLsizeiptr>(image.size);
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, upload_buffers_[next_upload_buffer_] );
+            next_upload_buffer_ = (next_upload_buffer_ + 1) % 3;
+            glBufferData( GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW );
+            void* mapped = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+            if( mapped )
+            {
+                memcpy( mapped, image.data, image.size );
+                glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+                levels = upload_image( info, image, nullptr );
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+            }
+            else
+            {
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+                levels = upload_image( info, image, image.data );
+            }
+
+            free_image( image );
+            if( entry->restoring )  cache_stats_.reloads++;
+            else if( reloaded )     TJH_TEXTURE_CACHE_PRINTF( "Reloaded '%s'.\n", info.filename.c_str() );
+            else                    TJH_TEXTURE_CACHE_PRINTF( "Added '%s' to the texture cache.\n", info.filename.c_str() );
+
+            set_resident( decoded.index, image, levels );
+            enforce_memory_budget();
+        }
+        else if( entry->restoring && !info.resident )
+        {
+            // Leave the placeholder in rather than trying again on every bind
+            free_image( image );
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to reload evicted image '%s'\n", info.filename.c_str() );
+            info.resident = true;
+            cache_stats_.resident_textures++;
+            cache_stats_.resident_bytes += info.bytes;
+        }
+        else
+        {
+            // A failed reload keeps the old image, a failed first load is dropped below
+            free_image( image );
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", info.filename.c_str() );
+        }
+        const bool failed_load = !ok && info.loading;
+        info.loading = false;
+        entry->reloading = false;
+        entry->restoring = false;
+        pending_count_--;
+
+        if( entry->reload_again && !failed_load )
+        {
+            entry->reload_again = false;
+            queue_reload( decoded.index );
+        }
+
+        // Callbacks may load more textures and move the entries, so take them out first
+        std::vector<LoadCallback> callbacks = std::move( entry->callbacks );
+        entry->callbacks.clear();
+
+        // Don't leave an empty texture in the cache, so loading the path again has another go
+        if( failed_load )
+        {
+            free_entry( decoded.index );
+        }
+
+        for( LoadCallback& callback : callbacks )
+        {
+            callback( handle, ok );
+        }
+    }
+
+    // Uploads images that have finished decoding until the upload budget is used
+    void upload_decoded_images()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        size_t bytes = 0;
+
+        while( true )
+        {
+            DecodedImage decoded;
+            {
+                std::lock_guard<std::mutex> lock( loader_mutex_ );
+                if( decoded_images_.empty() )
+                {
+                    return;
+                }
+                decoded = decoded_images_.front();
+                decoded_images_.pop_front();
+            }
+
+            bytes += decoded.image.size;
+            upload_decoded_image( decoded );
+
+            const double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+            if( (upload_budget_bytes_ && bytes >= upload_budget_bytes_) || (upload_budget_ms_ > 0.0 && ms >= upload_budget_ms_) )
+            {
+                return;
+            }
+        }
+    }
+
+    // Waits for the next decoded image and uploads it, returns false if nothing is in flight
+    bool upload_next_decoded_image()
+    {
+        if( pending_count_ == 0 )
+        {
+            return false;
+        }
+
+        DecodedImage decoded;
+        {
+            std::unique_lock<std::mutex> lock( loader_mutex_ );
+            images_ready_.wait( lock, []{ return !decoded_images_.empty(); } );
+            decoded = decoded_images_.front();
+            decoded_images_.pop_front();
+        }
+        upload_decoded_image( decoded );
+        return true;
+    }
+
+    // LIBRARY FUNCTIONS ///////////////////////////////////////////////////////
+
+    PathId intern( const std::string& filename )
+    {
+        auto it = path_ids_.find( filename );
+        if( it != path_ids_.end() )
+        {
+            return it->second;
+        }
+
+        const PathId path = static_cast<PathId>(paths_.size());
+        paths_.push_back( filename );
+        entry_by_path_.push_back( 0 );
+        path_ids_[filename] = path;
+        return path;
+    }
+
+    const std::string& getPath( PathId path )
+    {
+        return paths_[path];
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( const std::string& filename, char channels )
+    {
+        LoadOptions options;
+        options.channels = channels;
+        return load( intern( filename ), options );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( PathId path, char channels )
+    {
+        LoadOptions options;
+        options.channels = channels;
+        return load( path, options );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( const std::string& filename, const LoadOptions& options )
+    {
+        return load( intern( filename ), options );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    load( PathId path, const LoadOptions& options )
+    {
+        const uint32_t cached = entry_by_path_[path];
+        if( cached )
+        {
+            TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle = handle_for_entry( cached - 1 );
+
+            // Still loading in the background, finish it off now
+            if( cache_entries_[cached - 1].info.loading )
+            {
+                wait( &handle, 1 );
+            }
+            return handle;
+        }
+
+        // Load the texture in anew
+        const std::string& filename = paths_[path];
+        Image image;
+        if( !decode_image( filename, options, image ) || !can_upload( image, filename ) )
+        {
+            free_image( image );
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", filename.c_str() );
+            return TJH_TEXTURE_CACHE_HANDLE_TYPENAME();
+        }
+
+        const uint32_t index = add_entry( path, options );
+        TextureInfo& info = cache_entries_[index].info;
+
+        // TODO: error checking if the texture failed to gen
+        glGenTextures( 1, &info.texture );
+        const int levels = upload_image( info, image, image.data );
+
+        free_image( image );
+
+        TJH_TEXTURE_CACHE_PRINTF( "Added '%s' to the texture cache.\n", filename.c_str() );
+
+        set_resident( index, image, levels );
+        enforce_memory_budget();
+        return handle_for_entry( index );
+    }
+
+    void cacheClear()
+    {
+        // Drop anything still loading, the loader threads finish what they're on and it's
+        // thrown away when it turns up
+        {
+            std::lock_guard<std::mutex> lock( loader_mutex_ );
+            decode_jobs_.clear();
+            for( DecodedImage& decoded : decoded_images_ )
+            {
+                free_image( decoded.image );
+            }
+            decoded_images_.clear();
+        }
+        pending_count_ = 0;
+        if( upload_buffers_[0] )
+        {
+            glDeleteBuffers( 3, upload_buffers_ );
+            upload_buffers_[0] = upload_buffers_[1] = upload_buffers_[2] = 0;
+        }
+
+        // Delete all the textures and free every entry, bumping the generation makes any
+        // handles still out there invalid
+        free_entries_.clear();
+        for( uint32_t i = 0; i < cache_entries_.size(); i++ )
+        {
+            CacheEntry& entry = cache_entries_[i];
+            if( entry.used )
+            {
+                glDeleteTextures( 1, &entry.info.texture );
+                entry.used = false;
+                entry.generation++;
+                entry.info = TextureInfo();
+                entry.callbacks.clear();
+            }
+            entry.lru_prev = entry.lru_next = NO_ENTRY;
+            entry.in_lru = false;
+            free_entries_.push_back( i );
+        }
+        // Hand the lowest indices out first
+        std::reverse( free_entries_.begin(), free_entries_.end() );
+        std::fill( entry_by_path_.begin(), entry_by_path_.end(), 0 );
+        cache_count_ = 0;
+        lru_head_ = lru_tail_ = NO_ENTRY;
+        cache_stats_.resident_bytes = 0;
+        cache_stats_.resident_textures = 0;
+    }
+
+    size_t cacheSize()
+    {
+        return cache_count_;
+    }
+
+    int cacheReload()
+    {
+        std::vector<uint32_t> changed;
+        find_changed_entries( changed );
+
+        int started = 0;
+        for( uint32_t index : changed )
+        {
+            const bool was_reloading = cache_entries_[index].reloading;
+            queue_reload( index );
+            if( !was_reloading && cache_entries_[index].reloading )
+            {
+                started++;
+            }
+        }
+
+        upload_decoded_images();
+        return started;
+    }
+
+    void setReloadPollInterval( int milliseconds )
+    {
+        reload_poll_interval_ms_ = milliseconds;
+    }
+
+    bool reload( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle )
+    {
+        if( !find_entry( handle ) )
+        {
+            return false;
+        }
+        queue_reload( handle.index );
+        return true;
+    }
+
+    bool TJH_TEXTURE_CACHE_HANDLE_TYPENAME::isValid() const
+    {
+        return find_entry( *this ) != nullptr;
+    }
+
+    const TextureInfo& TJH_TEXTURE_CACHE_HANDLE_TYPENAME::info() const
+    {
+        static const TextureInfo invalid;
+        const CacheEntry* entry = find_entry( *this );
+        return entry ? entry->info : invalid;
+    }
+
+    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::setWrap( GLint s_wrap, GLint t_wrap )
+    {
+        CacheEntry* entry = find_entry( *this );
+        if( !entry )
+        {
+            return;
+        }
+        entry->info.s_wrap = s_wrap;
+        entry->info.t_wrap = t_wrap;
+        glBindTexture( GL_TEXTURE_2D, entry->info.texture );
+        apply_parameters( entry->info );
+    }
+
+    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::setFilter( GLint min_filter, GLint max_filter )
+    {
+        CacheEntry* entry = find_entry( *this );
+        if( !entry )
+        {
+            return;
+        }
+        entry->info.min_filter = min_filter;
+        entry->info.max_filter = max_filter;
+        glBindTexture( GL_TEXTURE_2D, entry->info.texture );
+        apply_parameters( entry->info );
+    }
+
+    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::pin() const
+    {
+        CacheEntry* entry = find_entry( *this );
+        if( !entry )
+        {
+            return;
+        }
+        if( entry->info.pins++ == 0 )
+        {
+            lru_unlink( index );
+        }
+        if( !entry->info.resident && !entry->info.loading )
+        {
+            reload_evicted( index );
+        }
+    }
+
+    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::unpin() const
+    {
+        CacheEntry* entry = find_entry( *this );
+        if( !entry || entry->info.pins == 0 )
+        {
+            return;
+        }
+        if( --entry->info.pins == 0 )
+        {
+            lru_touch( index );
+            enforce_memory_budget();
+        }
+    }
+
+    void TJH_TEXTURE_CACHE_HANDLE_TYPENAME::bind() const
+    {
+        CacheEntry* entry = find_entry( *this );
+        if( !entry )
+        {
+            glBindTexture( GL_TEXTURE_2D, 0 );
+            return;
+        }
+
+        if( !entry->info.resident )
+        {
+            queue_restore( index );
+        }
+        entry->bound_frame = frame_;
+        lru_touch( index );
+
+        // The parameters are already on the texture, so this is all binding costs
+        glBindTexture( GL_TEXTURE_2D, entry->info.texture );
+    }
+
+    void setMemoryBudget( size_t bytes )
+    {
+        cache_stats_.budget_bytes = bytes;
+        enforce_memory_budget();
+    }
+
+    const CacheStats& getCacheStats()
+    {
+        return cache_stats_;
+    }
+
+    // COOKED CACHE ////////////////////////////////////////////////////////////
+
+    void setCookedCacheDirectory( const std::string& directory )
+    {
+        std::lock_guard<std::mutex> lock( cooked_mutex_ );
+        cooked_directory_ = directory;
+    }
+
+    bool cook( const std::string& filename, const LoadOptions& options )
+    {
+        {
+            std::lock_guard<std::mutex> lock( cooked_mutex_ );
+            if( cooked_directory_.empty() )
+            {
+                TJH_TEXTURE_CACHE_PRINTF( "ERROR: can't cook '%s', there's no cooked cache directory\n", filename.c_str() );
+                return false;
+            }
+        }
+
+        Image image;
+        bool cook_failed = false;
+        if( !decode_image( filename, options, image, &cook_failed ) )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", filename.c_str() );
+            return false;
+        }
+        free_image( image );
+        return !cook_failed;
+    }
+
+    // ASYNC LOADING ///////////////////////////////////////////////////////////
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( const std::string& filename, char channels, LoadCallback on_loaded )
+    {
+        LoadOptions options;
+        options.channels = channels;
+        return loadAsync( intern( filename ), options, std::move( on_loaded ) );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( PathId path, char channels, LoadCallback on_loaded )
+    {
+        LoadOptions options;
+        options.channels = channels;
+        return loadAsync( path, options, std::move( on_loaded ) );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( const std::string& filename, const LoadOptions& options, LoadCallback on_loaded )
+    {
+        return loadAsync( intern( filename ), options, std::move( on_loaded ) );
+    }
+
+    TJH_TEXTURE_CACHE_HANDLE_TYPENAME
+    loadAsync( PathId path, const LoadOptions& options, LoadCallback on_loaded )
+    {
+        const uint32_t cached = entry_by_path_[path];
+        if( cached )
+        {
+            const TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle = handle_for_entry( cached - 1 );
+            CacheEntry& entry = cache_entries_[cached - 1];
+            if( entry.info.loading )
+            {
+                if( on_loaded )
+                {
+                    entry.callbacks.push_back( std::move( on_loaded ) );
+                }
+            }
+            else if( on_loaded )
+            {
+                on_loaded( handle, entry.info.width > 0 );
+            }
+            return handle;
+        }
+
+        // The texture name is handed out now and never changes, the placeholder is
+        // replaced by the real image when it's uploaded
+        const uint32_t index = add_entry( path, options );
+        CacheEntry& entry = cache_entries_[index];
+        entry.info.loading = true;
+        glGenTextures( 1, &entry.info.texture );
+        upload_placeholder( entry.info );
+        apply_parameters( entry.info );
+        if( on_loaded )
+        {
+            entry.callbacks.push_back( std::move( on_loaded ) );
+        }
+        pending_count_++;
+
+        start_loader_threads();
+        {
+            std::lock_guard<std::mutex> lock( loader_mutex_ );
+            decode_jobs_.push_back( DecodeJob{ paths_[path], options, index, entry.generation } );
+        }
+        jobs_ready_.notify_one();
+
+        return handle_for_entry( index );
+    }
+
+    void update()
+    {
+        // Textures bound last frame can be evicted now
+        frame_++;
+        enforce_memory_budget();
+        upload_decoded_images();
+    }
+
+    void setUploadBudget( size_t bytes_per_frame, double milliseconds_per_frame )
+    {
+        upload_budget_bytes_ = bytes_per_frame;
+        upload_budget_ms_ = milliseconds_per_frame;
+    }
+
+    void setLoaderThreadCount( int count )
+    {
+        loader_thread_count_ = count;
+    }
+
+    bool wait( const TJH_TEXTURE_CACHE_HANDLE_TYPENAME* handles, size_t count )
+    {
+        auto any_pending = [&]() {
+            for( size_t i = 0; i < count; i++ )
+            {
+                const CacheEntry* entry = find_entry( handles[i] );
+                if( entry && (entry->info.loading || entry->reloading) )
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+        while( any_pending() && upload_next_decoded_image() ) {}
+
+        bool all_loaded = true;
+        for( size_t i = 0; i < count; i++ )
+        {
+            all_loaded = isLoaded( handles[i] ) && all_loaded;
+        }
+        return all_loaded;
+    }
+
+    void waitAll()
+    {
+        while( upload_next_decoded_image() ) {}
+    }
+
+    bool isLoaded( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle )
+    {
+        const CacheEntry* entry = find_entry( handle );
+        return entry && !entry->info.loading && entry->info.width > 0;
+    }
+
+    size_t pendingCount()
+    {
+        return pending_count_;
+    }
+
+    // ATLAS ///////////////////////////////////////////////////////////////////
+
+    // Decodes a file for an atlas or texture array, which only hold RGBA8. Uses the same
+    // options as a default load() so the same cooked file is shared.
+    bool decode_rgba( PathId path, Image& image )
+    {
+        const std::string& filename = getPath( path );
+        if( !decode_image( filename, LoadOptions(), image ) )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: failed to load image '%s'\n", filename.c_str() );
+            free_image( image );
+            return false;
+        }
+        if( image.compressed_format || image.channels != 4 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is compressed, only RGBA8 images can be added to atlases and arrays\n", filename.c_str() );
+            free_image( image );
+            return false;
+        }
+        return true;
+    }
+
+    // Reads the top level of a loaded texture back as RGBA8, decoding the file instead if
+    // the texture is still loading or was evicted. Grey images are expanded to grey RGB.
+    bool read_rgba( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle, std::vector<unsigned char>& rgba )
+    {
+        if( !handle.isValid() )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: can't add an invalid handle to an atlas or array\n" );
+            return false;
+        }
+
+        const TextureInfo& info = handle.info();
+        if( !info.resident )
+        {
+            Image image;
+            if( !decode_rgba( info.path, image ) )
+            {
+                return false;
+            }
+            rgba.assign( image.data, image.data + level_bytes( image, 0 ) );
+            free_image( image );
+            return true;
+        }
+        if( find_compressed_format( info.format ) || info.channels < 1 || info.channels > 4 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is compressed, only RGBA8 images can be added to atlases and arrays\n", info.filename.c_str() );
+            return false;
+        }
+
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        const size_t pixels = static_cast<size_t>(info.width) * info.height;
+        std::vector<unsigned char> read( pixels * info.channels );
+        glBindTexture( GL_TEXTURE_2D, info.texture );
+        glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+        glGetTexImage( GL_TEXTURE_2D, 0, formats[info.channels - 1], GL_UNSIGNED_BYTE, read.data() );
+
+        rgba.resize( pixels * 4 );
+        for( size_t i = 0; i < pixels; i++ )
+        {
+            const unsigned char* in = &read[i * info.channels];
+            unsigned char* out = &rgba[i * 4];
+            const bool grey = info.channels < 3;
+            out[0] = in[0];
+            out[1] = grey ? in[0] : in[1];
+            out[2] = grey ? in[0] : in[2];
+            out[3] = info.channels == 2 ? in[1] : info.channels == 4 ? in[3] : 255;
+        }
+        return true;
+    }
+
+    void Atlas::init( int page_size, int padding )
+    {
+        shutdown();
+
+        GLint max_size = 0;
+        glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_size );
+        page_size_ = (max_size > 0 && page_size > max_size) ? max_size : page_size;
+        padding_ = padding;
+    }
+
+    void Atlas::shutdown()
+    {
+        for( const Page& page : pages_ )
+        {
+            glDeleteTextures( 1, &page.texture );
+        }
+        pages_.clear();
+        regions_.clear();
+    }
+
+    Region Atlas::add( const std::string& filename )
+    {
+        return add( intern( filename ) );
+    }
+
+    Region Atlas::add( PathId path )
+    {
+        auto it = regions_.find( getPath( path ) );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        Image image;
+        if( !decode_rgba( path, image ) )
+        {
+            return Region();
+        }
+        Region result = add( getPath( path ), image.data, image.width, image.height );
+        free_image( image );
+        return result;
+    }
+
+    Region Atlas::add( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle )
+    {
+        auto it = regions_.find( handle.info().filename );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        std::vector<unsigned char> rgba;
+        if( !read_rgba( handle, rgba ) )
+        {
+            return Region();
+        }
+        return add( handle.info().filename, rgba.data(), handle.info().width, handle.info().height );
+    }
+
+    Region Atlas::add( const std::string& name, const unsigned char* rgba, int width, int height )
+    {
+        auto it = regions_.find( name );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        if( !rgba || width < 1 || height < 1 )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' has no pixels to add to the atlas\n", name.c_str() );
+            return Region();
+        }
+
+        const int padded_width  = width + padding_ * 2;
+        const int padded_height = height + padding_ * 2;
+        if( padded_width > page_size_ || padded_height > page_size_ )
+        {
+            TJH_TEXTURE_CACHE_PRINTF( "ERROR: '%s' is %ix%i, too big for %ix%i atlas pages\n",
+                                      name.c_str(), width, height, page_size_, page_size_ );
+            return Region();
+        }
+
+        // Try the pages we have before starting a new one
+        int x = 0, y = 0;
+        size_t node = 0;
+        size_t page_index = 0;
+        while( page_index < pages_.size() && !find_position( pages_[page_index], padded_width, padded_height, x, y, node ) )
+        {
+            page_index++;
+        }
+        if( page_index == pages_.size() )
+        {
+            add_page();
+            find_position( pages_[page_index], padded_width, padded_height, x, y, node );
+        }
+
+        Page& page = pages_[page_index];
+        add_skyline_level( page, node, x, y, padded_width, padded_height );
+
+        Region region;
+        region.texture  = page.texture;
+        region.target   = GL_TEXTURE_2D;
+        region.page     = static_cast<int>(page_index);
+        region.x        = x + padding_;
+        region.y        = y + padding_;
+        region.width    = width;
+        region.height   = height;
+        region.u0       = static_cast<float>(region.x) / page_size_;
+        region.v0       = static_cast<float>(region.y) / page_size_;
+        region.u1       = static_cast<float>(region.x + width) / page_size_;
+        region.v1       = static_cast<float>(region.y + height) / page_size_;
+
+        // The padding repeats the nearest edge texel, corners included
+        std::vector<unsigned char> padded( static_cast<size_t>(padded_width) * padded_height * 4 );
+        for( int row = 0; row < padded_height; row++ )
+        {
+            const int source_row = std::min( std::max( row - padding_, 0 ), height - 1 );
+            const unsigned char* source = rgba + static_cast<size_t>(source_row) * width * 4;
+            unsigned char* destination = &padded[static_cast<size_t>(row) * padded_width * 4];
+            for( int column = 0; column < padding_; column++ )
+            {
+                memcpy( destination + column * 4, source, 4 );
+                memcpy( destination + (padding_ + width + column) * 4, source + (width - 1) * 4, 4 );
+            }
+            memcpy( destination + padding_ * 4, source, static_cast<size_t>(width) * 4 );
+        }
+
+        glBindTexture( GL_TEXTURE_2D, page.texture );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, padded_width, padded_height, GL_RGBA, GL_UNSIGNED_BYTE, padded.data() );
+
+        regions_[name] = region;
+        return region;
+    }
+
+    bool Atlas::find_position( const Page& page, int width, int height, int& x, int& y, size_t& node ) const
+    {
+        // Bottom-left: the spot where the top of the rectangle ends up lowest, ties go to
+        // the narrower skyline segment so wide gaps are saved for wide images
+        int best_top = page_size_ + 1;
+        int best_width = page_size_ + 1;
+        bool found = false;
+
+        for( size_t i = 0; i < page.skyline.size(); i++ )
+        {
+            const int left = page.skyline[i].x;
+            if( left + width > page_size_ )
+            {
+                break;
+            }
+
+            // The rectangle rests on the highest segment under it
+            int top = 0;
+            int remaining = width;
+            for( size_t j = i; remaining > 0; j++ )
+            {
+                top = std::max( top, page.skyline[j].y );
+                remaining -= page.skyline[j].width;
+            }
+            if( top + height > page_size_ )
+            {
+                continue;
+            }
+
+            if( top + height < best_top || (top + height == best_top && page.skyline[i].width < best_width) )
+            {
+                best_top = top + height;
+                best_width = page.skyline[i].width;
+                x = left;
+                y = top;
+                node = i;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void Atlas::add_skyline_level( Page& page, size_t node, int x, int y, int width, int height )
+    {
+        std::vector<SkylineNode>& skyline = page.skyline;
+        skyline.insert( skyline.begin() + node, SkylineNode{ x, y + height, width } );
+
+        // Trim or remove the segments now under the new one
+        for( size_t i = node + 1; i < skyline.size(); )
+        {
+            const int covered = skyline[i - 1].x + skyline[i - 1].width - skyline[i].x;
+            if( covered <= 0 )
+            {
+                break;
+            }
+            if( covered < skyline[i].width )
+            {
+                skyline[i].x += covered;
+                skyline[i].width -= covered;
+                break;
+            }
+            skyline.erase( skyline.begin() + i );
+        }
+
+        // Join neighbours at the same height
+        for( size_t i = 0; i + 1 < skyline.size(); )
+        {
+            if( skyline[i].y == skyline[i + 1].y )
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase( skyline.begin() + i + 1 );
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    void Atlas::add_page()
+    {
+        Page page;
+        page.skyline.push_back( SkylineNode{ 0, 0, page_size_ } );
+
+        glGenTextures( 1, &page.texture );
+        glBindTexture( GL_TEXTURE_2D, page.texture );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, page_size_, page_size_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+        // New pages are undefined, clear them so the gaps between images are transparent
+        std::vector<unsigned char> zeros( static_cast<size_t>(page_size_) * page_size_ * 4, 0 );
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, page_size_, page_size_, GL_RGBA, GL_UNSIGNED_BYTE, zeros.data() );
+
+        pages_.push_back( page );
+    }
+
+    // TEXTURE ARRAY ///////////////////////////////////////////////////////////
+
+    void TextureArray::init( int layers_per_array )
+    {
+        shutdown();
+
+        GLint max_layers = 0;
+        glGetIntegerv( GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers );
+        layers_per_array_ = (max_layers > 0 && layers_per_array > max_layers) ? max_layers : layers_per_array;
+    }
+
+    void TextureArray::shutdown()
+    {
+        for( const Array& array : arrays_ )
+        {
+            glDeleteTextures( 1, &array.texture );
+        }
+        arrays_.clear();
+        regions_.clear();
+    }
+
+    Region TextureArray::add( const std::string& filename )
+    {
+        return add( intern( filename ) );
+    }
+
+    Region TextureArray::add( PathId path )
+    {
+        auto it = regions_.find( getPath( path ) );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        Image image;
+        if( !decode_rgba( path, image ) )
+        {
+            return Region();
+        }
+        Region result = add( getPath( path ), image.data, image.width, image.height );
+        free_image( image );
+        return result;
+    }
+
+    Region TextureArray::add( TJH_TEXTURE_CACHE_HANDLE_TYPENAME handle )
+    {
+        auto it = regions_.find( handle.info().filename );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        std::vector<unsigned char> rgba;
+        if( !read_rgba( handle, rgba ) )
+        {
+            return Region();
+        }
+        return add( handle.info().filename, rgba.data(), handle.info().width, handle.info().height );
+    }
+
+    Region TextureArray::add( const std::string& name, const unsigned char* rgba, int width, int height )
+    {
+        auto it = regions_.find( name );
+        if( it != regions_.end() )
+        {
+            return it->second;
+        }
+
+        size_t index = 0;
+        while( index < arrays_.size() &&
+               (arrays_[index].width != width || arrays_[index].height != height || arrays_[index].used == layers_per_array_) )
+        {
+            index++;
+        }
+
+        if( index == arrays_.size() )
+        {
+            Array array;
+            array.width = width;
+            array.height = height;
+
+            glGenTextures( 1, &array.texture );
+            glBindTexture( GL_TEXTURE_2D_ARRAY, array.texture );
+            glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers_per_array_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+            arrays_.push_back( array );
+        }
+
+        Array& array = arrays_[index];
+
+        Region region;
+        region.texture  = array.texture;
+        region.target   = GL_TEXTURE_2D_ARRAY;
+        region.page     = static_cast<int>(index);
+        region.layer    = array.used++;
+        region.width    = width;
+        region.height   = height;
+        region.u1       = 1.0f;
+        region.v1       = 1.0f;
+
+        glBindTexture( GL_TEXTURE_2D_ARRAY, array.texture );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, region.layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba );
+
+        regions_[name] = region;
+        return region;
     }
 }
 